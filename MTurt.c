@@ -232,7 +232,8 @@ void TurtOnKeyb(void (*func)(SDLKey, SDLMod))
 
 /**
  * Starts filling a region of the drawing surface
- * @param count number of vertices in the polygon to fill
+ * @param count number of vertices in the polygon to fill, or 0 to fill
+ * when TurtEndFill is called
  * @param r fill color (red component)
  * @param g fill color (green component)
  * @param b fill color (blue component)
@@ -241,3 +242,11 @@ void TurtBeginFill(int count, Uint32 r, Uint32 g, Uint32 b)
 {
     TT_BeginFill(turt, count, r, g, b);
 }
+
+/**
+ * Fills the polygon made of the vertices visited since TurtBeginFill
+ */
+void TurtEndFill()
+{
+    TT_EndFill(turt);
+}
@@ -23,15 +23,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <math.h>
 #include <SDL/SDL.h>
 #include <SDL/SDL_image.h>
 #include <SDL/SDL_ttf.h>
+#include <png.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
 #include "SDL_rotozoom.h"
-#include "SDL_gfxPrimitives.h"
 #include "SDL_draw.h"
 #include "MTurtle.h"
+#include "MTurtleRaster.h"
 
 #define BITS_PER_PIXEL 32
 #define PI 3.14159265
@@ -41,35 +46,1552 @@
 #define FONT_FILE "miscfixed.ttf"
 #define FONT_SIZE 12 /* in pt */
 
+#ifndef CURSOR_ANGLE_STEP
+#define CURSOR_ANGLE_STEP 1 /* in degrees, must divide 360 */
+#endif
+#define CURSOR_SPRITE_COUNT (360 / CURSOR_ANGLE_STEP)
+
+#define REPLAY_TILE_SIZE 64 /* in pixels */
+
+#define GLYPH_COUNT 256 /* Latin-1 */
+#define GLYPH_ATLAS_COLUMNS 16
+#define GLYPH_ATLAS_COUNT 16 /* text colors with cached glyphs */
+#define TEXT_CACHE_SIZE 64 /* recently written strings kept rendered */
+#define FILL_INITIAL_CAPACITY 16 /* vertices, for fills ended by TT_EndFill */
+
 SDL_Surface* tt_screen;
 SDL_Surface* tt_baseCursor;
+SDL_Surface* tt_cursorCache[CURSOR_SPRITE_COUNT]; /* pre-rotated cursors */
 TTF_Font* tt_font;
+bool tt_headless = false;
+SDL_mutex* tt_textLock = NULL;  /* glyph atlases and text cache, shared by all turtles */
+
+/**
+ * How shape coordinates are given, to find the tiles it touches.
+ */
+typedef enum {
+    SHAPE_BOX,
+    SHAPE_LINE,
+    SHAPE_RING
+} shape_type;
+
+/**
+ * A surface to draw on, and its world position.
+ */
+struct draw_target
+{
+    SDL_Surface* surface;
+    int x;
+    int y;
+};
+
+/**
+ * Glyphs of tt_font rendered in one color, in a grid of
+ * GLYPH_ATLAS_COLUMNS cells per row. Cells are rendered on first use.
+ */
+struct glyph_atlas
+{
+    SDL_Color color;
+    SDL_Surface* surface;           /* NULL until the first glyph */
+    bool isRendered[GLYPH_COUNT];
+    Uint32 lastUsed;                /* for recycling */
+};
+
+/**
+ * A rendered string, for TT_WriteText.
+ */
+struct text_cache_entry
+{
+    char* str;                      /* NULL if unused */
+    SDL_Color color;
+    SDL_Surface* surface;
+    Uint32 lastUsed;                /* for recycling */
+};
+
+struct glyph_atlas tt_glyphAtlases[GLYPH_ATLAS_COUNT];
+struct text_cache_entry tt_textCache[TEXT_CACHE_SIZE];
+Uint32 tt_textClock = 0;        /* text cache use counter */
+int tt_glyphCellW = 0;          /* glyph atlas cell size */
+int tt_glyphCellH = 0;
+int tt_glyphWidth[GLYPH_COUNT]; /* rendered glyph width */
+int tt_glyphAdvance[GLYPH_COUNT];
+
+/**
+ * A display list replay, shared by all the threads taking part in it.
+ */
+struct replay_job
+{
+    struct TT_DisplayList* list;    /* commands to draw */
+    SDL_PixelFormat* srcFormat;     /* format of the recorded colors */
+    SDL_Surface* dest;              /* target surface */
+    float scale;                    /* coordinate scale factor */
+    bool sameFormat;                /* can colors be used as-is? */
+    SDL_Surface** texts;            /* pre-rendered text, per command */
+    int maxPolygon;                 /* largest polygon vertex count */
+    int tilesX;                     /* tile columns */
+    int tilesY;                     /* tile rows */
+    int* tileStart;                 /* per tile, first index in tileCmds */
+    int* tileCmds;                  /* command indices, binned by tile */
+    int nextTile;                   /* next tile to rasterize */
+    SDL_mutex* lock;                /* protects nextTile */
+};
+
+/**
+ * Per-thread state of a display list replay.
+ */
+struct replay_worker
+{
+    struct replay_job* job;
+    SDL_Thread* thread;
+};
+
+
+/**
+ * Change from an "int color" to an SDL_Color
+ * via http://www.gamedev.net/topic/291015-cannot-convert-from-uint32-to-sdl_color/
+ * @param int_color
+ * @return
+ */
+SDL_Color translate_color(Uint32 int_color)
+{
+    #if SDL_BYTEORDER == SDL_BIG_ENDIAN
+        SDL_Color color={(int_color & 0x00ff0000)/0x10000,(int_color &
+0x0000ff00)/0x100,(int_color & 0x000000ff),0};
+    #else
+        SDL_Color color={(int_color & 0x000000ff),(int_color &
+0x0000ff00)/0x100,(int_color & 0x00ff0000)/0x10000,0};
+    #endif
+    return color;
+}
+
+float mod(float x, float y)
+{
+    float r = fmod(x, y);
+    return r < 0 ? r + y : r;
+}
+
+/**
+ * Renders one rotated cursor sprite per CURSOR_ANGLE_STEP degrees,
+ * converted to the screen format, so that blitting the cursor is
+ * only a table lookup.
+ */
+void build_cursor_cache()
+{
+    int i;
+    for(i = 0; i < CURSOR_SPRITE_COUNT; i++)
+    {
+        tt_cursorCache[i] = NULL;
+
+        if(tt_baseCursor == NULL)
+        {
+            continue;
+        }
+
+        SDL_Surface* rotated = rotozoomSurface(tt_baseCursor, -(i * CURSOR_ANGLE_STEP), 1.0, 1);
+        if(rotated == NULL)
+        {
+            continue;
+        }
+
+        tt_cursorCache[i] = SDL_DisplayFormatAlpha(rotated);
+        if(tt_cursorCache[i] == NULL)
+        {
+            /* Keep Unconverted Sprite */
+            tt_cursorCache[i] = rotated;
+        }
+        else
+        {
+            SDL_FreeSurface(rotated);
+        }
+    }
+}
+
+/**
+ * Frees the pre-rotated cursor sprites.
+ */
+void free_cursor_cache()
+{
+    int i;
+    for(i = 0; i < CURSOR_SPRITE_COUNT; i++)
+    {
+        SDL_FreeSurface(tt_cursorCache[i]);
+        tt_cursorCache[i] = NULL;
+    }
+}
+
+/**
+ * Returns the cached cursor sprite closest to the given orientation
+ * @param angle in degrees, within [0, 360[
+ * @return
+ */
+SDL_Surface* get_cursor_sprite(float angle)
+{
+    int index = (int) (angle / CURSOR_ANGLE_STEP + 0.5f) % CURSOR_SPRITE_COUNT;
+    return tt_cursorCache[index];
+}
+
+/**
+ * Tells whether two colors are the same (alpha is ignored)
+ * @param a
+ * @param b
+ * @return
+ */
+bool same_color(SDL_Color a, SDL_Color b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+/**
+ * Measures the glyph cells (the widest glyph and the font height), once
+ */
+void init_glyph_metrics()
+{
+    if(tt_glyphCellH > 0)
+    {
+        return;
+    }
+
+    tt_glyphCellH = TTF_FontHeight(tt_font);
+    tt_glyphCellW = 1;
+
+    int i;
+    for(i = 1; i < GLYPH_COUNT; i++)
+    {
+        char str[2] = {(char) i, '\0'};
+        int w, h;
+        if(TTF_SizeText(tt_font, str, &w, &h) == 0 && w > tt_glyphCellW)
+        {
+            tt_glyphCellW = w;
+        }
+    }
+}
+
+/**
+ * Returns the glyph atlas for a color, creating it (or recycling the
+ * least recently used one) as necessary
+ * @param color
+ * @return
+ */
+struct glyph_atlas* get_glyph_atlas(SDL_Color color)
+{
+    struct glyph_atlas* victim = &tt_glyphAtlases[0];
+
+    int i;
+    for(i = 0; i < GLYPH_ATLAS_COUNT; i++)
+    {
+        struct glyph_atlas* atlas = &tt_glyphAtlases[i];
+        if(atlas->surface != NULL && same_color(atlas->color, color))
+        {
+            atlas->lastUsed = ++tt_textClock;
+            return atlas;
+        }
+
+        if(atlas->surface == NULL || (victim->surface != NULL && atlas->lastUsed < victim->lastUsed))
+        {
+            victim = atlas;
+        }
+    }
+
+    /* Start Over with Empty Cells */
+    SDL_FreeSurface(victim->surface);
+    victim->surface = NULL;
+    memset(victim->isRendered, 0, sizeof(victim->isRendered));
+    victim->color = color;
+    victim->lastUsed = ++tt_textClock;
+
+    return victim;
+}
+
+/**
+ * Renders a glyph into its atlas cell, if not done yet
+ * @param atlas
+ * @param c character (Latin-1)
+ * @return false if the glyph cannot be rendered
+ */
+bool render_glyph(struct glyph_atlas* atlas, Uint8 c)
+{
+    if(atlas->isRendered[c])
+    {
+        return true;
+    }
+
+    char str[2] = {(char) c, '\0'};
+    SDL_Surface* glyph = TTF_RenderText_Blended(tt_font, str, atlas->color);
+    if(glyph == NULL)
+    {
+        return false;
+    }
+
+    /* Atlas Takes the Format of the Rendered Text */
+    if(atlas->surface == NULL)
+    {
+        SDL_PixelFormat* f = glyph->format;
+        atlas->surface = SDL_CreateRGBSurface(SDL_SWSURFACE, GLYPH_ATLAS_COLUMNS * tt_glyphCellW,
+                                              (GLYPH_COUNT / GLYPH_ATLAS_COLUMNS) * tt_glyphCellH,
+                                              32, f->Rmask, f->Gmask, f->Bmask, f->Amask);
+        if(atlas->surface == NULL)
+        {
+            fprintf(stderr, "render_glyph: cannot create glyph atlas!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Copy Pixels (Alpha Included) into the Cell */
+    int w = glyph->w < tt_glyphCellW ? glyph->w : tt_glyphCellW;
+    int h = glyph->h < tt_glyphCellH ? glyph->h : tt_glyphCellH;
+    int x0 = (c % GLYPH_ATLAS_COLUMNS) * tt_glyphCellW;
+    int y0 = (c / GLYPH_ATLAS_COLUMNS) * tt_glyphCellH;
+
+    SDL_LockSurface(glyph);
+    int j;
+    for(j = 0; j < h; j++)
+    {
+        memcpy((Uint32*) ((Uint8*) atlas->surface->pixels + (y0 + j) * atlas->surface->pitch) + x0,
+               (Uint8*) glyph->pixels + j * glyph->pitch, w * sizeof(Uint32));
+    }
+    SDL_UnlockSurface(glyph);
+
+    /* Glyph Metrics Do Not Depend on the Color */
+    int minx, maxx, miny, maxy, advance;
+    if(TTF_GlyphMetrics(tt_font, c, &minx, &maxx, &miny, &maxy, &advance) != 0)
+    {
+        advance = glyph->w;
+    }
+    tt_glyphWidth[c] = w;
+    tt_glyphAdvance[c] = advance;
+
+    SDL_FreeSurface(glyph);
+    atlas->isRendered[c] = true;
+
+    return true;
+}
+
+/**
+ * Renders a string from the glyph atlas of its color, like
+ * TTF_RenderText_Blended does
+ * @param str
+ * @param color
+ * @return new surface (to be freed), or NULL if there is nothing to draw
+ */
+SDL_Surface* build_text_surface(const char* str, SDL_Color color)
+{
+    if(tt_font == NULL)
+    {
+        return NULL;
+    }
+
+    init_glyph_metrics();
+    struct glyph_atlas* atlas = get_glyph_atlas(color);
+
+    /* Render Missing Glyphs, Measure String */
+    int w = 0, pen = 0;
+    const Uint8* p;
+    for(p = (const Uint8*) str; *p != '\0'; p++)
+    {
+        if(!render_glyph(atlas, *p))
+        {
+            return NULL;
+        }
+
+        w = pen + tt_glyphWidth[*p] > w ? pen + tt_glyphWidth[*p] : w;
+        pen += tt_glyphAdvance[*p];
+    }
+    w = pen > w ? pen : w;
+
+    if(w <= 0)
+    {
+        return NULL;
+    }
+
+    SDL_PixelFormat* f = atlas->surface->format;
+    SDL_Surface* text = SDL_CreateRGBSurface(SDL_SWSURFACE, w, tt_glyphCellH, 32,
+                                             f->Rmask, f->Gmask, f->Bmask, f->Amask);
+    if(text == NULL)
+    {
+        return NULL;
+    }
+
+    /* Transparent Background of the Text Color */
+    SDL_FillRect(text, NULL, SDL_MapRGBA(text->format, color.r, color.g, color.b, 0));
+
+    /* Assemble Glyphs (Overlaps Keep the Most Opaque Pixel) */
+    pen = 0;
+    for(p = (const Uint8*) str; *p != '\0'; p++)
+    {
+        int x0 = (*p % GLYPH_ATLAS_COLUMNS) * tt_glyphCellW;
+        int y0 = (*p / GLYPH_ATLAS_COLUMNS) * tt_glyphCellH;
+
+        int i, j;
+        for(j = 0; j < tt_glyphCellH; j++)
+        {
+            Uint32* s = (Uint32*) ((Uint8*) atlas->surface->pixels + (y0 + j) * atlas->surface->pitch) + x0;
+            Uint32* d = (Uint32*) ((Uint8*) text->pixels + j * text->pitch) + pen;
+
+            for(i = 0; i < tt_glyphWidth[*p]; i++)
+            {
+                if((s[i] & f->Amask) > (d[i] & f->Amask))
+                {
+                    d[i] = s[i];
+                }
+            }
+        }
+
+        pen += tt_glyphAdvance[*p];
+    }
+
+    return text;
+}
+
+/**
+ * Returns the rendering of a string, from the cache of recently written
+ * strings if possible
+ * @param str
+ * @param color
+ * @return surface owned by the cache, valid until the next call; NULL if
+ * there is nothing to draw. Hold tt_textLock until done with it.
+ */
+SDL_Surface* get_text_surface(const char* str, SDL_Color color)
+{
+    struct text_cache_entry* victim = &tt_textCache[0];
+
+    int i;
+    for(i = 0; i < TEXT_CACHE_SIZE; i++)
+    {
+        struct text_cache_entry* entry = &tt_textCache[i];
+        if(entry->str != NULL && same_color(entry->color, color) && strcmp(entry->str, str) == 0)
+        {
+            entry->lastUsed = ++tt_textClock;
+            return entry->surface;
+        }
+
+        if(entry->str == NULL || (victim->str != NULL && entry->lastUsed < victim->lastUsed))
+        {
+            victim = entry;
+        }
+    }
+
+    SDL_Surface* text = build_text_surface(str, color);
+    if(text == NULL)
+    {
+        return NULL;
+    }
+
+    /* Replace Least Recently Used String */
+    free(victim->str);
+    SDL_FreeSurface(victim->surface);
+    victim->str = strdup(str);
+    victim->color = color;
+    victim->surface = text;
+    victim->lastUsed = ++tt_textClock;
+
+    if(victim->str == NULL)
+    {
+        fprintf(stderr, "get_text_surface: strdup failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return text;
+}
+
+/**
+ * Frees the glyph atlases and the cached strings.
+ */
+void free_text_cache()
+{
+    int i;
+    for(i = 0; i < GLYPH_ATLAS_COUNT; i++)
+    {
+        SDL_FreeSurface(tt_glyphAtlases[i].surface);
+        tt_glyphAtlases[i].surface = NULL;
+    }
+
+    for(i = 0; i < TEXT_CACHE_SIZE; i++)
+    {
+        free(tt_textCache[i].str);
+        SDL_FreeSurface(tt_textCache[i].surface);
+        tt_textCache[i].str = NULL;
+        tt_textCache[i].surface = NULL;
+    }
+
+    tt_glyphCellH = 0;
+}
+
+
+/**
+ * Tells whether the turtle is on its surface (always true, except on
+ * a sparse canvas)
+ * @param turt
+ * @return
+ */
+bool is_turtle_in_view(struct Turtle* turt)
+{
+    return turt->x >= turt->viewX && turt->x < turt->viewX + turt->surface->w
+           && turt->y >= turt->viewY && turt->y < turt->viewY + turt->surface->h;
+}
+
+/**
+ * Records an area of the turtle surface as modified, so that the next
+ * present updates it.
+ * @param turt
+ * @param x world coordinates
+ * @param y
+ * @param w
+ * @param h
+ */
+void mark_dirty(struct Turtle* turt, int x, int y, int w, int h)
+{
+    /* World to Surface Coordinates */
+    x -= turt->viewX;
+    y -= turt->viewY;
+
+    /* Clip to Surface */
+    if(x < 0)
+    {
+        w += x;
+        x = 0;
+    }
+    if(y < 0)
+    {
+        h += y;
+        y = 0;
+    }
+    if(x + w > turt->surface->w)
+    {
+        w = turt->surface->w - x;
+    }
+    if(y + h > turt->surface->h)
+    {
+        h = turt->surface->h - y;
+    }
+    if(w <= 0 || h <= 0 || turt->isAllDirty)
+    {
+        return;
+    }
+
+    /* Too Many Areas: Merge Everything into Bounding Box */
+    if(turt->dirtyCount >= TT_MAX_DIRTY_RECTS)
+    {
+        int x1 = x, y1 = y, x2 = x + w, y2 = y + h;
+        int i;
+        for(i = 0; i < turt->dirtyCount; i++)
+        {
+            SDL_Rect* r = &(turt->dirtyRects[i]);
+            x1 = r->x < x1 ? r->x : x1;
+            y1 = r->y < y1 ? r->y : y1;
+            x2 = r->x + r->w > x2 ? r->x + r->w : x2;
+            y2 = r->y + r->h > y2 ? r->y + r->h : y2;
+        }
+
+        turt->dirtyCount = 0;
+        x = x1;
+        y = y1;
+        w = x2 - x1;
+        h = y2 - y1;
+    }
+
+    SDL_Rect* r = &(turt->dirtyRects[turt->dirtyCount]);
+    r->x = x;
+    r->y = y;
+    r->w = w;
+    r->h = h;
+    turt->dirtyCount ++;
+}
+
+/**
+ * Records the bounding box of a line as modified
+ * @param turt
+ * @param x1
+ * @param y1
+ * @param x2
+ * @param y2
+ */
+void mark_dirty_line(struct Turtle* turt, int x1, int y1, int x2, int y2)
+{
+    int x = x1 < x2 ? x1 : x2;
+    int y = y1 < y2 ? y1 : y2;
+    mark_dirty(turt, x, y, abs(x2 - x1) + 1, abs(y2 - y1) + 1);
+}
+
+/**
+ * Clips a rectangle to the screen
+ * @param rect
+ * @return false if nothing is left
+ */
+bool clip_to_screen(SDL_Rect* rect)
+{
+    int x1 = rect->x < 0 ? 0 : rect->x;
+    int y1 = rect->y < 0 ? 0 : rect->y;
+    int x2 = rect->x + rect->w > tt_screen->w ? tt_screen->w : rect->x + rect->w;
+    int y2 = rect->y + rect->h > tt_screen->h ? tt_screen->h : rect->y + rect->h;
+
+    if(x2 <= x1 || y2 <= y1)
+    {
+        return false;
+    }
+
+    rect->x = x1;
+    rect->y = y1;
+    rect->w = x2 - x1;
+    rect->h = y2 - y1;
+    return true;
+}
+
+/**
+ * Repaints an area of the screen from the turtle surface (or the
+ * background color outside of it), without the cursor
+ * @param turt
+ * @param area screen coordinates, already clipped to the screen
+ */
+void repaint_area(struct Turtle* turt, SDL_Rect* area)
+{
+    SDL_Rect dst = *area;
+    SDL_FillRect(tt_screen, &dst, turt->bgColor);
+
+    SDL_Rect src;
+    src.x = area->x - turt->surfacePos.x;
+    src.y = area->y - turt->surfacePos.y;
+    src.w = area->w;
+    src.h = area->h;
+
+    dst = *area;
+    SDL_BlitSurface(turt->surface, &src, tt_screen, &dst);
+}
+
+/**
+ * Presents the modified areas of the turtle surface and the cursor,
+ * or nothing at all if nothing changed since the last present
+ * @param turt
+ * @return true if anything was presented
+ */
+bool present_dirty(struct Turtle* turt)
+{
+    /* Where Does the Cursor Go? */
+    SDL_Surface* sprite = turt->isVisible && is_turtle_in_view(turt) ? get_cursor_sprite(turt->angle) : NULL;
+    SDL_Rect cursorRect = {0, 0, 0, 0};
+    if(sprite != NULL)
+    {
+        cursorRect.x = (turt->x - turt->viewX - sprite->w / 2) + turt->surfacePos.x;
+        cursorRect.y = (turt->y - turt->viewY - sprite->h / 2) + turt->surfacePos.y;
+        cursorRect.w = sprite->w;
+        cursorRect.h = sprite->h;
+    }
+
+    bool cursorMoved = sprite != turt->cursorSprite
+                       || cursorRect.x != turt->cursorRect.x
+                       || cursorRect.y != turt->cursorRect.y;
+
+    /* Nothing to Do */
+    if(!turt->isAllDirty && turt->dirtyCount == 0 && !cursorMoved)
+    {
+        return false;
+    }
+
+    if(turt->isAllDirty || (tt_screen->flags & SDL_DOUBLEBUF))
+    {
+        /* Full Redraw */
+        SDL_FillRect(tt_screen, NULL, turt->bgColor);
+        TT_Blit(turt);
+        SDL_Flip(tt_screen);
+    }
+    else
+    {
+        SDL_Rect rects[TT_MAX_DIRTY_RECTS + 2];
+        int count = 0;
+        int i;
+
+        /* Repaint Modified Areas */
+        for(i = 0; i < turt->dirtyCount; i++)
+        {
+            rects[count] = turt->dirtyRects[i];
+            rects[count].x += turt->surfacePos.x;
+            rects[count].y += turt->surfacePos.y;
+            if(clip_to_screen(&rects[count]))
+            {
+                repaint_area(turt, &rects[count]);
+                count ++;
+            }
+        }
+
+        /* Erase Old Cursor */
+        rects[count] = turt->cursorRect;
+        if(turt->cursorSprite != NULL && clip_to_screen(&rects[count]))
+        {
+            repaint_area(turt, &rects[count]);
+            count ++;
+        }
+
+        /* Paint New Cursor */
+        if(sprite != NULL)
+        {
+            SDL_Rect cursorPos = cursorRect;
+            SDL_BlitSurface(sprite, NULL, tt_screen, &cursorPos);
+
+            rects[count] = cursorRect;
+            if(clip_to_screen(&rects[count]))
+            {
+                count ++;
+            }
+        }
+
+        SDL_UpdateRects(tt_screen, count, rects);
+    }
+
+    /* Everything is Up to Date */
+    turt->dirtyCount = 0;
+    turt->isAllDirty = false;
+    turt->cursorRect = cursorRect;
+    turt->cursorSprite = sprite;
+
+    return true;
+}
+
+/**
+ * Dispatches one user event to the turtle's handlers
+ * @param turt
+ * @param ev
+ * @return false if the user asked to quit
+ */
+bool handle_event(struct Turtle* turt, SDL_Event* ev)
+{
+    /* User Exit */
+    if(ev->type == SDL_QUIT)
+    {
+        return false;
+    }
+
+    /* User Keyboard Press */
+    if(ev->type == SDL_KEYDOWN)
+    {
+        SDLKey sym = ev->key.keysym.sym;
+        if(turt->onkeyb != NULL)
+        {
+            turt->onkeyb(sym, ev->key.keysym.mod);
+        }
+        else if(sym == SDLK_ESCAPE || sym == SDLK_q)
+        {
+            return false;
+        }
+    }
+
+    /* User Mouse Click */
+    if(ev->type == SDL_MOUSEBUTTONUP && ev->button.button == SDL_BUTTON_LEFT
+            && turt->onclick != NULL)
+    {
+        turt->onclick(ev->button.x, ev->button.y);
+    }
+
+    return true;
+}
+
+/**
+ * Grows a buffer so that it can hold at least `needed' elements
+ * @param buf
+ * @param capacity current capacity, updated
+ * @param needed
+ * @param size element size
+ */
+void grow_buffer(void** buf, int* capacity, int needed, size_t size)
+{
+    if(needed <= *capacity)
+    {
+        return;
+    }
+
+    int newCapacity = *capacity > 0 ? *capacity : 64;
+    while(newCapacity < needed)
+    {
+        newCapacity *= 2;
+    }
+
+    void* newBuf = realloc(*buf, newCapacity * size);
+    if(newBuf == NULL)
+    {
+        fprintf(stderr, "grow_buffer: realloc failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *buf = newBuf;
+    *capacity = newCapacity;
+}
+
+/**
+ * Locks a surface for direct pixel access, if needed
+ * @param surface
+ */
+void lock_surface(SDL_Surface* surface)
+{
+    if(SDL_MUSTLOCK(surface))
+    {
+        SDL_LockSurface(surface);
+    }
+}
+
+/**
+ * Unlocks a surface locked with lock_surface
+ * @param surface
+ */
+void unlock_surface(SDL_Surface* surface)
+{
+    if(SDL_MUSTLOCK(surface))
+    {
+        SDL_UnlockSurface(surface);
+    }
+}
+
+/**
+ * Appends a command to a display list
+ * @param list
+ * @param op
+ * @param color
+ * @param a
+ * @param b
+ * @param c
+ * @param d
+ */
+void record_command(struct TT_DisplayList* list, TT_Op op, Uint32 color, int a, int b, int c, int d)
+{
+    grow_buffer((void**) &(list->cmds), &(list->capacity), list->count + 1, sizeof(struct TT_Command));
+
+    struct TT_Command* cmd = &(list->cmds[list->count]);
+    cmd->op = op;
+    cmd->color = color;
+    cmd->a = a;
+    cmd->b = b;
+    cmd->c = c;
+    cmd->d = d;
+    list->count ++;
+}
+
+/**
+ * Returns the index of the tile containing a world coordinate
+ * @param v
+ * @return
+ */
+int tile_index(int v)
+{
+    return v >= 0 ? v / TT_TILE_SIZE : -((-v + TT_TILE_SIZE - 1) / TT_TILE_SIZE);
+}
+
+/**
+ * Returns the hash table slot of a tile, or of the empty slot where it
+ * would go
+ * @param tiles
+ * @param capacity
+ * @param tx
+ * @param ty
+ * @return
+ */
+struct TT_Tile* find_tile_slot(struct TT_Tile* tiles, int capacity, int tx, int ty)
+{
+    Uint32 h = ((Uint32) tx * 73856093u) ^ ((Uint32) ty * 19349663u);
+    int i = h & (capacity - 1);
+
+    while(tiles[i].surface != NULL && (tiles[i].tx != tx || tiles[i].ty != ty))
+    {
+        i = (i + 1) & (capacity - 1);
+    }
+
+    return &tiles[i];
+}
+
+/**
+ * Returns a tile of a sparse canvas
+ * @param turt
+ * @param tx
+ * @param ty
+ * @param create allocate the tile (filled with the background color) if
+ * it does not exist yet
+ * @return NULL if the tile does not exist and create is false
+ */
+SDL_Surface* get_tile(struct Turtle* turt, int tx, int ty, bool create)
+{
+    if(turt->tileCapacity > 0)
+    {
+        struct TT_Tile* tile = find_tile_slot(turt->tiles, turt->tileCapacity, tx, ty);
+        if(tile->surface != NULL || !create)
+        {
+            return tile->surface;
+        }
+    }
+    else if(!create)
+    {
+        return NULL;
+    }
+
+    /* Keep the Table at Most Half Full */
+    if(2 * (turt->tileCount + 1) > turt->tileCapacity)
+    {
+        int capacity = turt->tileCapacity > 0 ? 2 * turt->tileCapacity : 64;
+        struct TT_Tile* tiles = calloc(capacity, sizeof(struct TT_Tile));
+        if(tiles == NULL)
+        {
+            fprintf(stderr, "get_tile: calloc failed!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        int i;
+        for(i = 0; i < turt->tileCapacity; i++)
+        {
+            if(turt->tiles[i].surface != NULL)
+            {
+                *find_tile_slot(tiles, capacity, turt->tiles[i].tx, turt->tiles[i].ty) = turt->tiles[i];
+            }
+        }
+
+        free(turt->tiles);
+        turt->tiles = tiles;
+        turt->tileCapacity = capacity;
+    }
+
+    SDL_PixelFormat* f = turt->surface->format;
+    SDL_Surface* surface = SDL_CreateRGBSurface(SDL_SWSURFACE, TT_TILE_SIZE, TT_TILE_SIZE, BITS_PER_PIXEL,
+                                                f->Rmask, f->Gmask, f->Bmask, f->Amask);
+    if(surface == NULL)
+    {
+        fprintf(stderr, "get_tile: cannot create tile: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    SDL_FillRect(surface, NULL, turt->bgColor);
+
+    struct TT_Tile* tile = find_tile_slot(turt->tiles, turt->tileCapacity, tx, ty);
+    tile->tx = tx;
+    tile->ty = ty;
+    tile->surface = surface;
+    turt->tileCount ++;
+
+    return surface;
+}
 
+/**
+ * Frees all the tiles of a sparse canvas
+ * @param turt
+ */
+void free_tiles(struct Turtle* turt)
+{
+    int i;
+    for(i = 0; i < turt->tileCapacity; i++)
+    {
+        SDL_FreeSurface(turt->tiles[i].surface);
+    }
+
+    free(turt->tiles);
+    turt->tiles = NULL;
+    turt->tileCount = 0;
+    turt->tileCapacity = 0;
+}
 
 /**
- * Change from an "int color" to an SDL_Color
- * via http://www.gamedev.net/topic/291015-cannot-convert-from-uint32-to-sdl_color/
- * @param int_color
+ * Copies an area of a sparse canvas onto a surface
+ * @param turt
+ * @param dest
+ * @param x world position of the area
+ * @param y
+ */
+void compose_canvas(struct Turtle* turt, SDL_Surface* dest, int x, int y)
+{
+    SDL_FillRect(dest, NULL, turt->bgColor);
+
+    int tx, ty;
+    for(ty = tile_index(y); ty <= tile_index(y + dest->h - 1); ty++)
+    {
+        for(tx = tile_index(x); tx <= tile_index(x + dest->w - 1); tx++)
+        {
+            SDL_Surface* tile = get_tile(turt, tx, ty, false);
+            if(tile != NULL)
+            {
+                SDL_Rect dst;
+                dst.x = tx * TT_TILE_SIZE - x;
+                dst.y = ty * TT_TILE_SIZE - y;
+                SDL_BlitSurface(tile, NULL, dest, &dst);
+            }
+        }
+    }
+}
+
+/**
+ * Tells whether a line may have pixels in a tile
+ * @param x1
+ * @param y1
+ * @param x2
+ * @param y2
+ * @param tx
+ * @param ty
  * @return
  */
-SDL_Color translate_color(Uint32 int_color)
+bool line_touches(int x1, int y1, int x2, int y2, int tx, int ty)
 {
-    #if SDL_BYTEORDER == SDL_BIG_ENDIAN
-        SDL_Color color={(int_color & 0x00ff0000)/0x10000,(int_color &
-0x0000ff00)/0x100,(int_color & 0x000000ff),0};
-    #else
-        SDL_Color color={(int_color & 0x000000ff),(int_color &
-0x0000ff00)/0x100,(int_color & 0x00ff0000)/0x10000,0};
-    #endif
-    return color;
+    /* Clip the Segment to the Tile, Widened by One Pixel */
+    double xmin = (double) tx * TT_TILE_SIZE - 1.0, xmax = xmin + TT_TILE_SIZE + 1.0;
+    double ymin = (double) ty * TT_TILE_SIZE - 1.0, ymax = ymin + TT_TILE_SIZE + 1.0;
+    double dx = x2 - x1, dy = y2 - y1;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {x1 - xmin, xmax - x1, y1 - ymin, ymax - y1};
+    double t1 = 0.0, t2 = 1.0;
+
+    int i;
+    for(i = 0; i < 4; i++)
+    {
+        if(p[i] == 0.0)
+        {
+            if(q[i] < 0.0)
+            {
+                return false;
+            }
+        }
+        else if(p[i] < 0.0)
+        {
+            t1 = q[i] / p[i] > t1 ? q[i] / p[i] : t1;
+        }
+        else
+        {
+            t2 = q[i] / p[i] < t2 ? q[i] / p[i] : t2;
+        }
+    }
+
+    return t1 <= t2;
 }
 
-float mod(float x, float y)
+/**
+ * Tells whether a circle outline may have pixels in a tile
+ * @param x center
+ * @param y center
+ * @param radius
+ * @param tx
+ * @param ty
+ * @return
+ */
+bool ring_touches(int x, int y, int radius, int tx, int ty)
 {
-    float r = fmod(x, y);
-    return r < 0 ? r + y : r;
+    double x1 = (double) tx * TT_TILE_SIZE, x2 = x1 + TT_TILE_SIZE - 1;
+    double y1 = (double) ty * TT_TILE_SIZE, y2 = y1 + TT_TILE_SIZE - 1;
+
+    /* Nearest and Farthest Points of the Tile */
+    double nx = x < x1 ? x1 : (x > x2 ? x2 : x);
+    double ny = y < y1 ? y1 : (y > y2 ? y2 : y);
+    double fx = fabs(x - x1) > fabs(x - x2) ? x1 : x2;
+    double fy = fabs(y - y1) > fabs(y - y2) ? y1 : y2;
+
+    double dmin = hypot(nx - x, ny - y);
+    double dmax = hypot(fx - x, fy - y);
+
+    return dmin <= radius + 1.0 && dmax >= radius - 1.0;
+}
+
+/**
+ * Lists the surfaces to draw a shape on: the turtle surface and, on a
+ * sparse canvas, the tiles the shape touches (allocated as necessary)
+ * @param turt
+ * @param shape how to read the coordinates
+ * @param x1 SHAPE_BOX: top left; SHAPE_LINE: first end; SHAPE_RING: center
+ * @param y1
+ * @param x2 SHAPE_BOX: bottom right; SHAPE_LINE: second end; SHAPE_RING: radius
+ * @param y2
+ * @return number of targets, in turt->targets
+ */
+int collect_targets(struct Turtle* turt, shape_type shape, int x1, int y1, int x2, int y2)
+{
+    int count = 0;
+
+    /* Turtle Surface */
+    grow_buffer((void**) &(turt->targets), &(turt->targetCapacity), 1, sizeof(struct draw_target));
+    turt->targets[count].surface = turt->surface;
+    turt->targets[count].x = turt->viewX;
+    turt->targets[count].y = turt->viewY;
+    count ++;
+
+    if(!turt->isSparse)
+    {
+        return count;
+    }
+
+    /* Bounding Box */
+    int bx1, by1, bx2, by2;
+    if(shape == SHAPE_RING)
+    {
+        bx1 = x1 - x2;
+        by1 = y1 - x2;
+        bx2 = x1 + x2;
+        by2 = y1 + x2;
+    }
+    else
+    {
+        bx1 = x1 < x2 ? x1 : x2;
+        by1 = y1 < y2 ? y1 : y2;
+        bx2 = x1 > x2 ? x1 : x2;
+        by2 = y1 > y2 ? y1 : y2;
+    }
+
+    /* Tiles */
+    int tx, ty;
+    for(ty = tile_index(by1); ty <= tile_index(by2); ty++)
+    {
+        for(tx = tile_index(bx1); tx <= tile_index(bx2); tx++)
+        {
+            if((shape == SHAPE_LINE && !line_touches(x1, y1, x2, y2, tx, ty))
+               || (shape == SHAPE_RING && !ring_touches(x1, y1, x2, tx, ty)))
+            {
+                continue;
+            }
+
+            grow_buffer((void**) &(turt->targets), &(turt->targetCapacity), count + 1, sizeof(struct draw_target));
+            turt->targets[count].surface = get_tile(turt, tx, ty, true);
+            turt->targets[count].x = tx * TT_TILE_SIZE;
+            turt->targets[count].y = ty * TT_TILE_SIZE;
+            count ++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Draws a line on the turtle surface (and/or records it)
+ * @param turt
+ * @param x1
+ * @param y1
+ * @param x2
+ * @param y2
+ */
+void emit_line(struct Turtle* turt, int x1, int y1, int x2, int y2)
+{
+    if(turt->isRecording)
+    {
+        record_command(&(turt->displayList), TT_OP_LINE, turt->color, x1, y1, x2, y2);
+    }
+
+    if(!turt->isDeferred)
+    {
+        int count = collect_targets(turt, SHAPE_LINE, x1, y1, x2, y2);
+        int i;
+        for(i = 0; i < count; i++)
+        {
+            struct draw_target* t = &(turt->targets[i]);
+            lock_surface(t->surface);
+            raster_line(t->surface, NULL, x1 - t->x, y1 - t->y, x2 - t->x, y2 - t->y, turt->color);
+            unlock_surface(t->surface);
+        }
+        mark_dirty_line(turt, x1, y1, x2, y2);
+    }
+}
+
+/**
+ * Draws a circle on the turtle surface (and/or records it)
+ * @param turt
+ * @param x center
+ * @param y center
+ * @param radius
+ */
+void emit_circle(struct Turtle* turt, int x, int y, int radius)
+{
+    if(turt->isRecording)
+    {
+        record_command(&(turt->displayList), TT_OP_CIRCLE, turt->color, x, y, radius, 0);
+    }
+
+    if(!turt->isDeferred)
+    {
+        int count = collect_targets(turt, SHAPE_RING, x, y, radius, 0);
+        int i;
+        for(i = 0; i < count; i++)
+        {
+            struct draw_target* t = &(turt->targets[i]);
+            lock_surface(t->surface);
+            raster_circle(t->surface, NULL, x - t->x, y - t->y, radius, turt->color);
+            unlock_surface(t->surface);
+        }
+        mark_dirty(turt, x - radius, y - radius, 2 * radius + 1, 2 * radius + 1);
+    }
+}
+
+/**
+ * Draws an arc of circle, at most a quarter turn long, on the turtle
+ * surface (and/or records it)
+ * @param turt
+ * @param x center
+ * @param y center
+ * @param radius
+ * @param ax direction of the arc start (from the center)
+ * @param ay
+ * @param bx direction of the arc end (clockwise from the start)
+ * @param by
+ */
+void emit_arc(struct Turtle* turt, int x, int y, int radius, int ax, int ay, int bx, int by)
+{
+    if(turt->isRecording)
+    {
+        struct TT_DisplayList* list = &(turt->displayList);
+        grow_buffer((void**) &(list->verts), &(list->vertCapacity), list->vertCount + 2, 2 * sizeof(int));
+
+        list->verts[2 * list->vertCount] = ax;
+        list->verts[2 * list->vertCount + 1] = ay;
+        list->verts[2 * list->vertCount + 2] = bx;
+        list->verts[2 * list->vertCount + 3] = by;
+
+        record_command(list, TT_OP_ARC, turt->color, x, y, radius, list->vertCount);
+        list->vertCount += 2;
+    }
+
+    if(!turt->isDeferred)
+    {
+        int count = collect_targets(turt, SHAPE_RING, x, y, radius, 0);
+        int i;
+        for(i = 0; i < count; i++)
+        {
+            struct draw_target* t = &(turt->targets[i]);
+            lock_surface(t->surface);
+            raster_arc(t->surface, NULL, x - t->x, y - t->y, radius, ax, ay, bx, by, turt->color);
+            unlock_surface(t->surface);
+        }
+        mark_dirty(turt, x - radius, y - radius, 2 * radius + 1, 2 * radius + 1);
+    }
+}
+
+/**
+ * Fills a polygon on the turtle surface (and/or records it)
+ * @param turt
+ * @param vx vertices (X)
+ * @param vy vertices (Y)
+ * @param count vertex count
+ * @param color surface color
+ */
+void emit_polygon(struct Turtle* turt, int* vx, int* vy, int count, Uint32 color)
+{
+    if(turt->isRecording)
+    {
+        struct TT_DisplayList* list = &(turt->displayList);
+        grow_buffer((void**) &(list->verts), &(list->vertCapacity), list->vertCount + count, 2 * sizeof(int));
+
+        int i;
+        for(i = 0; i < count; i++)
+        {
+            list->verts[2 * (list->vertCount + i)] = vx[i];
+            list->verts[2 * (list->vertCount + i) + 1] = vy[i];
+        }
+
+        record_command(list, TT_OP_POLYGON, color, list->vertCount, count, 0, 0);
+        list->vertCount += count;
+    }
+
+    if(!turt->isDeferred)
+    {
+        /* Polygon Bounding Box */
+        int x1 = vx[0], y1 = vy[0], x2 = vx[0], y2 = vy[0];
+        int i, j;
+        for(i = 1; i < count; i++)
+        {
+            x1 = vx[i] < x1 ? vx[i] : x1;
+            y1 = vy[i] < y1 ? vy[i] : y1;
+            x2 = vx[i] > x2 ? vx[i] : x2;
+            y2 = vy[i] > y2 ? vy[i] : y2;
+        }
+
+        /* Draw with Vertices Relative to Each Target */
+        int targets = collect_targets(turt, SHAPE_BOX, x1, y1, x2, y2);
+        for(i = 0; i < targets; i++)
+        {
+            struct draw_target* t = &(turt->targets[i]);
+            for(j = 0; j < count; j++)
+            {
+                vx[j] -= t->x;
+                vy[j] -= t->y;
+            }
+
+            lock_surface(t->surface);
+            raster_polygon(t->surface, NULL, vx, vy, count, color, &(turt->fillScratch), &(turt->fillScratchSize));
+            unlock_surface(t->surface);
+
+            for(j = 0; j < count; j++)
+            {
+                vx[j] += t->x;
+                vy[j] += t->y;
+            }
+        }
+        mark_dirty_line(turt, x1, y1, x2, y2);
+    }
+}
+
+/**
+ * Writes text on the turtle surface (and/or records it)
+ * @param turt
+ * @param x
+ * @param y
+ * @param str
+ */
+void emit_text(struct Turtle* turt, int x, int y, const char* str)
+{
+    if(turt->isRecording)
+    {
+        struct TT_DisplayList* list = &(turt->displayList);
+        int lg = strlen(str) + 1;
+        grow_buffer((void**) &(list->text), &(list->textCapacity), list->textSize + lg, sizeof(char));
+
+        memcpy(list->text + list->textSize, str, lg);
+        record_command(list, TT_OP_TEXT, turt->color, x, y, list->textSize, 0);
+        list->textSize += lg;
+    }
+
+    if(!turt->isDeferred)
+    {
+        /* Other Turtles May Write Meanwhile, in Other Threads */
+        SDL_LockMutex(tt_textLock);
+        SDL_Surface* text = get_text_surface(str, translate_color(turt->color));
+        if(text != NULL)
+        {
+            int count = collect_targets(turt, SHAPE_BOX, x, y, x + text->w - 1, y + text->h - 1);
+            int i;
+            for(i = 0; i < count; i++)
+            {
+                struct draw_target* t = &(turt->targets[i]);
+                lock_surface(t->surface);
+                raster_blend(t->surface, NULL, text, x - t->x, y - t->y);
+                unlock_surface(t->surface);
+            }
+            mark_dirty(turt, x, y, text->w, text->h);
+        }
+        SDL_UnlockMutex(tt_textLock);
+    }
+}
+
+/**
+ * Clears the turtle surface (and/or records it)
+ * @param turt
+ */
+void emit_clear(struct Turtle* turt)
+{
+    if(turt->isRecording)
+    {
+        record_command(&(turt->displayList), TT_OP_CLEAR, turt->bgColor, 0, 0, 0, 0);
+    }
+
+    if(!turt->isDeferred)
+    {
+        free_tiles(turt);
+        SDL_FillRect(turt->surface, NULL, turt->bgColor);
+        turt->isAllDirty = true;
+    }
+}
+
+/**
+ * Returns the number of online processors (1 if unknown)
+ * @return
+ */
+int get_processor_count()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * Scales a recorded coordinate for replay
+ * @param job
+ * @param v
+ * @return
+ */
+int replay_coord(struct replay_job* job, int v)
+{
+    return (int) round(v * job->scale);
+}
+
+/**
+ * Computes the area of the target surface a recorded command may
+ * touch during replay
+ * @param job
+ * @param index command index
+ * @param x1 left (inclusive)
+ * @param y1 top (inclusive)
+ * @param x2 right (inclusive)
+ * @param y2 bottom (inclusive)
+ * @return false if the command is not visible at all
+ */
+bool get_command_bounds(struct replay_job* job, int index, int* x1, int* y1, int* x2, int* y2)
+{
+    struct TT_Command* cmd = &(job->list->cmds[index]);
+    int i, r;
+
+    switch(cmd->op)
+    {
+    case TT_OP_LINE:
+        *x1 = replay_coord(job, cmd->a < cmd->c ? cmd->a : cmd->c);
+        *y1 = replay_coord(job, cmd->b < cmd->d ? cmd->b : cmd->d);
+        *x2 = replay_coord(job, cmd->a > cmd->c ? cmd->a : cmd->c);
+        *y2 = replay_coord(job, cmd->b > cmd->d ? cmd->b : cmd->d);
+        break;
+    case TT_OP_CIRCLE:
+    case TT_OP_ARC:
+        r = replay_coord(job, cmd->c);
+        *x1 = replay_coord(job, cmd->a) - r;
+        *y1 = replay_coord(job, cmd->b) - r;
+        *x2 = replay_coord(job, cmd->a) + r;
+        *y2 = replay_coord(job, cmd->b) + r;
+        break;
+    case TT_OP_POLYGON:
+        *x1 = *x2 = replay_coord(job, job->list->verts[2 * cmd->a]);
+        *y1 = *y2 = replay_coord(job, job->list->verts[2 * cmd->a + 1]);
+        for(i = 1; i < cmd->b; i++)
+        {
+            int x = replay_coord(job, job->list->verts[2 * (cmd->a + i)]);
+            int y = replay_coord(job, job->list->verts[2 * (cmd->a + i) + 1]);
+            *x1 = x < *x1 ? x : *x1;
+            *y1 = y < *y1 ? y : *y1;
+            *x2 = x > *x2 ? x : *x2;
+            *y2 = y > *y2 ? y : *y2;
+        }
+        break;
+    case TT_OP_TEXT:
+        if(job->texts[index] == NULL)
+        {
+            return false;
+        }
+        *x1 = replay_coord(job, cmd->a);
+        *y1 = replay_coord(job, cmd->b);
+        *x2 = *x1 + job->texts[index]->w - 1;
+        *y2 = *y1 + job->texts[index]->h - 1;
+        break;
+    default: /* TT_OP_CLEAR */
+        *x1 = 0;
+        *y1 = 0;
+        *x2 = job->dest->w - 1;
+        *y2 = job->dest->h - 1;
+        break;
+    }
+
+    /* Clip to Target */
+    *x1 = *x1 < 0 ? 0 : *x1;
+    *y1 = *y1 < 0 ? 0 : *y1;
+    *x2 = *x2 >= job->dest->w ? job->dest->w - 1 : *x2;
+    *y2 = *y2 >= job->dest->h ? job->dest->h - 1 : *y2;
+
+    return *x1 <= *x2 && *y1 <= *y2;
+}
+
+/**
+ * Draws one recorded command, clipped
+ * @param job
+ * @param view surface sharing the target's pixels, clipped to `clip'
+ * @param clip
+ * @param index command index
+ * @param vx polygon vertex scratch buffer (X)
+ * @param vy polygon vertex scratch buffer (Y)
+ * @param scratch polygon filler work buffer
+ * @param scratchSize polygon filler work buffer size
+ */
+void replay_command(struct replay_job* job, SDL_Surface* view, SDL_Rect* clip, int index,
+                    int* vx, int* vy, void** scratch, int* scratchSize)
+{
+    struct TT_Command* cmd = &(job->list->cmds[index]);
+    Uint32 color = cmd->color;
+    int i;
+
+    /* Convert Surface Colors */
+    if(!job->sameFormat)
+    {
+        Uint8 r, g, b;
+        SDL_GetRGB(color, job->srcFormat, &r, &g, &b);
+        color = SDL_MapRGB(view->format, r, g, b);
+    }
+
+    switch(cmd->op)
+    {
+    case TT_OP_LINE:
+        raster_line(view, clip, replay_coord(job, cmd->a), replay_coord(job, cmd->b),
+                    replay_coord(job, cmd->c), replay_coord(job, cmd->d), color);
+        break;
+    case TT_OP_CIRCLE:
+        raster_circle(view, clip, replay_coord(job, cmd->a), replay_coord(job, cmd->b),
+                      replay_coord(job, cmd->c), color);
+        break;
+    case TT_OP_ARC:
+        raster_arc(view, clip, replay_coord(job, cmd->a), replay_coord(job, cmd->b),
+                   replay_coord(job, cmd->c),
+                   job->list->verts[2 * cmd->d], job->list->verts[2 * cmd->d + 1],
+                   job->list->verts[2 * cmd->d + 2], job->list->verts[2 * cmd->d + 3], color);
+        break;
+    case TT_OP_POLYGON:
+        for(i = 0; i < cmd->b; i++)
+        {
+            vx[i] = replay_coord(job, job->list->verts[2 * (cmd->a + i)]);
+            vy[i] = replay_coord(job, job->list->verts[2 * (cmd->a + i) + 1]);
+        }
+        raster_polygon(view, clip, vx, vy, cmd->b, color, scratch, scratchSize);
+        break;
+    case TT_OP_TEXT:
+        raster_blend(view, clip, job->texts[index], replay_coord(job, cmd->a), replay_coord(job, cmd->b));
+        break;
+    case TT_OP_CLEAR:
+        SDL_FillRect(view, NULL, color);
+        break;
+    default:
+        fprintf(stderr, "TT_Replay: invalid command!\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
+/**
+ * Replay thread: rasterizes tiles until there are none left
+ * @param data struct replay_worker*
+ * @return 0
+ */
+int replay_worker_main(void* data)
+{
+    struct replay_worker* worker = data;
+    struct replay_job* job = worker->job;
+    SDL_Surface* dest = job->dest;
+
+    /* View on the Target Pixels, with its Own Clip Rectangle */
+    SDL_Surface* view = SDL_CreateRGBSurfaceFrom(dest->pixels, dest->w, dest->h,
+                                                 dest->format->BitsPerPixel, dest->pitch,
+                                                 dest->format->Rmask, dest->format->Gmask,
+                                                 dest->format->Bmask, dest->format->Amask);
+    int* vx = malloc(sizeof(int) * (job->maxPolygon + 1));
+    int* vy = malloc(sizeof(int) * (job->maxPolygon + 1));
+    void* scratch = NULL;
+    int scratchSize = 0;
+
+    if(view == NULL || vx == NULL || vy == NULL)
+    {
+        fprintf(stderr, "TT_ReplayParallel: allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(;;)
+    {
+        /* Take Next Tile */
+        SDL_LockMutex(job->lock);
+        int tile = job->nextTile;
+        job->nextTile ++;
+        SDL_UnlockMutex(job->lock);
+
+        if(tile >= job->tilesX * job->tilesY)
+        {
+            break;
+        }
+
+        SDL_Rect clip;
+        clip.x = (tile % job->tilesX) * REPLAY_TILE_SIZE;
+        clip.y = (tile / job->tilesX) * REPLAY_TILE_SIZE;
+        clip.w = REPLAY_TILE_SIZE;
+        clip.h = REPLAY_TILE_SIZE;
+        SDL_SetClipRect(view, &clip);
+
+        /* Draw Tile Commands in Order */
+        int i;
+        for(i = job->tileStart[tile]; i < job->tileStart[tile + 1]; i++)
+        {
+            replay_command(job, view, &(view->clip_rect), job->tileCmds[i], vx, vy, &scratch, &scratchSize);
+        }
+    }
+
+    free(scratch);
+    free(vx);
+    free(vy);
+    SDL_FreeSurface(view);
+
+    return 0;
+}
 
 /**
  * Initializes the MTurtle library. Must be called before any other
@@ -100,6 +1622,7 @@ void TT_Init(const char* title, int w, int h)
 
     /* Make Default Cursor Surface */
     tt_baseCursor = IMG_Load(TURTLE_SPRITE);
+    build_cursor_cache();
 
     /* Init SDL_ttf */
     if(TTF_Init() == -1)
@@ -108,6 +1631,7 @@ void TT_Init(const char* title, int w, int h)
         exit(EXIT_FAILURE);
     }
     tt_font = TTF_OpenFont(FONT_FILE, FONT_SIZE);
+    tt_textLock = SDL_CreateMutex();
 }
 
 /**
@@ -120,7 +1644,49 @@ void TT_InitMinimal(SDL_Surface* screen)
 {
     tt_screen = screen;
     tt_baseCursor = IMG_Load(TURTLE_SPRITE);
+    build_cursor_cache();
+    tt_font = TTF_OpenFont(FONT_FILE, FONT_SIZE);
+    tt_textLock = SDL_CreateMutex();
+}
+
+/**
+ * Initializes the MTurtle library without opening a window. The
+ * screen is a plain memory surface; the cursor is never composited
+ * and nothing is ever flipped. Use TT_SavePNG / TT_SavePPM to get
+ * the drawing out.
+ * @param w virtual screen width
+ * @param h virtual screen height
+ */
+void TT_InitHeadless(int w, int h)
+{
+    /* Init SDL (no Subsystem Needed) */
+    if(SDL_Init(0) == -1)
+    {
+        fprintf(stderr, "SDL_Init() failed: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    /* Init Screen Surface in Memory */
+    tt_screen = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, BITS_PER_PIXEL, 0, 0, 0, 0);
+    if(tt_screen == NULL)
+    {
+        fprintf(stderr, "TT_InitHeadless() failed: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    /* No Cursor is Ever Drawn */
+    tt_baseCursor = NULL;
+    build_cursor_cache();
+    tt_headless = true;
+
+    /* Init SDL_ttf */
+    if(TTF_Init() == -1)
+    {
+        fprintf(stderr, "TTF_Init() failed: %s\n", TTF_GetError());
+        exit(EXIT_FAILURE);
+    }
     tt_font = TTF_OpenFont(FONT_FILE, FONT_SIZE);
+    tt_textLock = SDL_CreateMutex();
 }
 
 /**
@@ -145,8 +1711,27 @@ struct Turtle* TT_Create(int w, int h, int r, int g, int b)
     turt->isFilling = false;
     turt->onclick = NULL;
     turt->onkeyb = NULL;
-
-    turt->surface = SDL_CreateRGBSurface(SDL_HWSURFACE, w, h, BITS_PER_PIXEL, 0, 0, 0, 0);
+    turt->dirtyCount = 0;
+    turt->isAllDirty = true;
+    turt->cursorSprite = NULL;
+    turt->frameDelay = 0;
+    turt->lastPresent = 0;
+    turt->isRecording = false;
+    turt->isDeferred = false;
+    memset(&(turt->displayList), 0, sizeof(struct TT_DisplayList));
+    turt->isSparse = false;
+    turt->viewX = 0;
+    turt->viewY = 0;
+    turt->tiles = NULL;
+    turt->tileCount = 0;
+    turt->tileCapacity = 0;
+    turt->targets = NULL;
+    turt->targetCapacity = 0;
+    turt->fillScratch = NULL;
+    turt->fillScratchSize = 0;
+
+    turt->surface = SDL_CreateRGBSurface(tt_headless ? SDL_SWSURFACE : SDL_HWSURFACE,
+                                         w, h, BITS_PER_PIXEL, 0, 0, 0, 0);
     turt->surfacePos.x = 0;
     turt->surfacePos.y = 0;
 
@@ -166,53 +1751,80 @@ struct Turtle* TT_Create(int w, int h, int r, int g, int b)
     return turt;
 }
 
+/**
+ * Creates a new turtle on an unbounded canvas. The turtle can go
+ * anywhere; the canvas is made of tiles allocated when first drawn on,
+ * and the surface only shows a viewport on it (see TT_SetViewport).
+ * @param w viewport width
+ * @param h viewport height
+ * @param r background color - red component
+ * @param g background color - green component
+ * @param b background color - blue component
+ * @return New Turtle struct
+ */
+struct Turtle* TT_CreateSparse(int w, int h, int r, int g, int b)
+{
+    struct Turtle* turt = TT_Create(w, h, r, g, b);
+    turt->isSparse = true;
+    return turt;
+}
+
 /**
  * Waits for user events (mouse click, key press, quit...), then
  * processes these events and redraws the screen (trails + cursor)
  * @param turt
- * @return true until the user closes the window or presses ESC / Q
+ * @return true until the user closes the window or presses ESC / Q;
+ * always false in headless mode
  */
 bool TT_MainLoop(struct Turtle* turt)
 {
-    /* Check for User Events */
+    /* No Window, No Events */
+    if(tt_headless)
+    {
+        TT_Blit(turt);
+        return false;
+    }
+
+    /* Wait for an Event, then Drain the Queue */
     SDL_Event ev;
     SDL_WaitEvent(&ev);
-
-    /* User Exit */
-    if(ev.type == SDL_QUIT)
+    if(!handle_event(turt, &ev))
     {
         return false;
     }
 
-    /* User Keyboard Press */
-    if(ev.type == SDL_KEYDOWN)
+    while(SDL_PollEvent(&ev))
     {
-        SDLKey sym = ev.key.keysym.sym;
-        if(turt->onkeyb != NULL)
-        {
-            turt->onkeyb(sym, ev.key.keysym.mod);
-        }
-        else if(sym == SDLK_ESCAPE || sym == SDLK_q)
+        if(!handle_event(turt, &ev))
         {
             return false;
         }
     }
 
-    /* User Mouse Click */
-    if(ev.type == SDL_MOUSEBUTTONUP && ev.button.button == SDL_BUTTON_LEFT
-            && turt->onclick != NULL)
+    /* Frame Rate Cap */
+    if(turt->frameDelay > 0)
     {
-        turt->onclick(ev.button.x, ev.button.y);
+        Uint32 elapsed = SDL_GetTicks() - turt->lastPresent;
+        if(elapsed < turt->frameDelay)
+        {
+            SDL_Delay(turt->frameDelay - elapsed);
+
+            /* Events Received Meanwhile Go in the Same Frame */
+            while(SDL_PollEvent(&ev))
+            {
+                if(!handle_event(turt, &ev))
+                {
+                    return false;
+                }
+            }
+        }
     }
 
-    /* Clear Screen */
-    SDL_FillRect(tt_screen, NULL, turt->bgColor);
-
-    /* Paint Turtle */
-    TT_Blit(turt);
-
     /* Refresh Window */
-    SDL_Flip(tt_screen);
+    if(present_dirty(turt))
+    {
+        turt->lastPresent = SDL_GetTicks();
+    }
 
     return true;
 }
@@ -228,17 +1840,128 @@ void TT_Blit(struct Turtle* turt)
     SDL_BlitSurface(turt->surface, NULL, tt_screen, &(turt->surfacePos));
 
     /* Paint Cursor as Necessary */
-    if(turt->isVisible)
+    if(turt->isVisible && !tt_headless && is_turtle_in_view(turt))
+    {
+        SDL_Surface* cursor = get_cursor_sprite(turt->angle);
+        if(cursor != NULL)
+        {
+            SDL_Rect cursorPos;
+            cursorPos.x = (turt->x - turt->viewX - cursor->w / 2) + turt->surfacePos.x;
+            cursorPos.y = (turt->y - turt->viewY - cursor->h / 2) + turt->surfacePos.y;
+
+            SDL_BlitSurface(cursor, NULL, tt_screen, &cursorPos);
+        }
+    }
+}
+
+/**
+ * Saves the turtle's drawing surface as a PNG file.
+ * @param turt
+ * @param filename
+ * @return true on success
+ */
+bool TT_SavePNG(struct Turtle* turt, const char* filename)
+{
+    SDL_Surface* surface = turt->surface;
+
+    FILE* file = fopen(filename, "wb");
+    if(file == NULL)
+    {
+        fprintf(stderr, "TT_SavePNG: cannot open %s\n", filename);
+        return false;
+    }
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png == NULL ? NULL : png_create_info_struct(png);
+    png_bytep row = malloc(surface->w * 3);
+
+    /* Error Control (libpng longjmps here on failure) */
+    if(info == NULL || row == NULL || setjmp(png_jmpbuf(png)))
+    {
+        fprintf(stderr, "TT_SavePNG: cannot write %s\n", filename);
+        png_destroy_write_struct(&png, &info);
+        free(row);
+        fclose(file);
+        return false;
+    }
+
+    png_init_io(png, file);
+    png_set_IHDR(png, info, surface->w, surface->h, 8, PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+
+    /* Convert Rows to Packed RGB */
+    SDL_LockSurface(surface);
+    int x, y;
+    for(y = 0; y < surface->h; y++)
+    {
+        Uint32* pixels = (Uint32*) ((Uint8*) surface->pixels + y * surface->pitch);
+        for(x = 0; x < surface->w; x++)
+        {
+            SDL_GetRGB(pixels[x], surface->format, &row[3 * x], &row[3 * x + 1], &row[3 * x + 2]);
+        }
+        png_write_row(png, row);
+    }
+    SDL_UnlockSurface(surface);
+
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    free(row);
+    fclose(file);
+
+    return true;
+}
+
+/**
+ * Saves the turtle's drawing surface as a binary PPM (P6) file.
+ * @param turt
+ * @param filename
+ * @return true on success
+ */
+bool TT_SavePPM(struct Turtle* turt, const char* filename)
+{
+    SDL_Surface* surface = turt->surface;
+
+    FILE* file = fopen(filename, "wb");
+    if(file == NULL)
+    {
+        fprintf(stderr, "TT_SavePPM: cannot open %s\n", filename);
+        return false;
+    }
+
+    Uint8* row = malloc(surface->w * 3);
+    if(row == NULL)
+    {
+        fprintf(stderr, "TT_SavePPM: malloc failed!\n");
+        fclose(file);
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", surface->w, surface->h);
+
+    /* Convert Rows to Packed RGB */
+    SDL_LockSurface(surface);
+    int x, y;
+    for(y = 0; y < surface->h; y++)
     {
-        SDL_Surface* cursor = rotozoomSurface(tt_baseCursor, -abs(turt->angle), 1.0, 1);
-        SDL_Rect cursorPos;
-        cursorPos.x = (turt->x - cursor->w / 2) + turt->surfacePos.x;
-        cursorPos.y = (turt->y - cursor->h / 2) + turt->surfacePos.y;
+        Uint32* pixels = (Uint32*) ((Uint8*) surface->pixels + y * surface->pitch);
+        for(x = 0; x < surface->w; x++)
+        {
+            SDL_GetRGB(pixels[x], surface->format, &row[3 * x], &row[3 * x + 1], &row[3 * x + 2]);
+        }
+        fwrite(row, 3, surface->w, file);
+    }
+    SDL_UnlockSurface(surface);
 
-        SDL_BlitSurface(cursor, NULL, tt_screen, &cursorPos);
+    free(row);
 
-        SDL_FreeSurface(cursor);
+    if(fclose(file) != 0)
+    {
+        fprintf(stderr, "TT_SavePPM: cannot write %s\n", filename);
+        return false;
     }
+
+    return true;
 }
 
 /**
@@ -247,6 +1970,15 @@ void TT_Blit(struct Turtle* turt)
  */
 void TT_Destroy(struct Turtle* turt)
 {
+    TT_ClearRecording(turt);
+    if(turt->isFilling)
+    {
+        free(turt->fillX);
+        free(turt->fillY);
+    }
+    free_tiles(turt);
+    free(turt->targets);
+    free(turt->fillScratch);
     SDL_FreeSurface(turt->surface);
     free(turt);
 }
@@ -257,6 +1989,15 @@ void TT_Destroy(struct Turtle* turt)
  */
 void TT_EndProgram()
 {
+    if(tt_headless)
+    {
+        SDL_FreeSurface(tt_screen);
+    }
+
+    free_cursor_cache();
+    free_text_cache();
+    SDL_DestroyMutex(tt_textLock);
+    SDL_FreeSurface(tt_baseCursor);
     TTF_CloseFont(tt_font);
     TTF_Quit();
     SDL_Quit();
@@ -278,6 +2019,18 @@ void TT_SetSurfacePos(struct Turtle* turt, int x, int y)
 {
     turt->surfacePos.x = x;
     turt->surfacePos.y = y;
+    turt->isAllDirty = true;
+}
+
+/**
+ * Limits how often TT_MainLoop redraws the screen. Events are still
+ * all processed, in order, between two redraws.
+ * @param turt
+ * @param fps maximum frames per second (0 for no limit)
+ */
+void TT_SetMaxFPS(struct Turtle* turt, int fps)
+{
+    turt->frameDelay = fps > 0 ? 1000 / fps : 0;
 }
 
 /**
@@ -289,7 +2042,7 @@ void TT_SetSurfacePos(struct Turtle* turt, int x, int y)
 void TT_MoveTo(struct Turtle* turt, int x, int y)
 {
     /* Boundary Check */
-    if(x < 0 || y < 0 || x >= turt->surface->w || y >= turt->surface->h)
+    if(!turt->isSparse && (x < 0 || y < 0 || x >= turt->surface->w || y >= turt->surface->h))
     {
         fprintf(stderr, "TT_MoveTo: going outside world!\n");
         exit(EXIT_FAILURE);
@@ -298,7 +2051,7 @@ void TT_MoveTo(struct Turtle* turt, int x, int y)
     /* Draw Line as Necessary */
     if(turt->isDrawing)
     {
-        Draw_Line(turt->surface, turt->x, turt->y, x, y, turt->color);
+        emit_line(turt, turt->x, turt->y, x, y);
     }
 
     /* Move Turtle */
@@ -308,21 +2061,23 @@ void TT_MoveTo(struct Turtle* turt, int x, int y)
     /* Fill Shape */
     if(turt->isFilling)
     {
-        if(turt->fillIndex < turt->fillCount)
+        if(turt->fillCount <= 0 || turt->fillIndex < turt->fillCount)
         {
             /* Push Vertex */
+            if(turt->fillIndex >= turt->fillCapacity)
+            {
+                int capacity = turt->fillCapacity;
+                grow_buffer((void**) &(turt->fillX), &capacity, turt->fillIndex + 1, sizeof(int));
+                grow_buffer((void**) &(turt->fillY), &(turt->fillCapacity), turt->fillIndex + 1, sizeof(int));
+            }
             turt->fillX[turt->fillIndex] = x;
             turt->fillY[turt->fillIndex] = y;
             turt->fillIndex ++;
         }
 
-        if(turt->fillIndex >= turt->fillCount)
+        if(turt->fillCount > 0 && turt->fillIndex >= turt->fillCount)
         {
-            /* Do Fill */
-            filledPolygonColor(turt->surface, turt->fillX, turt->fillY, turt->fillCount, turt->fillColor);
-            turt->isFilling = false;
-            free(turt->fillX);
-            free(turt->fillY);
+            TT_EndFill(turt);
         }
     }
 }
@@ -361,24 +2116,28 @@ void TT_Forward(struct Turtle* turt, int distance)
     int x = turt->x + round(offset_x);
     int y = turt->y + round(offset_y);
 
-    /* Boundary Check (X) */
-    if(x < 0)
-    {
-        x = 0;
-    }
-    else if(x >= turt->surface->w)
+    /* Boundary Check (a Sparse Canvas Has None) */
+    if(!turt->isSparse)
     {
-        x = turt->surface->w - 1;
-    }
+        /* Boundary Check (X) */
+        if(x < 0)
+        {
+            x = 0;
+        }
+        else if(x >= turt->surface->w)
+        {
+            x = turt->surface->w - 1;
+        }
 
-    /* Boundary Check (Y) */
-    if(y < 0)
-    {
-        y = 0;
-    }
-    else if(y >= turt->surface->h)
-    {
-        y = turt->surface->h - 1;
+        /* Boundary Check (Y) */
+        if(y < 0)
+        {
+            y = 0;
+        }
+        else if(y >= turt->surface->h)
+        {
+            y = turt->surface->h - 1;
+        }
     }
 
     TT_MoveTo(turt, x, y);
@@ -411,8 +2170,7 @@ void TT_Home(struct Turtle* turt)
  */
 void TT_Clear(struct Turtle* turt)
 {
-    /* Init Surface */
-    SDL_FillRect(turt->surface, NULL, turt->bgColor);
+    emit_clear(turt);
 }
 
 /**
@@ -468,12 +2226,7 @@ void TT_HideTurtle(struct Turtle* turt)
  */
 void TT_WriteText(struct Turtle* turt, const char* str)
 {
-    SDL_Surface* text = TTF_RenderText_Blended(tt_font, str, translate_color(turt->color));
-    SDL_Rect pos;
-    pos.x = turt->x;
-    pos.y = turt->y;
-    SDL_BlitSurface(text, NULL, turt->surface, &pos);
-    SDL_FreeSurface(text);
+    emit_text(turt, turt->x, turt->y, str);
 }
 
 /**
@@ -491,13 +2244,72 @@ void TT_Circle(struct Turtle* turt, int radius)
     int x = turt->x + round(offset_x);
     int y = turt->y + round(offset_y);
 
-    if(x < 0 || y < 0 || x >= turt->surface->w || y >= turt->surface->h)
+    if(!turt->isSparse && (x < 0 || y < 0 || x >= turt->surface->w || y >= turt->surface->h))
     {
         fprintf(stderr, "TT_Circle: circle center is off limits!\n");
         return;
     }
 
-    Draw_Circle(turt->surface, x, y, radius, turt->color);
+    emit_circle(turt, x, y, radius);
+}
+
+/**
+ * Moves the turtle along an arc of circle, turning it by the given
+ * angle. With a positive angle, the turtle turns left around the center
+ * used by TT_Circle; with a negative one, it turns right.
+ * @param turt
+ * @param radius
+ * @param deg
+ */
+void TT_Arc(struct Turtle* turt, int radius, float deg)
+{
+    double side = deg >= 0 ? 1.0 : -1.0; /* left or right */
+    double sweep = fabs(deg);
+
+    /* Center is R Units Left (or Right) to Turtle */
+    double cx = turt->x + radius * cos((turt->angle - 90.0 * side) * RAD2DEG);
+    double cy = turt->y + radius * sin((turt->angle - 90.0 * side) * RAD2DEG);
+    double start = turt->angle + 90.0 * side; /* turtle direction from the center */
+
+    /* Draw Quarter Turns at Most, as Seen from the Rounded Center */
+    if(turt->isDrawing && radius > 0)
+    {
+        double drawn = sweep < 360.0 ? sweep : 360.0;
+        int count = (int) ceil(drawn / 90.0);
+        int i;
+        for(i = 0; i < count; i++)
+        {
+            double from = start - side * drawn * i / count;
+            double to = start - side * drawn * (i + 1) / count;
+
+            /* Clockwise Order */
+            double a = side > 0 ? to : from;
+            double b = side > 0 ? from : to;
+            emit_arc(turt, (int) round(cx), (int) round(cy), radius,
+                     (int) round(65536.0 * cos(a * RAD2DEG)), (int) round(65536.0 * sin(a * RAD2DEG)),
+                     (int) round(65536.0 * cos(b * RAD2DEG)), (int) round(65536.0 * sin(b * RAD2DEG)));
+        }
+    }
+
+    /* Exact End Position */
+    double end = start - side * sweep;
+    int x = round(cx + radius * cos(end * RAD2DEG));
+    int y = round(cy + radius * sin(end * RAD2DEG));
+
+    /* Boundary Check (a Sparse Canvas Has None) */
+    if(!turt->isSparse)
+    {
+        x = x < 0 ? 0 : (x >= turt->surface->w ? turt->surface->w - 1 : x);
+        y = y < 0 ? 0 : (y >= turt->surface->h ? turt->surface->h - 1 : y);
+    }
+
+    /* Move Turtle (the Arc is Already Drawn) */
+    bool isDrawing = turt->isDrawing;
+    turt->isDrawing = false;
+    TT_MoveTo(turt, x, y);
+    turt->isDrawing = isDrawing;
+
+    TT_Left(turt, deg);
 }
 
 /**
@@ -509,7 +2321,7 @@ void TT_Circle(struct Turtle* turt, int radius)
  */
 void TT_CenteredCircle(struct Turtle* turt, int radius)
 {
-    Draw_Circle(turt->surface, turt->x, turt->y, radius, turt->color);
+    emit_circle(turt, turt->x, turt->y, radius);
 }
 
 /*
@@ -543,9 +2355,12 @@ void TT_OnKeyb(struct Turtle* turt, void (*func)(SDLKey, SDLMod))
  */
 
 /**
- * Starts filling a region of the drawing surface
+ * Starts filling a region of the drawing surface. Every position the
+ * turtle moves to becomes a vertex of the polygon.
  * @param turt
- * @param count number of vertices in the polygon to fill
+ * @param count number of vertices in the polygon to fill (the fill is
+ * done when the last one is reached), or 0 to fill when TT_EndFill is
+ * called
  * @param r fill color (red component)
  * @param g fill color (green component)
  * @param b fill color (blue component)
@@ -560,10 +2375,11 @@ void TT_BeginFill(struct Turtle* turt, int count, Uint32 r, Uint32 g, Uint32 b)
     }
 
     /* Init Variables */
-    turt->fillCount = count;
-    turt->fillColor = (r << 24) | (g << 16) | (b << 8) | 0xFF;
-    turt->fillX = malloc(sizeof(int) * count);
-    turt->fillY = malloc(sizeof(int) * count);
+    turt->fillCount = count > 0 ? count : 0;
+    turt->fillCapacity = count > 0 ? count : FILL_INITIAL_CAPACITY;
+    turt->fillColor = SDL_MapRGB(turt->surface->format, r, g, b);
+    turt->fillX = malloc(sizeof(int) * turt->fillCapacity);
+    turt->fillY = malloc(sizeof(int) * turt->fillCapacity);
 
     /* Error Control */
     if(turt->fillX == NULL || turt->fillY == NULL)
@@ -579,3 +2395,315 @@ void TT_BeginFill(struct Turtle* turt, int count, Uint32 r, Uint32 g, Uint32 b)
     turt->isFilling = true;
     turt->fillIndex = 1;
 }
+
+/**
+ * Fills the polygon made of the vertices visited since TT_BeginFill
+ * @param turt
+ */
+void TT_EndFill(struct Turtle* turt)
+{
+    if(!turt->isFilling)
+    {
+        fprintf(stderr, "TT_EndFill: not filling!\n");
+        return;
+    }
+
+    /* Do Fill */
+    if(turt->fillIndex >= 3)
+    {
+        emit_polygon(turt, turt->fillX, turt->fillY, turt->fillIndex, turt->fillColor);
+    }
+
+    turt->isFilling = false;
+    free(turt->fillX);
+    free(turt->fillY);
+}
+
+/*
+ * Sparse Canvas API
+ */
+
+/**
+ * Moves the viewport of a sparse canvas
+ * @param turt
+ * @param x world position of the surface's top left corner
+ * @param y
+ */
+void TT_SetViewport(struct Turtle* turt, int x, int y)
+{
+    if(!turt->isSparse)
+    {
+        fprintf(stderr, "TT_SetViewport: not a sparse canvas!\n");
+        return;
+    }
+
+    turt->viewX = x;
+    turt->viewY = y;
+    compose_canvas(turt, turt->surface, x, y);
+    turt->isAllDirty = true;
+}
+
+/**
+ * Gets the world area covered by the allocated tiles of a sparse
+ * canvas (everything drawn is inside)
+ * @param turt
+ * @param x top left corner (world)
+ * @param y
+ * @param w
+ * @param h
+ * @return false if nothing was drawn yet
+ */
+bool TT_GetCanvasBounds(struct Turtle* turt, int* x, int* y, int* w, int* h)
+{
+    int tx1 = 0, ty1 = 0, tx2 = -1, ty2 = -1;
+    bool found = false;
+
+    int i;
+    for(i = 0; i < turt->tileCapacity; i++)
+    {
+        struct TT_Tile* tile = &(turt->tiles[i]);
+        if(tile->surface == NULL)
+        {
+            continue;
+        }
+
+        tx1 = !found || tile->tx < tx1 ? tile->tx : tx1;
+        ty1 = !found || tile->ty < ty1 ? tile->ty : ty1;
+        tx2 = !found || tile->tx > tx2 ? tile->tx : tx2;
+        ty2 = !found || tile->ty > ty2 ? tile->ty : ty2;
+        found = true;
+    }
+
+    *x = tx1 * TT_TILE_SIZE;
+    *y = ty1 * TT_TILE_SIZE;
+    *w = (tx2 - tx1 + 1) * TT_TILE_SIZE;
+    *h = (ty2 - ty1 + 1) * TT_TILE_SIZE;
+
+    return found;
+}
+
+/**
+ * Copies an area of a sparse canvas onto a surface, e.g. to save the
+ * whole drawing
+ * @param turt
+ * @param dest 32 bpp surface, filled from its top left corner
+ * @param x world position of the area
+ * @param y
+ */
+void TT_DrawCanvas(struct Turtle* turt, SDL_Surface* dest, int x, int y)
+{
+    compose_canvas(turt, dest, x, y);
+}
+
+/*
+ * Display List API
+ */
+
+/**
+ * Starts recording drawing commands into the turtle's display list
+ * @param turt
+ * @param deferred if true, commands are only recorded; nothing is
+ * drawn until TT_Replay is called
+ */
+void TT_StartRecording(struct Turtle* turt, bool deferred)
+{
+    turt->isRecording = true;
+    turt->isDeferred = deferred;
+}
+
+/**
+ * Stops recording drawing commands. The display list is kept.
+ * @param turt
+ */
+void TT_StopRecording(struct Turtle* turt)
+{
+    turt->isRecording = false;
+    turt->isDeferred = false;
+}
+
+/**
+ * Empties the turtle's display list
+ * @param turt
+ */
+void TT_ClearRecording(struct Turtle* turt)
+{
+    struct TT_DisplayList* list = &(turt->displayList);
+
+    free(list->cmds);
+    free(list->verts);
+    free(list->text);
+    memset(list, 0, sizeof(struct TT_DisplayList));
+}
+
+/**
+ * Draws the turtle's display list onto a surface
+ * @param turt
+ * @param dest target surface (32 bpp), e.g. turt->surface
+ * @param scale coordinate scale factor (1.0 for the same size)
+ */
+void TT_Replay(struct Turtle* turt, SDL_Surface* dest, float scale)
+{
+    TT_ReplayParallel(turt, dest, scale, 1);
+}
+
+/**
+ * Draws the turtle's display list onto a surface, split in tiles
+ * rasterized in parallel. The result is the same as TT_Replay's.
+ * @param turt
+ * @param dest target surface (32 bpp), e.g. turt->surface
+ * @param scale coordinate scale factor (1.0 for the same size)
+ * @param threads number of threads (0 for one per processor)
+ */
+void TT_ReplayParallel(struct Turtle* turt, SDL_Surface* dest, float scale, int threads)
+{
+    struct TT_DisplayList* list = &(turt->displayList);
+
+    if(threads <= 0)
+    {
+        threads = get_processor_count();
+    }
+
+    /* Shared Job Description */
+    struct replay_job job;
+    job.list = list;
+    job.srcFormat = turt->surface->format;
+    job.dest = dest;
+    job.scale = scale;
+    job.sameFormat = turt->surface->format->Rmask == dest->format->Rmask
+                     && turt->surface->format->Gmask == dest->format->Gmask
+                     && turt->surface->format->Bmask == dest->format->Bmask;
+    job.tilesX = (dest->w + REPLAY_TILE_SIZE - 1) / REPLAY_TILE_SIZE;
+    job.tilesY = (dest->h + REPLAY_TILE_SIZE - 1) / REPLAY_TILE_SIZE;
+    job.nextTile = 0;
+    job.lock = SDL_CreateMutex();
+    job.texts = calloc(list->count + 1, sizeof(SDL_Surface*));
+    job.tileStart = calloc(job.tilesX * job.tilesY + 1, sizeof(int));
+
+    if(job.lock == NULL || job.texts == NULL || job.tileStart == NULL)
+    {
+        fprintf(stderr, "TT_ReplayParallel: allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Render Text Up Front (SDL_ttf is not Thread-Safe) */
+    int i;
+    job.maxPolygon = 0;
+    SDL_LockMutex(tt_textLock);
+    for(i = 0; i < list->count; i++)
+    {
+        struct TT_Command* cmd = &(list->cmds[i]);
+        if(cmd->op == TT_OP_TEXT)
+        {
+            job.texts[i] = build_text_surface(list->text + cmd->c, translate_color(cmd->color));
+        }
+        else if(cmd->op == TT_OP_POLYGON && cmd->b > job.maxPolygon)
+        {
+            job.maxPolygon = cmd->b;
+        }
+    }
+    SDL_UnlockMutex(tt_textLock);
+
+    /* Bin Commands into Tiles (Counting Sort Keeps Draw Order) */
+    int pass;
+    job.tileCmds = NULL;
+    for(pass = 0; pass < 2; pass++)
+    {
+        int* fill = NULL;
+        if(pass == 1)
+        {
+            int total = 0;
+            int t;
+            for(t = 0; t <= job.tilesX * job.tilesY; t++)
+            {
+                int count = job.tileStart[t];
+                job.tileStart[t] = total;
+                total += count;
+            }
+
+            job.tileCmds = malloc(sizeof(int) * (total + 1));
+            fill = calloc(job.tilesX * job.tilesY + 1, sizeof(int));
+            if(job.tileCmds == NULL || fill == NULL)
+            {
+                fprintf(stderr, "TT_ReplayParallel: allocation failed!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        for(i = 0; i < list->count; i++)
+        {
+            int x1, y1, x2, y2;
+            if(!get_command_bounds(&job, i, &x1, &y1, &x2, &y2))
+            {
+                continue;
+            }
+
+            int tx, ty;
+            for(ty = y1 / REPLAY_TILE_SIZE; ty <= y2 / REPLAY_TILE_SIZE; ty++)
+            {
+                for(tx = x1 / REPLAY_TILE_SIZE; tx <= x2 / REPLAY_TILE_SIZE; tx++)
+                {
+                    int t = ty * job.tilesX + tx;
+                    if(pass == 0)
+                    {
+                        job.tileStart[t] ++;
+                    }
+                    else
+                    {
+                        job.tileCmds[job.tileStart[t] + fill[t]] = i;
+                        fill[t] ++;
+                    }
+                }
+            }
+        }
+
+        free(fill);
+    }
+
+    /* Rasterize Tiles on Worker Threads (and on this One) */
+    lock_surface(dest);
+
+    struct replay_worker* workers = calloc(threads, sizeof(struct replay_worker));
+    if(workers == NULL)
+    {
+        fprintf(stderr, "TT_ReplayParallel: allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(i = 0; i < threads; i++)
+    {
+        workers[i].job = &job;
+        workers[i].thread = NULL;
+        if(i > 0)
+        {
+            workers[i].thread = SDL_CreateThread(replay_worker_main, &workers[i]);
+        }
+    }
+
+    replay_worker_main(&workers[0]);
+
+    for(i = 1; i < threads; i++)
+    {
+        if(workers[i].thread != NULL)
+        {
+            SDL_WaitThread(workers[i].thread, NULL);
+        }
+    }
+
+    unlock_surface(dest);
+
+    /* Cleanup */
+    for(i = 0; i < list->count; i++)
+    {
+        SDL_FreeSurface(job.texts[i]);
+    }
+    free(workers);
+    free(job.texts);
+    free(job.tileStart);
+    free(job.tileCmds);
+    SDL_DestroyMutex(job.lock);
+
+    if(dest == turt->surface)
+    {
+        turt->isAllDirty = true;
+    }
+}
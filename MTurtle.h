@@ -34,14 +34,75 @@
 #include "SDL_rotozoom.h"
 #include "SDL_draw.h"
 
+/**
+ * Maximum number of separate regions tracked between two presents;
+ * beyond that they are merged into their bounding box.
+ */
+#define TT_MAX_DIRTY_RECTS 32
+
+/**
+ * Size of the tiles of a sparse canvas, in pixels
+ */
+#define TT_TILE_SIZE 256
+
+/**
+ * Display list opcodes
+ */
+typedef enum {
+    TT_OP_LINE,                     /* a, b -> c, d */
+    TT_OP_CIRCLE,                   /* center (a, b), radius c */
+    TT_OP_ARC,                      /* center (a, b), radius c, from direction d to d + 1 */
+    TT_OP_POLYGON,                  /* vertices a to a + b - 1 */
+    TT_OP_TEXT,                     /* at (a, b), string at offset c */
+    TT_OP_CLEAR                     /* fill with color */
+} TT_Op;
+
+/**
+ * A recorded drawing command.
+ */
+struct TT_Command
+{
+    Uint8 op;                       /* TT_Op */
+    Uint32 color;                   /* surface color */
+    int a, b, c, d;                 /* operands, see TT_Op */
+};
+
+/**
+ * A growable buffer of drawing commands, with side buffers for
+ * polygon vertices and text.
+ */
+struct TT_DisplayList
+{
+    struct TT_Command* cmds;        /* commands */
+    int count;                      /* command count */
+    int capacity;                   /* allocated commands */
+    int* verts;                     /* polygon vertices and arc directions (X, Y pairs) */
+    int vertCount;                  /* vertex count */
+    int vertCapacity;               /* allocated vertices */
+    char* text;                     /* NUL-separated strings */
+    int textSize;                   /* used bytes in text */
+    int textCapacity;               /* allocated bytes in text */
+};
+
+/**
+ * A tile of a sparse canvas, covering the world area from
+ * (tx * TT_TILE_SIZE, ty * TT_TILE_SIZE) to TT_TILE_SIZE pixels further.
+ */
+struct TT_Tile
+{
+    int tx;
+    int ty;
+    SDL_Surface* surface;           /* NULL for an unused slot */
+};
+
 /**
  * The Turtle struct. Describes a turtle cursor, with its position,
  * orientation, color, and associated SDL surface.
  */
 struct Turtle
 {
-    int x;                          /* cursor position (X) */
-    int y;                          /* cursor position (Y) */
+    int x;                          /* cursor position (X, world) */
+    int y;                          /* cursor position (Y, world) */
     float angle;                    /* cursor orientation */
     bool isDrawing;                 /* is the pen up or down? */
     bool isVisible;                 /* is the turtle visible or not? */
@@ -49,15 +110,40 @@ struct Turtle
     Uint32 bgColor;                 /* background color */
 
     Uint32 fillColor;               /* shape fill color */
-    Sint16* fillX;                  /* shape fill vertex array (X) */
-    Sint16* fillY;                  /* shape fill vertex array (Y) */
-    int fillCount;                  /* shape fill vertex count */
+    int* fillX;                     /* shape fill vertex array (X) */
+    int* fillY;                     /* shape fill vertex array (Y) */
+    int fillCount;                  /* shape fill vertex count (0 until TT_EndFill) */
+    int fillCapacity;               /* shape fill vertex array size */
     int fillIndex;                  /* shape fill current vertex */
     bool isFilling;                 /* are we currently filling a polygon? */
     SDL_Surface* surface;           /* SDL surface for the turtle screen */
     SDL_Rect surfacePos;            /* surface coordinates on the screen */
     void (*onclick)(int, int);      /* click event handler func */
     void (*onkeyb)(SDLKey, SDLMod); /* keyboard event handler func */
+
+    SDL_Rect dirtyRects[TT_MAX_DIRTY_RECTS]; /* areas drawn since last present */
+    int dirtyCount;                 /* number of dirty areas */
+    bool isAllDirty;                /* must the whole surface be presented? */
+    SDL_Rect cursorRect;            /* cursor area at last present (screen) */
+    SDL_Surface* cursorSprite;      /* cursor sprite at last present */
+    Uint32 frameDelay;              /* min. ticks between presents (0 = none) */
+    Uint32 lastPresent;             /* ticks at last present */
+
+    struct TT_DisplayList displayList; /* recorded drawing commands */
+    bool isRecording;               /* are drawing commands recorded? */
+    bool isDeferred;                /* are they rasterized only on replay? */
+
+    bool isSparse;                  /* is the world unbounded and tiled? */
+    int viewX;                      /* world position of the surface (X) */
+    int viewY;                      /* world position of the surface (Y) */
+    struct TT_Tile* tiles;          /* hash table of allocated tiles */
+    int tileCount;                  /* allocated tiles */
+    int tileCapacity;               /* hash table size (power of 2) */
+
+    struct draw_target* targets;    /* surfaces the current shape is drawn on */
+    int targetCapacity;             /* allocated targets */
+    void* fillScratch;              /* polygon filler work buffer */
+    int fillScratchSize;            /* polygon filler work buffer size */
 };
 
 /**
@@ -77,6 +163,16 @@ void TT_Init(const char* title, int w, int h);
  */
 void TT_InitMinimal(SDL_Surface* screen);
 
+/**
+ * Initializes the MTurtle library without opening a window. The
+ * screen is a plain memory surface; the cursor is never composited
+ * and nothing is ever flipped. Use TT_SavePNG / TT_SavePPM to get
+ * the drawing out.
+ * @param w virtual screen width
+ * @param h virtual screen height
+ */
+void TT_InitHeadless(int w, int h);
+
 /**
  * Creates a new turtle.
  * @param w surface width
@@ -88,9 +184,23 @@ void TT_InitMinimal(SDL_Surface* screen);
  */
 struct Turtle* TT_Create(int w, int h, int r, int g, int b);
 
+/**
+ * Creates a new turtle on an unbounded canvas. The turtle can go
+ * anywhere; the canvas is made of tiles allocated when first drawn on,
+ * and the surface only shows a viewport on it (see TT_SetViewport).
+ * @param w viewport width
+ * @param h viewport height
+ * @param r background color - red component
+ * @param g background color - green component
+ * @param b background color - blue component
+ * @return New Turtle struct
+ */
+struct Turtle* TT_CreateSparse(int w, int h, int r, int g, int b);
+
 /**
  * Waits for user events (mouse click, key press, quit...), then
- * processes these events and redraws the screen (trails + cursor)
+ * processes all pending events and redraws once the parts of the
+ * screen which changed (trails + cursor)
  * @param turt
  * @return true until the user closes the window or presses ESC / Q
  */
@@ -103,6 +213,22 @@ bool TT_MainLoop(struct Turtle* turt);
  */
 void TT_Blit(struct Turtle* turt);
 
+/**
+ * Saves the turtle's drawing surface as a PNG file.
+ * @param turt
+ * @param filename
+ * @return true on success
+ */
+bool TT_SavePNG(struct Turtle* turt, const char* filename);
+
+/**
+ * Saves the turtle's drawing surface as a binary PPM (P6) file.
+ * @param turt
+ * @param filename
+ * @return true on success
+ */
+bool TT_SavePPM(struct Turtle* turt, const char* filename);
+
 /**
  * Destroys a Turtle struct.
  * @param turt the victim
@@ -133,6 +259,14 @@ void TT_SetColor(struct Turtle* turt, Uint32 r, Uint32 g, Uint32 b);
  */
 void TT_SetSurfacePos(struct Turtle* turt, int x, int y);
 
+/**
+ * Limits how often TT_MainLoop redraws the screen. Events are still
+ * all processed, in order, between two redraws.
+ * @param turt
+ * @param fps maximum frames per second (0 for no limit)
+ */
+void TT_SetMaxFPS(struct Turtle* turt, int fps);
+
 /**
  * Moves the cursor to the specified location
  * @param turt
@@ -226,6 +360,16 @@ void TT_WriteText(struct Turtle* turt, const char* str);
  */
 void TT_Circle(struct Turtle* turt, int radius);
 
+/**
+ * Moves the turtle along an arc of circle, turning it by the given
+ * angle. With a positive angle, the turtle turns left around the center
+ * used by TT_Circle; with a negative one, it turns right.
+ * @param turt
+ * @param radius
+ * @param deg
+ */
+void TT_Arc(struct Turtle* turt, int radius, float deg);
+
 /**
  * Draws a circle whose center is on the turtle. This function
  * is not in the Turtle Graphics spirit and is provided for
@@ -260,13 +404,98 @@ void TT_OnKeyb(struct Turtle* turt, void (*func)(SDLKey, SDLMod));
  */
 
 /**
- * Starts filling a region of the drawing surface
+ * Starts filling a region of the drawing surface. Every position the
+ * turtle moves to becomes a vertex of the polygon.
  * @param turt
- * @param count number of vertices in the polygon to fill
+ * @param count number of vertices in the polygon to fill (the fill is
+ * done when the last one is reached), or 0 to fill when TT_EndFill is
+ * called
  * @param r fill color (red component)
  * @param g fill color (green component)
  * @param b fill color (blue component)
  */
 void TT_BeginFill(struct Turtle* turt, int count, Uint32 r, Uint32 g, Uint32 b);
 
+/**
+ * Fills the polygon made of the vertices visited since TT_BeginFill
+ * @param turt
+ */
+void TT_EndFill(struct Turtle* turt);
+
+/*
+ * Sparse Canvas API
+ */
+
+/**
+ * Moves the viewport of a sparse canvas
+ * @param turt
+ * @param x world position of the surface's top left corner
+ * @param y
+ */
+void TT_SetViewport(struct Turtle* turt, int x, int y);
+
+/**
+ * Gets the world area covered by the allocated tiles of a sparse
+ * canvas (everything drawn is inside)
+ * @param turt
+ * @param x top left corner (world)
+ * @param y
+ * @param w
+ * @param h
+ * @return false if nothing was drawn yet
+ */
+bool TT_GetCanvasBounds(struct Turtle* turt, int* x, int* y, int* w, int* h);
+
+/**
+ * Copies an area of a sparse canvas onto a surface, e.g. to save the
+ * whole drawing
+ * @param turt
+ * @param dest 32 bpp surface, filled from its top left corner
+ * @param x world position of the area
+ * @param y
+ */
+void TT_DrawCanvas(struct Turtle* turt, SDL_Surface* dest, int x, int y);
+
+/*
+ * Display List API
+ */
+
+/**
+ * Starts recording drawing commands into the turtle's display list
+ * @param turt
+ * @param deferred if true, commands are only recorded; nothing is
+ * drawn until TT_Replay is called
+ */
+void TT_StartRecording(struct Turtle* turt, bool deferred);
+
+/**
+ * Stops recording drawing commands. The display list is kept.
+ * @param turt
+ */
+void TT_StopRecording(struct Turtle* turt);
+
+/**
+ * Empties the turtle's display list
+ * @param turt
+ */
+void TT_ClearRecording(struct Turtle* turt);
+
+/**
+ * Draws the turtle's display list onto a surface
+ * @param turt
+ * @param dest target surface (32 bpp), e.g. turt->surface
+ * @param scale coordinate scale factor (1.0 for the same size)
+ */
+void TT_Replay(struct Turtle* turt, SDL_Surface* dest, float scale);
+
+/**
+ * Draws the turtle's display list onto a surface, split in tiles
+ * rasterized in parallel. The result is the same as TT_Replay's.
+ * @param turt
+ * @param dest target surface (32 bpp), e.g. turt->surface
+ * @param scale coordinate scale factor (1.0 for the same size)
+ * @param threads number of threads (0 for one per processor)
+ */
+void TT_ReplayParallel(struct Turtle* turt, SDL_Surface* dest, float scale, int threads);
+
 #endif /* __MTURTLE_H_ */
@@ -0,0 +1,599 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * MTurtle Raster
+ * Clip-exact rasterization primitives for 32 bpp surfaces.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <SDL/SDL.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "MTurtleRaster.h"
+
+/**
+ * A polygon edge, for the scanline filler. X at the current row center
+ * is kept exactly as x + rem / den (0 <= rem < den).
+ */
+struct raster_edge
+{
+    int ymin;                       /* first covered row */
+    int ymax;                       /* last covered row */
+    int x1;                         /* upper end */
+    int y1;
+    int dx;                         /* lower end X - upper end X */
+    Sint64 x;                       /* integer part of X */
+    Sint64 rem;                     /* fractional part of X (numerator) */
+    Sint64 den;                     /* fractional part of X (denominator) */
+    Sint64 step;                    /* X increment per row (integer part) */
+    Sint64 remStep;                 /* X increment per row (numerator) */
+};
+
+/**
+ * Intersects a clip rectangle with the surface bounds
+ * @param dst
+ * @param clip may be NULL
+ * @param x1 resulting left bound (inclusive)
+ * @param y1 resulting top bound (inclusive)
+ * @param x2 resulting right bound (exclusive)
+ * @param y2 resulting bottom bound (exclusive)
+ * @return false if nothing can be drawn
+ */
+bool get_clip_bounds(SDL_Surface* dst, const SDL_Rect* clip, int* x1, int* y1, int* x2, int* y2)
+{
+    *x1 = 0;
+    *y1 = 0;
+    *x2 = dst->w;
+    *y2 = dst->h;
+
+    if(clip != NULL)
+    {
+        *x1 = clip->x > *x1 ? clip->x : *x1;
+        *y1 = clip->y > *y1 ? clip->y : *y1;
+        *x2 = clip->x + clip->w < *x2 ? clip->x + clip->w : *x2;
+        *y2 = clip->y + clip->h < *y2 ? clip->y + clip->h : *y2;
+    }
+
+    return *x1 < *x2 && *y1 < *y2;
+}
+
+/**
+ * Floor division for 64-bit integers, the divisor being positive
+ */
+Sint64 floor_div(Sint64 a, Sint64 b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/**
+ * Along a line of major length `major' and minor length `minor', the
+ * minor offset at step k is q(k) = floor((2 k minor + major) / (2 major)).
+ * Restricts [*kfrom, *kto] to the steps where lo <= q(k) <= hi.
+ */
+void clip_minor_axis(Sint64 major, Sint64 minor, Sint64 lo, Sint64 hi, Sint64* kfrom, Sint64* kto)
+{
+    if(minor == 0)
+    {
+        /* q(k) is Always 0 */
+        if(lo > 0 || hi < 0)
+        {
+            *kto = *kfrom - 1;
+        }
+        return;
+    }
+
+    if(lo > 0)
+    {
+        /* Smallest k with 2 k minor + major >= 2 major lo */
+        Sint64 k = -floor_div(-(2 * major * lo - major), 2 * minor);
+        *kfrom = k > *kfrom ? k : *kfrom;
+    }
+
+    /* Largest k with 2 k minor + major <= 2 major (hi + 1) - 1 */
+    Sint64 k = floor_div(2 * major * (hi + 1) - 1 - major, 2 * minor);
+    *kto = k < *kto ? k : *kto;
+}
+
+/**
+ * Draws a line
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param x1
+ * @param y1
+ * @param x2
+ * @param y2
+ * @param color
+ */
+void raster_line(SDL_Surface* dst, const SDL_Rect* clip, int x1, int y1, int x2, int y2, Uint32 color)
+{
+    int cx1, cy1, cx2, cy2;
+    if(!get_clip_bounds(dst, clip, &cx1, &cy1, &cx2, &cy2))
+    {
+        return;
+    }
+
+    /*
+     * Both axes are handled the same way: we step along the major axis
+     * and compute the minor offset with integer arithmetic, so the
+     * visible steps can be found directly instead of walking the whole
+     * line. This gives the same pixels whatever the clip rectangle.
+     */
+    bool xMajor = abs(x2 - x1) >= abs(y2 - y1);
+    int a1 = xMajor ? x1 : y1, a2 = xMajor ? x2 : y2; /* major axis */
+    int b1 = xMajor ? y1 : x1, b2 = xMajor ? y2 : x2; /* minor axis */
+    int alo = xMajor ? cx1 : cy1, ahi = (xMajor ? cx2 : cy2) - 1;
+    int blo = xMajor ? cy1 : cx1, bhi = (xMajor ? cy2 : cx2) - 1;
+
+    Sint64 major = abs(a2 - a1);
+    Sint64 minor = abs(b2 - b1);
+    int sa = a2 >= a1 ? 1 : -1;
+    int sb = b2 >= b1 ? 1 : -1;
+
+    /* Visible Steps Along the Major Axis */
+    Sint64 kfrom = 0, kto = major;
+    Sint64 k = sa > 0 ? alo - a1 : a1 - ahi;
+    kfrom = k > kfrom ? k : kfrom;
+    k = sa > 0 ? ahi - a1 : a1 - alo;
+    kto = k < kto ? k : kto;
+
+    /* Visible Steps Along the Minor Axis */
+    if(major > 0)
+    {
+        if(sb > 0)
+        {
+            clip_minor_axis(major, minor, blo - b1, bhi - b1, &kfrom, &kto);
+        }
+        else
+        {
+            clip_minor_axis(major, minor, b1 - bhi, b1 - blo, &kfrom, &kto);
+        }
+    }
+    else if(b1 < blo || b1 > bhi)
+    {
+        return;
+    }
+
+    if(kfrom > kto)
+    {
+        return;
+    }
+
+    /* Incremental Walk over the Visible Steps */
+    Sint64 num = 2 * kfrom * minor + major;
+    Sint64 den = major > 0 ? 2 * major : 1;
+    int a = a1 + sa * kfrom;
+    int b = b1 + sb * (num / den);
+    Sint64 rem = num % den;
+    int pitch = dst->pitch / 4;
+    Uint32* pixels = (Uint32*) dst->pixels;
+    int stepA = xMajor ? sa : sa * pitch;
+    int stepB = xMajor ? sb * pitch : sb;
+    Uint32* p = pixels + (xMajor ? b * pitch + a : a * pitch + b);
+
+    for(k = kfrom; k <= kto; k++)
+    {
+        *p = color;
+
+        p += stepA;
+        rem += 2 * minor;
+        if(rem >= den)
+        {
+            rem -= den;
+            p += stepB;
+        }
+    }
+}
+
+/**
+ * Draws a circle outline
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param x0 center
+ * @param y0 center
+ * @param r radius
+ * @param color
+ */
+void raster_circle(SDL_Surface* dst, const SDL_Rect* clip, int x0, int y0, int r, Uint32 color)
+{
+    int cx1, cy1, cx2, cy2;
+    if(!get_clip_bounds(dst, clip, &cx1, &cy1, &cx2, &cy2) || r < 0)
+    {
+        return;
+    }
+
+    /* Not Visible at All */
+    if(x0 + r < cx1 || x0 - r >= cx2 || y0 + r < cy1 || y0 - r >= cy2)
+    {
+        return;
+    }
+
+    int pitch = dst->pitch / 4;
+    Uint32* pixels = (Uint32*) dst->pixels;
+
+    /* Midpoint Circle, One Octant Mirrored 8 Times */
+    int x = r, y = 0;
+    int err = 1 - r;
+    while(x >= y)
+    {
+        int px[8] = {x0 + x, x0 + y, x0 - y, x0 - x, x0 - x, x0 - y, x0 + y, x0 + x};
+        int py[8] = {y0 + y, y0 + x, y0 + x, y0 + y, y0 - y, y0 - x, y0 - x, y0 - y};
+        int i;
+        for(i = 0; i < 8; i++)
+        {
+            if(px[i] >= cx1 && px[i] < cx2 && py[i] >= cy1 && py[i] < cy2)
+            {
+                pixels[py[i] * pitch + px[i]] = color;
+            }
+        }
+
+        y ++;
+        if(err < 0)
+        {
+            err += 2 * y + 1;
+        }
+        else
+        {
+            x --;
+            err += 2 * (y - x) + 1;
+        }
+    }
+}
+
+/**
+ * Draws an arc of circle outline, at most a quarter turn long
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param x0 center
+ * @param y0 center
+ * @param r radius
+ * @param ax direction of the arc start, from the center (any length)
+ * @param ay
+ * @param bx direction of the arc end, clockwise from the start
+ * @param by
+ * @param color
+ */
+void raster_arc(SDL_Surface* dst, const SDL_Rect* clip, int x0, int y0, int r,
+                int ax, int ay, int bx, int by, Uint32 color)
+{
+    int cx1, cy1, cx2, cy2;
+    if(!get_clip_bounds(dst, clip, &cx1, &cy1, &cx2, &cy2) || r < 0)
+    {
+        return;
+    }
+
+    /* Not Visible at All */
+    if(x0 + r < cx1 || x0 - r >= cx2 || y0 + r < cy1 || y0 - r >= cy2)
+    {
+        return;
+    }
+
+    int pitch = dst->pitch / 4;
+    Uint32* pixels = (Uint32*) dst->pixels;
+
+    /*
+     * Same pixels as raster_circle, restricted to the directions between
+     * a and b: clockwise from a, counterclockwise from b, and on the same
+     * side as the bisector (the arc is less than half a turn long).
+     */
+    Sint64 mx = (Sint64) ax + bx, my = (Sint64) ay + by;
+    int x = r, y = 0;
+    int err = 1 - r;
+    while(x >= y)
+    {
+        int dx[8] = {x, y, -y, -x, -x, -y, y, x};
+        int dy[8] = {y, x, x, y, -y, -x, -x, -y};
+        int i;
+        for(i = 0; i < 8; i++)
+        {
+            int px = x0 + dx[i], py = y0 + dy[i];
+            if(px >= cx1 && px < cx2 && py >= cy1 && py < cy2
+               && (Sint64) ax * dy[i] - (Sint64) ay * dx[i] >= 0
+               && (Sint64) dx[i] * by - (Sint64) dy[i] * bx >= 0
+               && mx * dx[i] + my * dy[i] >= 0)
+            {
+                pixels[py * pitch + px] = color;
+            }
+        }
+
+        y ++;
+        if(err < 0)
+        {
+            err += 2 * y + 1;
+        }
+        else
+        {
+            x --;
+            err += 2 * (y - x) + 1;
+        }
+    }
+}
+
+/**
+ * Alpha-blends a surface with an alpha channel (e.g. rendered text)
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param src 32 bpp surface with an alpha channel
+ * @param x destination position
+ * @param y destination position
+ */
+void raster_blend(SDL_Surface* dst, const SDL_Rect* clip, SDL_Surface* src, int x, int y)
+{
+    int cx1, cy1, cx2, cy2;
+    if(src == NULL || !get_clip_bounds(dst, clip, &cx1, &cy1, &cx2, &cy2))
+    {
+        return;
+    }
+
+    /* Visible Part of the Source */
+    int sx1 = cx1 - x > 0 ? cx1 - x : 0;
+    int sy1 = cy1 - y > 0 ? cy1 - y : 0;
+    int sx2 = cx2 - x < src->w ? cx2 - x : src->w;
+    int sy2 = cy2 - y < src->h ? cy2 - y : src->h;
+
+    SDL_PixelFormat* sf = src->format;
+    SDL_PixelFormat* df = dst->format;
+
+    int i, j;
+    for(j = sy1; j < sy2; j++)
+    {
+        Uint32* s = (Uint32*) ((Uint8*) src->pixels + j * src->pitch);
+        Uint32* d = (Uint32*) ((Uint8*) dst->pixels + (y + j) * dst->pitch) + x;
+
+        for(i = sx1; i < sx2; i++)
+        {
+            Uint32 a = (s[i] & sf->Amask) >> sf->Ashift;
+            if(a == 0)
+            {
+                continue;
+            }
+
+            Uint32 sr = (s[i] & sf->Rmask) >> sf->Rshift;
+            Uint32 sg = (s[i] & sf->Gmask) >> sf->Gshift;
+            Uint32 sb = (s[i] & sf->Bmask) >> sf->Bshift;
+            Uint32 dr = (d[i] & df->Rmask) >> df->Rshift;
+            Uint32 dg = (d[i] & df->Gmask) >> df->Gshift;
+            Uint32 db = (d[i] & df->Bmask) >> df->Bshift;
+
+            dr = (sr * a + dr * (255 - a) + 127) / 255;
+            dg = (sg * a + dg * (255 - a) + 127) / 255;
+            db = (sb * a + db * (255 - a) + 127) / 255;
+
+            d[i] = (d[i] & df->Amask) | (dr << df->Rshift) | (dg << df->Gshift) | (db << df->Bshift);
+        }
+    }
+}
+
+/**
+ * Writes a run of pixels of the same color
+ * @param p
+ * @param count
+ * @param color
+ */
+static inline void raster_span(Uint32* p, int count, Uint32 color)
+{
+#if defined(__AVX2__)
+    __m256i v = _mm256_set1_epi32(color);
+    while(count >= 8)
+    {
+        _mm256_storeu_si256((__m256i*) p, v);
+        p += 8;
+        count -= 8;
+    }
+#elif defined(__SSE2__)
+    __m128i v = _mm_set1_epi32(color);
+    while(count >= 4)
+    {
+        _mm_storeu_si128((__m128i*) p, v);
+        p += 4;
+        count -= 4;
+    }
+#endif
+    while(count > 0)
+    {
+        *p = color;
+        p ++;
+        count --;
+    }
+}
+
+/**
+ * Orders polygon edges by first covered row
+ */
+int compare_edges(const void* a, const void* b)
+{
+    return ((const struct raster_edge*) a)->ymin - ((const struct raster_edge*) b)->ymin;
+}
+
+/**
+ * Tells whether the crossing of edge a is to the right of edge b's
+ */
+static inline bool edge_after(const struct raster_edge* a, const struct raster_edge* b)
+{
+    if(a->x != b->x)
+    {
+        return a->x > b->x;
+    }
+    return (Uint64) a->rem * (Uint64) b->den > (Uint64) b->rem * (Uint64) a->den;
+}
+
+/**
+ * Fills a polygon (even-odd rule, pixel centers)
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param vx vertices (X)
+ * @param vy vertices (Y)
+ * @param n vertex count
+ * @param color
+ * @param scratch work buffer, grown as needed (initially NULL, free it
+ * when done); one per thread
+ * @param scratchSize size of the work buffer (initially 0)
+ */
+void raster_polygon(SDL_Surface* dst, const SDL_Rect* clip, const int* vx, const int* vy, int n,
+                    Uint32 color, void** scratch, int* scratchSize)
+{
+    int cx1, cy1, cx2, cy2;
+    if(n < 3 || !get_clip_bounds(dst, clip, &cx1, &cy1, &cx2, &cy2))
+    {
+        return;
+    }
+
+    /* Work Buffer: Edge Table, then Active Edge List */
+    int needed = n * (sizeof(struct raster_edge) + sizeof(struct raster_edge*));
+    if(*scratchSize < needed)
+    {
+        free(*scratch);
+        *scratch = malloc(needed);
+        if(*scratch == NULL)
+        {
+            fprintf(stderr, "raster_polygon: malloc failed!\n");
+            exit(EXIT_FAILURE);
+        }
+        *scratchSize = needed;
+    }
+    struct raster_edge* edges = *scratch;
+    struct raster_edge** active = (struct raster_edge**) (edges + n);
+
+    /*
+     * Row y is covered by an edge if its center (y + 0.5) lies between
+     * the edge ends. X is evaluated with exact rational arithmetic, so
+     * crossings landing exactly on a pixel center are resolved the same
+     * way whatever the edge slope or clip rectangle.
+     */
+    int count = 0;
+    int ymin = cy2, ymax = cy1 - 1;
+    int i;
+    for(i = 0; i < n; i++)
+    {
+        int j = (i + 1) % n;
+        int x1 = vx[i], y1 = vy[i], x2 = vx[j], y2 = vy[j];
+
+        if(y1 == y2)
+        {
+            continue; /* horizontal edges never cross a row center */
+        }
+        if(y1 > y2)
+        {
+            int t = x1; x1 = x2; x2 = t;
+            t = y1; y1 = y2; y2 = t;
+        }
+
+        struct raster_edge* e = &edges[count];
+        e->ymin = y1;
+        e->ymax = y2 - 1;
+        e->x1 = x1;
+        e->y1 = y1;
+        e->dx = x2 - x1;
+        e->den = 2 * (Sint64) (y2 - y1);
+        e->step = floor_div(2 * (Sint64) e->dx, e->den);
+        e->remStep = 2 * (Sint64) e->dx - e->step * e->den;
+        count ++;
+
+        ymin = y1 < ymin ? y1 : ymin;
+        ymax = y2 - 1 > ymax ? y2 - 1 : ymax;
+    }
+
+    qsort(edges, count, sizeof(struct raster_edge), compare_edges);
+
+    ymin = ymin > cy1 ? ymin : cy1;
+    ymax = ymax < cy2 - 1 ? ymax : cy2 - 1;
+
+    int pitch = dst->pitch / 4;
+    Uint32* pixels = (Uint32*) dst->pixels;
+    int next = 0;   /* next edge to activate */
+    int nactive = 0;
+    int y;
+
+    for(y = ymin; y <= ymax; y++)
+    {
+        /* Activate Edges Starting Here (or Above the Clip Rectangle) */
+        while(next < count && edges[next].ymin <= y)
+        {
+            struct raster_edge* e = &edges[next];
+            if(e->ymax >= y)
+            {
+                /* X = x1 + dx (2 (y - y1) + 1) / den */
+                Sint64 num = (Sint64) e->dx * (2 * (Sint64) (y - e->y1) + 1);
+                Sint64 q = floor_div(num, e->den);
+                e->x = e->x1 + q;
+                e->rem = num - q * e->den;
+                active[nactive] = e;
+                nactive ++;
+            }
+            next ++;
+        }
+
+        /* Drop Finished Edges, Sort the Others by X (Insertion Sort) */
+        int k = 0;
+        for(i = 0; i < nactive; i++)
+        {
+            if(active[i]->ymax >= y)
+            {
+                struct raster_edge* e = active[i];
+                int m = k;
+                while(m > 0 && edge_after(active[m - 1], e))
+                {
+                    active[m] = active[m - 1];
+                    m --;
+                }
+                active[m] = e;
+                k ++;
+            }
+        }
+        nactive = k;
+
+        /* Fill Between Pairs of Crossings */
+        Uint32* row = pixels + y * pitch;
+        for(i = 0; i + 1 < nactive; i += 2)
+        {
+            /* Pixels Whose Center is in [xa, xb[ */
+            struct raster_edge* a = active[i];
+            struct raster_edge* b = active[i + 1];
+            int xa = (int) (a->x + (2 * a->rem > a->den));
+            int xb = (int) (b->x + (2 * b->rem > b->den));
+
+            xa = xa > cx1 ? xa : cx1;
+            xb = xb < cx2 ? xb : cx2;
+            if(xa < xb)
+            {
+                raster_span(row + xa, xb - xa, color);
+            }
+        }
+
+        /* Step Edges to the Next Row */
+        for(i = 0; i < nactive; i++)
+        {
+            struct raster_edge* e = active[i];
+            e->x += e->step;
+            e->rem += e->remStep;
+            if(e->rem >= e->den)
+            {
+                e->x ++;
+                e->rem -= e->den;
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * MTurtle Raster
+ * Clip-exact rasterization primitives for 32 bpp surfaces. A primitive
+ * drawn piecewise with several clip rectangles gives exactly the same
+ * pixels as when drawn at once, which makes tiled rendering possible.
+ */
+
+#ifndef __MTURTLERASTER_H_
+#define __MTURTLERASTER_H_
+
+#include <SDL/SDL.h>
+
+/**
+ * Draws a line
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param x1
+ * @param y1
+ * @param x2
+ * @param y2
+ * @param color
+ */
+void raster_line(SDL_Surface* dst, const SDL_Rect* clip, int x1, int y1, int x2, int y2, Uint32 color);
+
+/**
+ * Draws a circle outline
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param x0 center
+ * @param y0 center
+ * @param r radius
+ * @param color
+ */
+void raster_circle(SDL_Surface* dst, const SDL_Rect* clip, int x0, int y0, int r, Uint32 color);
+
+/**
+ * Draws an arc of circle outline, at most a quarter turn long
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param x0 center
+ * @param y0 center
+ * @param r radius
+ * @param ax direction of the arc start, from the center (any length)
+ * @param ay
+ * @param bx direction of the arc end, clockwise from the start
+ * @param by
+ * @param color
+ */
+void raster_arc(SDL_Surface* dst, const SDL_Rect* clip, int x0, int y0, int r,
+                int ax, int ay, int bx, int by, Uint32 color);
+
+/**
+ * Alpha-blends a surface with an alpha channel (e.g. rendered text)
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param src 32 bpp surface with an alpha channel
+ * @param x destination position
+ * @param y destination position
+ */
+void raster_blend(SDL_Surface* dst, const SDL_Rect* clip, SDL_Surface* src, int x, int y);
+
+/**
+ * Fills a polygon (even-odd rule, pixel centers)
+ * @param dst 32 bpp surface, locked if necessary
+ * @param clip only pixels inside this rectangle are written
+ * (NULL for the whole surface)
+ * @param vx vertices (X)
+ * @param vy vertices (Y)
+ * @param n vertex count
+ * @param color
+ * @param scratch work buffer, grown as needed (initially NULL, free it
+ * when done); one per thread
+ * @param scratchSize size of the work buffer (initially 0)
+ */
+void raster_polygon(SDL_Surface* dst, const SDL_Rect* clip, const int* vx, const int* vy, int n,
+                    Uint32 color, void** scratch, int* scratchSize);
+
+#endif /* __MTURTLERASTER_H_ */
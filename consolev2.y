@@ -33,13 +33,25 @@
     #include <SDL/SDL_ttf.h>
     #include "MTurtle.h"
     #include "consolev2_common.h"
+    #include "consolev2_vm.h"
+    #include "consolev2_opt.h"
+    #include "consolev2_worker.h"
+    #include "consolev2_batch.h"
     
+    /* Reentrant Scanner, See consolev2.l */
+    #ifndef YY_TYPEDEF_YY_SCANNER_T
+    #define YY_TYPEDEF_YY_SCANNER_T
+    typedef void* yyscan_t;
+    #endif
+}
+
+%code provides {
     /* Declarations from Lex */
-    void yyerror(struct ast_node** ast_result, const char* msg);
-    struct exec_env* yyextra;
-    extern FILE* yyin;
-    extern void scan_string(char* s);
-    extern void clean_buffer();
+    int yylex(YYSTYPE* lval, yyscan_t scanner);
+    struct exec_env* yyget_extra(yyscan_t scanner);
+    void yyerror(yyscan_t scanner, ast_index* ast_result, const char* msg);
+    struct ast_node* scan_string(struct exec_env* env, const char* text);
+    struct ast_node* scan_file(struct exec_env* env, const char* name);
 }
 
 %union {
@@ -47,14 +59,16 @@
     int intval;
     float fltval;
     char* strval;
-    struct ast_node* ast;
+    ast_index ast;
     boolop_type boolop;
 }
 
-%parse-param {struct ast_node** ast_result}
+%define api.pure full
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {ast_index* ast_result}
 
-%token TK_EXIT TK_HELP TK_FORWARD TK_BACKWARD TK_LEFT TK_RIGHT TK_PENDOWN TK_PENUP
-%token TK_CIRCLE TK_CENTEREDCIRCLE TK_WRITE TK_HOME TK_CLEAR TK_RESET TK_ECHO
+%token TK_EXIT TK_HELP TK_STATS TK_FORWARD TK_BACKWARD TK_LEFT TK_RIGHT TK_PENDOWN TK_PENUP
+%token TK_CIRCLE TK_CENTEREDCIRCLE TK_ARC TK_WRITE TK_HOME TK_CLEAR TK_RESET TK_ECHO
 %token TK_LOAD TK_IF TK_THEN TK_ELSE TK_WHILE TK_FOR TK_FROM TK_TO TK_DO
 %token TK_AND TK_OR TK_NOT TK_ENDIF TK_ENDFOR TK_ENDWHILE TK_EQ TK_NEQ TK_GEQ TK_LEQ
 %token TK_ASSIGN TK_NEWLINE TK_NOELSE TK_EOF TK_HIDETURTLE TK_SHOWTURTLE
@@ -76,8 +90,8 @@
 %right TK_ASSIGN
 %left '(' ')'
 
-%type <ast> statements statement assignment expression optional_expr boolexpr turt_forward turt_backward turt_left turt_right
-%type <ast> turt_circle turt_centered_circle turt_write echo load_file blc_if blc_while blc_for blc_repeat
+%type <ast> statements statement assignment expression signed_expr negative_expr optional_expr boolexpr turt_forward turt_backward turt_left turt_right
+%type <ast> turt_circle turt_centered_circle turt_arc turt_write echo load_file blc_if blc_while blc_for blc_repeat
 %type <ast> printable number loop_value basic_func blc_func expr_list idf_list turt_set_color std_color
 %type <boolop> boolop
 
@@ -89,8 +103,8 @@
 top_level
     : statements { *ast_result = $1; }
     | statement { *ast_result = $1; }
-    | newlines { *ast_result = NULL; }
-    | %empty { *ast_result = NULL; }
+    | newlines { *ast_result = AST_NONE; }
+    | %empty { *ast_result = AST_NONE; }
 ;
 
 statements
@@ -99,22 +113,24 @@ statements
 ;
 
 statement
-    : TK_EXIT { $$ = ast_make(AST_EXIT, NULL, NULL); }
-    | TK_HELP { $$ = ast_make(AST_SHOWHELP, NULL, NULL); }
+    : TK_EXIT { $$ = ast_make(AST_EXIT, AST_NONE, AST_NONE); }
+    | TK_HELP { $$ = ast_make(AST_SHOWHELP, AST_NONE, AST_NONE); }
+    | TK_STATS { $$ = ast_make(AST_STATS, AST_NONE, AST_NONE); }
     | turt_forward { $$ = $1; }
     | turt_backward { $$ = $1; }
     | turt_left { $$ = $1; }
     | turt_right { $$ = $1; }
-    | TK_PENDOWN { $$ = ast_make_turtle(TURT_PENDOWN, NULL); }
-    | TK_PENUP { $$ = ast_make_turtle(TURT_PENUP, NULL); }
-    | TK_HIDETURTLE { $$ = ast_make_turtle(TURT_HIDE, NULL); }
-    | TK_SHOWTURTLE { $$ = ast_make_turtle(TURT_SHOW, NULL); }
+    | TK_PENDOWN { $$ = ast_make_turtle(TURT_PENDOWN, AST_NONE); }
+    | TK_PENUP { $$ = ast_make_turtle(TURT_PENUP, AST_NONE); }
+    | TK_HIDETURTLE { $$ = ast_make_turtle(TURT_HIDE, AST_NONE); }
+    | TK_SHOWTURTLE { $$ = ast_make_turtle(TURT_SHOW, AST_NONE); }
     | turt_circle { $$ = $1; }
     | turt_centered_circle { $$ = $1; }
+    | turt_arc { $$ = $1; }
     | turt_write { $$ = $1; }
-    | TK_HOME { $$ = ast_make_turtle(TURT_HOME, NULL); }
-    | TK_CLEAR { $$ = ast_make_turtle(TURT_CLEAR, NULL); }
-    | TK_RESET { $$ = ast_make_turtle(TURT_RESET, NULL); }
+    | TK_HOME { $$ = ast_make_turtle(TURT_HOME, AST_NONE); }
+    | TK_CLEAR { $$ = ast_make_turtle(TURT_CLEAR, AST_NONE); }
+    | TK_RESET { $$ = ast_make_turtle(TURT_RESET, AST_NONE); }
     | turt_set_color { $$ = $1; }
     | echo { $$ = $1; }
     | load_file { $$ = $1; }
@@ -123,15 +139,16 @@ statement
     | blc_for { $$ = $1; }
     | blc_repeat { $$ = $1; }
     | blc_func { $$ = $1; }
-    | TK_RETURN { $$ = ast_make(AST_RETURN, NULL, NULL); }
-    | TK_RETURN expression { $$ = ast_make(AST_RETURN, $2, NULL); }
+    | TK_RETURN { $$ = ast_make(AST_RETURN, AST_NONE, AST_NONE); }
+    | TK_RETURN expression { $$ = ast_make(AST_RETURN, $2, AST_NONE); }
     | assignment { $$ = $1; }
-    | TK_IDENTIFIER '(' ')' { $$ = ast_make(AST_CALL, ast_make_string($1), NULL); }
+    | TK_IDENTIFIER '(' ')' { $$ = ast_make(AST_CALL, ast_make_string($1), AST_NONE); }
     | TK_IDENTIFIER '(' expr_list ')' { $$ = ast_make(AST_CALL, ast_make_string($1), $3); }
     | TK_IDENTIFIER {
-        char* str = malloc(1024);
+        char str[1024];
         snprintf(str, 1024, "-!- Unknown command: %s", $1);
-        $$ = ast_make(AST_ECHO, ast_make_string(str), NULL);
+        yyerror(scanner, ast_result, str);
+        $$ = AST_NONE;
     }
 ;
 
@@ -141,7 +158,7 @@ assignment
 
 expression
     : TK_IDENTIFIER { $$ = ast_make_symref($1); }
-    | TK_IDENTIFIER '(' ')' { $$ = ast_make(AST_CALL, ast_make_string($1), NULL); }
+    | TK_IDENTIFIER '(' ')' { $$ = ast_make(AST_CALL, ast_make_string($1), AST_NONE); }
     | TK_IDENTIFIER '(' expr_list ')' { $$ = ast_make(AST_CALL, ast_make_string($1), $3); }
     | number { $$ = $1; }
     | '(' expression ')' { $$ = $2; }
@@ -150,26 +167,42 @@ expression
     | expression '*' expression { $$ = ast_make(AST_TIMES, $1, $3); }
     | expression '/' expression { $$ = ast_make(AST_DIV, $1, $3); }
     | expression '%' expression { $$ = ast_make(AST_MOD, $1, $3); }
-    /*| '-' expression %prec '-' { $$ = ast_make(AST_UNARY_MINUS, $2, NULL); }*/
+    /*| '-' expression %prec '-' { $$ = ast_make(AST_UNARY_MINUS, $2, AST_NONE); }*/
     | '(' basic_func ')' { $$ = $2; }
     /*| basic_func { $$ = $1; }*/
     | expression TK_RMDR expression { $$ = ast_make_spfunc(SPFUNC_RMDR, $1, $3); }
 ;
 
+signed_expr
+    : expression { $$ = $1; }
+    | negative_expr { $$ = $1; }
+;
+
+negative_expr
+    : '-' number { $$ = ast_make(AST_UNARY_MINUS, $2, AST_NONE); }
+    | '-' TK_IDENTIFIER { $$ = ast_make(AST_UNARY_MINUS, ast_make_symref($2), AST_NONE); }
+    | '-' '(' expression ')' { $$ = ast_make(AST_UNARY_MINUS, $3, AST_NONE); }
+    | negative_expr '+' expression { $$ = ast_make(AST_PLUS, $1, $3); }
+    | negative_expr '-' expression { $$ = ast_make(AST_MINUS, $1, $3); }
+    | negative_expr '*' expression { $$ = ast_make(AST_TIMES, $1, $3); }
+    | negative_expr '/' expression { $$ = ast_make(AST_DIV, $1, $3); }
+    | negative_expr '%' expression { $$ = ast_make(AST_MOD, $1, $3); }
+;
+
 optional_expr
     : expression { $$ = $1; }
     | %empty { $$ = ast_make_integer(0); }
 ;
 
 expr_list
-    : expression { $$ = ast_make(AST_EXPRS, $1, NULL); }
+    : expression { $$ = ast_make(AST_EXPRS, $1, AST_NONE); }
     | expression ',' expr_list { $$ = ast_make(AST_EXPRS, $1, $3); }
 ;
 
 boolexpr
     : expression boolop expression { $$ = ast_make_boolexpr($2, $1, $3); }
     | '(' boolexpr ')' { $$ = $2; }
-    | bool_not boolexpr { $$ = ast_make(AST_NOT, $2, NULL); }
+    | bool_not boolexpr { $$ = ast_make(AST_NOT, $2, AST_NONE); }
     | '(' boolexpr TK_AND boolexpr ')'  { $$ = ast_make(AST_AND, $2, $4); }
     | '(' boolexpr TK_OR boolexpr ')'  { $$ = ast_make(AST_OR, $2, $4); }
     /*| boolexpr TK_AND boolexpr  { $$ = ast_make(AST_AND, $1, $3); }
@@ -219,6 +252,12 @@ turt_centered_circle
     : TK_CENTEREDCIRCLE optional_expr { $$ = ast_make_turtle(TURT_CENTERED_CIRCLE, $2); }
 ;
 
+turt_arc
+    : TK_ARC expression ',' signed_expr {
+        $$ = ast_make_turtle(TURT_ARC, ast_make(AST_EXPRS, $2, ast_make(AST_EXPRS, $4, AST_NONE)));
+    }
+;
+
 printable
     : TK_STRING { $$ = ast_make_string($1); }
     | expression { $$ = $1; }
@@ -249,16 +288,16 @@ std_color
 ;
 
 echo
-    : TK_ECHO printable { $$ = ast_make(AST_ECHO, $2, NULL); }
+    : TK_ECHO printable { $$ = ast_make(AST_ECHO, $2, AST_NONE); }
 ;
 
 load_file
-    : TK_LOAD TK_STRING { $$ = ast_make(AST_LOADFILE, ast_make_string($2), NULL); }
+    : TK_LOAD TK_STRING { $$ = ast_make(AST_LOADFILE, ast_make_string($2), AST_NONE); }
 ;
 
 blc_if
     : TK_IF boolexpr TK_THEN optional_newlines statements TK_ENDIF %prec TK_NOELSE {
-        $$ = ast_make_if($2, $5, NULL);
+        $$ = ast_make_if($2, $5, AST_NONE);
     }
     | TK_IF boolexpr TK_THEN optional_newlines statements TK_ELSE optional_newlines statements TK_ENDIF {
         $$ = ast_make_if($2, $5, $8);
@@ -293,24 +332,24 @@ blc_func
 ;
 
 idf_list
-    : TK_IDENTIFIER { $$ = ast_make(AST_PARAM, ast_make_string($1), NULL); }
+    : TK_IDENTIFIER { $$ = ast_make(AST_PARAM, ast_make_string($1), AST_NONE); }
     | TK_IDENTIFIER ',' idf_list { $$ = ast_make(AST_PARAM, ast_make_string($1), $3); }
-    | %empty { $$ = NULL; }
+    | %empty { $$ = AST_NONE; }
 ;
 
 basic_func
-    : TK_COS expression { $$ = ast_make_spfunc(SPFUNC_COS, $2, NULL); }
-    | TK_SIN expression { $$ = ast_make_spfunc(SPFUNC_SIN, $2, NULL); }
-    | TK_TAN expression { $$ = ast_make_spfunc(SPFUNC_TAN, $2, NULL); }
-    | TK_ABS expression { $$ = ast_make_spfunc(SPFUNC_ABS, $2, NULL); }
-    | TK_SQRT expression { $$ = ast_make_spfunc(SPFUNC_SQRT, $2, NULL); }
-    | TK_LOG expression { $$ = ast_make_spfunc(SPFUNC_LOG, $2, NULL); }
-    | TK_LOG10 expression { $$ = ast_make_spfunc(SPFUNC_LOG10, $2, NULL); }
-    | TK_EXP expression { $$ = ast_make_spfunc(SPFUNC_EXP, $2, NULL); }
+    : TK_COS expression { $$ = ast_make_spfunc(SPFUNC_COS, $2, AST_NONE); }
+    | TK_SIN expression { $$ = ast_make_spfunc(SPFUNC_SIN, $2, AST_NONE); }
+    | TK_TAN expression { $$ = ast_make_spfunc(SPFUNC_TAN, $2, AST_NONE); }
+    | TK_ABS expression { $$ = ast_make_spfunc(SPFUNC_ABS, $2, AST_NONE); }
+    | TK_SQRT expression { $$ = ast_make_spfunc(SPFUNC_SQRT, $2, AST_NONE); }
+    | TK_LOG expression { $$ = ast_make_spfunc(SPFUNC_LOG, $2, AST_NONE); }
+    | TK_LOG10 expression { $$ = ast_make_spfunc(SPFUNC_LOG10, $2, AST_NONE); }
+    | TK_EXP expression { $$ = ast_make_spfunc(SPFUNC_EXP, $2, AST_NONE); }
     | TK_MAX expression expression { $$ = ast_make_spfunc(SPFUNC_MAX, $2, $3); }
     | TK_MIN expression expression { $$ = ast_make_spfunc(SPFUNC_MIN, $2, $3); }
-    | TK_CEIL expression { $$ = ast_make_spfunc(SPFUNC_CEIL, $2, NULL); }
-    | TK_FLOOR expression { $$ = ast_make_spfunc(SPFUNC_FLOOR, $2, NULL); }
+    | TK_CEIL expression { $$ = ast_make_spfunc(SPFUNC_CEIL, $2, AST_NONE); }
+    | TK_FLOOR expression { $$ = ast_make_spfunc(SPFUNC_FLOOR, $2, AST_NONE); }
 ;
 
 newlines
@@ -328,18 +367,86 @@ optional_newlines
 
 #define TERMINAL_FONT_FILE "miscfixed.ttf"
 #define TERMINAL_FONT_SIZE 12
+#define FRAME_RATE 30                   /* while a command runs */
 
-SDL_Surface* screen;
-struct Turtle* turt;
-SDL_Terminal* term;
-
-void yyerror(struct ast_node** ast, const char* msg)
+void yyerror(yyscan_t scanner, ast_index* ast_result, const char* msg)
 {
-    SDL_TerminalPrint(term, "\033[31m%s\033[0m\n", msg);
+    /* Reported to the Environment the Scanner Was Made For */
+    struct exec_env* env = yyget_extra(scanner);
+    env_error(env, env->term != NULL ? "\033[31m%s\033[0m\n" : "%s\n", msg);
 }
 
 int main(int argc, char** argv)
 {
+    /* Names Are Shared by Every Session */
+    var_init();
+    
+    /* Parse Command Line */
+    struct batch_options batch = {malloc_or_die(argc * sizeof(char*)), 0, NULL, 0, malloc_or_die(argc * sizeof(char*)), 0};
+    bool isBatch = false;
+    bool isSweep = false;
+    bool isValid = true;
+    int i;
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--dump-ast") == 0)
+        {
+            ast_dump_trees = true;
+        }
+        else if(strcmp(argv[i], "--batch") == 0)
+        {
+            isBatch = true;
+        }
+        else if(strcmp(argv[i], "--sweep") == 0)
+        {
+            isSweep = true;
+        }
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            batch.output = argv[++i];
+        }
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            batch.jobs = atoi(argv[++i]);
+            isValid = isValid && batch.jobs > 0;
+        }
+        else if(argv[i][0] != '-' && strchr(argv[i], '=') != NULL)
+        {
+            batch.vars[batch.varcount++] = argv[i];
+        }
+        else if(argv[i][0] != '-')
+        {
+            batch.paths[batch.pathcount++] = argv[i];
+        }
+        else
+        {
+            isValid = false;
+        }
+    }
+    
+    /* Scripts and Options Only Make Sense Without Window, a Sweep Takes One Script */
+    bool isHeadless = isBatch || isSweep;
+    if(!isValid || (isBatch && isSweep) || isHeadless != (batch.pathcount > 0) || isSweep != (batch.varcount > 0)
+       || (isSweep && batch.pathcount != 1) || (!isHeadless && (batch.output != NULL || batch.jobs != 0)))
+    {
+        fprintf(stderr, "Usage: %s [--dump-ast]\n"
+                "       %s --batch [-o image|dir] [-j jobs] script.turt|dir...\n"
+                "       %s --sweep [-o sheet.png|dir] [-j jobs] script.turt name=lo..hi|name=a,b,c...\n"
+                "A dir/ ending in / is made if needed; jobs defaults to one per core\n", argv[0], argv[0], argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    
+    /* Run Scripts Without Window */
+    if(isHeadless)
+    {
+        int status = isSweep ? sweep_run(&batch) : batch_run(&batch);
+        free(batch.paths);
+        free(batch.vars);
+        return status;
+    }
+    free(batch.paths);
+    free(batch.vars);
+    
     /* Init SDL */
     if(SDL_Init(SDL_INIT_VIDEO) == -1)
     {
@@ -348,7 +455,7 @@ int main(int argc, char** argv)
     }
 
     /* Init Screen Surface */
-    screen = SDL_SetVideoMode(1140, 480, 32, SDL_HWSURFACE | SDL_DOUBLEBUF);
+    SDL_Surface* screen = SDL_SetVideoMode(1140, 480, 32, SDL_HWSURFACE | SDL_DOUBLEBUF);
     if(screen == NULL)
     {
         fprintf(stderr, "SDL_SetVideoMode() failed: %s\n", SDL_GetError());
@@ -367,12 +474,12 @@ int main(int argc, char** argv)
 
     /* Init MTurtle */
     TT_InitMinimal(screen);
-    turt = TT_Create(640, 480, 0, 0, 0);
+    struct Turtle* turt = TT_Create(640, 480, 0, 0, 0);
     TT_SetSurfacePos(turt, 500, 0);
     TT_PenDown(turt);
 
     /* Init Terminal */
-    term = SDL_CreateTerminal();
+    SDL_Terminal* term = SDL_CreateTerminal();
     if(SDL_TerminalSetFont(term, TERMINAL_FONT_FILE, TERMINAL_FONT_SIZE) == -1)
     {
         fprintf(stderr, "SDL_TerminalSetFont() failed: %s\n", SDL_GetError());
@@ -389,45 +496,84 @@ int main(int argc, char** argv)
     env.term = term;
     env.screen = screen;
     env.turt = turt;
-    env.varlist = NULL;
+    env.vars = NULL;
+    env.varcapacity = 0;
+    env.stack = NULL;
+    env.stacksize = 0;
+    env.stackcapacity = 0;
+    env.frame = -1;
     env.shouldExit = false;
-    env.hasReturned = false;
+    env.worker = NULL;
+    env.errors = 0;
     
-    yyextra = &env;
+    /* Commands Run on a Worker Thread, Which Queues Drawing for This One */
+    static struct worker worker;
+    worker_start(&worker, &env);
     
+    /* Command Being Run, Over Several Frames if Needed */
     struct ast_node* ast = NULL;
+    struct vm_chunk* chunk = NULL;
 
     /* Main Loop */
     for(;;)
     {
-        /* Check for User Events */
+        /* Check for User Events, Without Waiting While a Command Runs */
         SDL_Event ev;
-        SDL_WaitEvent(&ev);
+        int hasEvent = chunk == NULL ? SDL_WaitEvent(&ev) : SDL_PollEvent(&ev);
 
         /* User Exit */
-        if(ev.type == SDL_QUIT)
+        if(hasEvent && ev.type == SDL_QUIT)
         {
+            worker_stop(&worker);
             break;
         }
 
         /* Process Terminal Events */
-        if(ev.type == SDL_TERMINALEVENT)
+        if(hasEvent && ev.type == SDL_TERMINALEVENT)
         {
-            /* Send Command to Lexer */
-            scan_string(ev.user.data2);
-            
-            yyparse(&ast);
-            clean_buffer();
-            
-            /* Run Generated AST */
-            if(ast != NULL)
+            if(chunk != NULL)
+            {
+                SDL_TerminalPrint(term, "-!- Busy, press Ctrl-C to interrupt\n");
+            }
+            else
             {
-                ast_run(&env, ast);
+                /* Send Command to Parser */
+                ast = scan_string(&env, ev.user.data2);
+                
+                /* Compile Generated AST, It Runs in the Background */
+                if(ast != NULL)
+                {
+                    chunk = vm_compile(ast);
+                    worker_run(&worker, chunk);
+                }
+                else
+                {
+                    SDL_TerminalPrint(term, ">>> ");
+                }
             }
+        }
+        
+        /* Interrupt Command */
+        if(hasEvent && ev.type == SDL_KEYDOWN && ev.key.keysym.sym == SDLK_c && (ev.key.keysym.mod & KMOD_CTRL) && chunk != NULL)
+        {
+            SDL_TerminalPrint(term, "^C\n");
+            worker_cancel(&worker);
+        }
+        /*else if(ev.type == SDL_KEYDOWN && ev.key.keysym.sym == SDLK_ESCAPE)
+        {
+            break;
+        }*/
+        
+        /* Draw What the Command Did Until Next Frame Is Due */
+        if(chunk != NULL && worker_drain(&worker, SDL_GetTicks() + 1000 / FRAME_RATE))
+        {
+            vm_free(chunk);
+            chunk = NULL;
             
             /* Exit as Necessary */
             if(env.shouldExit)
             {
+                worker_stop(&worker);
                 break;
             }
             
@@ -435,16 +581,9 @@ int main(int argc, char** argv)
             ast_destroy(ast);
             ast = NULL;
             
-            /* Cannot Return from Top Level */
-            env.hasReturned = false;
-            
             /* Print Prompt */
             SDL_TerminalPrint(term, ">>> ");
         }
-        /*else if(ev.type == SDL_KEYDOWN && ev.key.keysym.sym == SDLK_ESCAPE)
-        {
-            break;
-        }*/
 
         /* Clear Screen */
         SDL_FillRect(screen, NULL, 0);
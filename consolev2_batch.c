@@ -0,0 +1,796 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * Headless batch runner
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include "MTurtle.h"
+#include "consolev2_common.h"
+#include "consolev2_vm.h"
+#include "consolev2_batch.h"
+
+extern struct ast_node* scan_file(struct exec_env*, const char*);
+
+/*
+ * SCRIPT LIST
+ */
+
+struct batch_list {
+    char** paths;
+    int count;
+    int capacity;
+};
+
+/* One per Thread of a Batch */
+struct batch_worker {
+    struct batch_list* list;
+    const char* output;
+    bool outputIsDir;
+    int first;                      /* runs scripts first, first + step... */
+    int step;
+    bool ok;
+    SDL_Thread* thread;
+};
+
+void batch_add(struct batch_list* list, const char* path)
+{
+    if(list->count >= list->capacity)
+    {
+        list->capacity = list->capacity > 0 ? 2 * list->capacity : 16;
+        list->paths = realloc(list->paths, list->capacity * sizeof(char*));
+        if(list->paths == NULL)
+        {
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    list->paths[list->count] = malloc_or_die(strlen(path) + 1);
+    strcpy(list->paths[list->count], path);
+    list->count ++;
+}
+
+bool is_directory(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool batch_output_dir(const char* output, bool* isDir)
+{
+    /* images/ Is a Directory, Made if Need Be; images/out.png Needs images/ */
+    size_t len = strlen(output);
+    if(len > 0 && output[len - 1] == '/')
+    {
+        if(mkdir(output, 0777) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "*** %s: %s\n", output, strerror(errno));
+            return false;
+        }
+        *isDir = true;
+        return true;
+    }
+    
+    *isDir = is_directory(output);
+    
+    const char* slash = strrchr(output, '/');
+    if(!*isDir && slash != NULL && slash != output)
+    {
+        char parent[1024];
+        snprintf(parent, sizeof(parent), "%.*s", (int) (slash - output), output);
+        if(!is_directory(parent))
+        {
+            fprintf(stderr, "*** %s: no such directory\n", parent);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+int batch_jobs(int jobs, int count)
+{
+    /* One Thread per Core by Default, Never More than There Is to Run */
+    jobs = jobs > 0 ? jobs : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    return jobs < count ? jobs : count;
+}
+
+bool has_suffix(const char* str, const char* suffix)
+{
+    size_t len = strlen(str);
+    size_t suffixlen = strlen(suffix);
+    return len >= suffixlen && strcmp(str + len - suffixlen, suffix) == 0;
+}
+
+int compare_paths(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+bool batch_add_directory(struct batch_list* list, const char* dir)
+{
+    DIR* handle = opendir(dir);
+    if(handle == NULL)
+    {
+        fprintf(stderr, "*** %s: %s\n", dir, strerror(errno));
+        return false;
+    }
+    
+    /* Sorted, so Runs Are Reproducible */
+    int first = list->count;
+    struct dirent* entry;
+    
+    while((entry = readdir(handle)) != NULL)
+    {
+        if(entry->d_name[0] != '.' && has_suffix(entry->d_name, ".turt"))
+        {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            batch_add(list, path);
+        }
+    }
+    closedir(handle);
+    
+    qsort(list->paths + first, list->count - first, sizeof(char*), compare_paths);
+    return true;
+}
+
+void batch_image_name(char* buf, size_t size, const char* script, const char* dir)
+{
+    /* script.turt Gives dir/script.png, or script.png Next to It */
+    const char* base = script;
+    if(dir != NULL && strrchr(script, '/') != NULL)
+    {
+        base = strrchr(script, '/') + 1;
+    }
+    
+    if(dir != NULL)
+    {
+        snprintf(buf, size, has_suffix(dir, "/") ? "%s%s" : "%s/%s", dir, base);
+    }
+    else
+    {
+        snprintf(buf, size, "%s", base);
+    }
+    
+    char* dot = strrchr(buf, '.');
+    if(dot != NULL && strchr(dot, '/') == NULL)
+    {
+        *dot = '\0';
+    }
+    
+    strncat(buf, ".png", size - strlen(buf) - 1);
+}
+
+/*
+ * SCRIPT EXECUTION
+ */
+
+void batch_env_init(struct exec_env* env)
+{
+    env->term = NULL;
+    env->screen = NULL;
+    env->turt = TT_Create(BATCH_WIDTH, BATCH_HEIGHT, 0, 0, 0);
+    env->vars = NULL;
+    env->varcapacity = 0;
+    env->stack = NULL;
+    env->stacksize = 0;
+    env->stackcapacity = 0;
+    env->frame = -1;
+    env->shouldExit = false;
+    env->worker = NULL;
+    env->errors = 0;
+    
+    TT_PenDown(env->turt);
+}
+
+void batch_env_free(struct exec_env* env)
+{
+    var_clear_all(env);
+    free(env->stack);
+    TT_Destroy(env->turt);
+}
+
+bool batch_exec(struct exec_env* env, const char* script)
+{
+    /* Nothing Is Drawn if the Script Could Not Be Read or Parsed */
+    int errors = env->errors;
+    struct ast_node* ast = scan_file(env, script);
+    if(ast == NULL)
+    {
+        return env->errors == errors;
+    }
+    
+    struct vm_chunk* chunk = vm_compile(ast);
+    vm_run(env, chunk);
+    vm_free(chunk);
+    ast_destroy(ast);
+    
+    return true;
+}
+
+bool batch_save(struct exec_env* env, const char* image)
+{
+    bool saved = has_suffix(image, ".ppm") ? TT_SavePPM(env->turt, image) : TT_SavePNG(env->turt, image);
+    if(!saved)
+    {
+        env_error(env, "-!- Unable to write %s\n", image);
+    }
+    
+    return saved;
+}
+
+bool batch_script(const char* script, const char* image)
+{
+    struct exec_env env;
+    batch_env_init(&env);
+    
+    if(batch_exec(&env, script))
+    {
+        batch_save(&env, image);
+    }
+    
+    if(env.errors > 0)
+    {
+        fprintf(stderr, "*** %s: %d error(s)\n", script, env.errors);
+    }
+    
+    fflush(stdout);
+    batch_env_free(&env);
+    
+    return env.errors == 0;
+}
+
+bool batch_scripts(struct batch_list* list, const char* output, bool outputIsDir, int first, int step)
+{
+    bool ok = true;
+    int i;
+    
+    for(i = first; i < list->count; i += step)
+    {
+        char image[1024];
+        if(output != NULL && !outputIsDir)
+        {
+            snprintf(image, sizeof(image), "%s", output);
+        }
+        else
+        {
+            batch_image_name(image, sizeof(image), list->paths[i], output);
+        }
+        
+        ok = batch_script(list->paths[i], image) && ok;
+    }
+    
+    return ok;
+}
+
+int batch_worker_main(void* data)
+{
+    struct batch_worker* worker = data;
+    worker->ok = batch_scripts(worker->list, worker->output, worker->outputIsDir, worker->first, worker->step);
+    
+    return 0;
+}
+
+/*
+ * BATCH API
+ */
+
+int batch_run(struct batch_options* options)
+{
+    struct batch_list list = {NULL, 0, 0};
+    bool ok = true;
+    int i;
+    
+    for(i = 0; i < options->pathcount; i++)
+    {
+        if(is_directory(options->paths[i]))
+        {
+            ok = batch_add_directory(&list, options->paths[i]) && ok;
+        }
+        else
+        {
+            batch_add(&list, options->paths[i]);
+        }
+    }
+    
+    if(list.count == 0)
+    {
+        fprintf(stderr, "*** No script to run\n");
+        return EXIT_FAILURE;
+    }
+    
+    bool outputIsDir = false;
+    if(options->output != NULL && !batch_output_dir(options->output, &outputIsDir))
+    {
+        return EXIT_FAILURE;
+    }
+    if(options->output != NULL && !outputIsDir && list.count > 1)
+    {
+        fprintf(stderr, "*** %s: not a directory, cannot hold %d images\n", options->output, list.count);
+        return EXIT_FAILURE;
+    }
+    
+    /* Same Canvas as the Console, but Never Shown */
+    TT_InitHeadless(BATCH_WIDTH, BATCH_HEIGHT);
+    
+    int jobs = batch_jobs(options->jobs, list.count);
+    if(jobs <= 1)
+    {
+        ok = batch_scripts(&list, options->output, outputIsDir, 0, 1) && ok;
+    }
+    else
+    {
+        /* Worker k Runs Scripts k, k + jobs, k + 2 * jobs... */
+        struct batch_worker* workers = malloc_or_die(jobs * sizeof(struct batch_worker));
+        
+        /* Workers Share stdout, Lines Stay in One Piece */
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        
+        for(i = 0; i < jobs; i++)
+        {
+            workers[i].list = &list;
+            workers[i].output = options->output;
+            workers[i].outputIsDir = outputIsDir;
+            workers[i].first = i;
+            workers[i].step = jobs;
+            workers[i].ok = false;
+            workers[i].thread = SDL_CreateThread(batch_worker_main, &workers[i]);
+            if(workers[i].thread == NULL)
+            {
+                fprintf(stderr, "*** FATAL: SDL_CreateThread failed: %s\n", SDL_GetError());
+                exit(EXIT_FAILURE);
+            }
+        }
+        
+        for(i = 0; i < jobs; i++)
+        {
+            SDL_WaitThread(workers[i].thread, NULL);
+            ok = workers[i].ok && ok;
+        }
+        free(workers);
+    }
+    
+    /* Cleanup */
+    for(i = 0; i < list.count; i++)
+    {
+        free(list.paths[i]);
+    }
+    free(list.paths);
+    
+    TT_EndProgram();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * SWEEP
+ */
+
+struct sweep_var {
+    char* name;                     /* interned */
+    float* values;
+    int count;
+};
+
+struct sweep_result {
+    bool done;
+    int errors;
+    double ms;
+};
+
+/* Shared by the Threads of a Sweep */
+struct sweep_shared {
+    int next;                       /* next run to start */
+    struct sweep_result results[];
+};
+
+struct sweep {
+    const char* script;
+    struct sweep_var* vars;
+    int varcount;
+    int runs;
+    const char* imagedir;           /* one image per run, NULL to save next to the script */
+    bool hasSheet;                  /* or a contact sheet */
+    int columns;
+    int sheetw;
+    int sheeth;
+    Uint32* sheet;                  /* contact sheet pixels, each thumbnail written by one thread */
+    struct sweep_shared* shared;
+};
+
+bool sweep_parse_value(const char* str, size_t len, float* val)
+{
+    char buf[64];
+    char* end;
+    
+    if(len == 0 || len >= sizeof(buf))
+    {
+        return false;
+    }
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    
+    *val = strtof(buf, &end);
+    return *end == '\0';
+}
+
+bool sweep_parse(const char* spec, struct sweep_var* var)
+{
+    /* name=lo..hi by Steps of 1, or name=a,b,c */
+    const char* eq = strchr(spec, '=');
+    const char* range = strstr(spec, "..");
+    
+    if(eq == NULL || eq == spec)
+    {
+        return false;
+    }
+    
+    char name[256];
+    snprintf(name, sizeof(name), "%.*s", (int) (eq - spec), spec);
+    var->name = var_intern(name);
+    var->count = 0;
+    
+    if(range != NULL)
+    {
+        float lo, hi;
+        if(!sweep_parse_value(eq + 1, range - eq - 1, &lo) || !sweep_parse_value(range + 2, strlen(range + 2), &hi) || hi < lo || hi - lo >= SWEEP_MAX_RUNS)
+        {
+            return false;
+        }
+        
+        var->values = malloc_or_die(((int) (hi - lo) + 1) * sizeof(float));
+        while(lo + var->count <= hi)
+        {
+            var->values[var->count] = lo + var->count;
+            var->count ++;
+        }
+        return true;
+    }
+    
+    var->values = malloc_or_die(strlen(eq) * sizeof(float));
+    const char* cursor = eq + 1;
+    
+    for(;;)
+    {
+        const char* comma = strchr(cursor, ',');
+        size_t len = comma != NULL ? (size_t) (comma - cursor) : strlen(cursor);
+        
+        if(!sweep_parse_value(cursor, len, &var->values[var->count]))
+        {
+            return false;
+        }
+        var->count ++;
+        
+        if(comma == NULL)
+        {
+            return true;
+        }
+        cursor = comma + 1;
+    }
+}
+
+void sweep_values(struct sweep* sweep, int run, float* values)
+{
+    /* The Last Variable Changes Fastest */
+    int i;
+    for(i = sweep->varcount - 1; i >= 0; i--)
+    {
+        values[i] = sweep->vars[i].values[run % sweep->vars[i].count];
+        run /= sweep->vars[i].count;
+    }
+}
+
+void sweep_label(struct sweep* sweep, int run, char separator, char* buf, size_t size)
+{
+    float* values = malloc_or_die(sweep->varcount * sizeof(float));
+    sweep_values(sweep, run, values);
+    
+    size_t len = 0;
+    int i;
+    buf[0] = '\0';
+    
+    for(i = 0; i < sweep->varcount && len < size; i++)
+    {
+        if(i > 0)
+        {
+            len += snprintf(buf + len, size - len, "%c", separator);
+        }
+        len += snprintf(buf + len, size - len, "%s=%g", sweep->vars[i].name, values[i]);
+    }
+    
+    free(values);
+}
+
+double sweep_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void sweep_thumbnail(struct sweep* sweep, SDL_Surface* surface, int run)
+{
+    /* Average Each Block of SWEEP_SCALE x SWEEP_SCALE Pixels */
+    int cellw = BATCH_WIDTH / SWEEP_SCALE;
+    int cellh = BATCH_HEIGHT / SWEEP_SCALE;
+    int left = SWEEP_GAP + (run % sweep->columns) * (cellw + SWEEP_GAP);
+    int top = SWEEP_GAP + (run / sweep->columns) * (cellh + SWEEP_GAP);
+    int x, y, i, j;
+    
+    SDL_LockSurface(surface);
+    for(y = 0; y < cellh; y++)
+    {
+        for(x = 0; x < cellw; x++)
+        {
+            int r = 0, g = 0, b = 0;
+            
+            for(j = 0; j < SWEEP_SCALE; j++)
+            {
+                Uint32* row = (Uint32*) ((Uint8*) surface->pixels + (y * SWEEP_SCALE + j) * surface->pitch);
+                for(i = 0; i < SWEEP_SCALE; i++)
+                {
+                    Uint8 pr, pg, pb;
+                    SDL_GetRGB(row[x * SWEEP_SCALE + i], surface->format, &pr, &pg, &pb);
+                    r += pr;
+                    g += pg;
+                    b += pb;
+                }
+            }
+            
+            int n = SWEEP_SCALE * SWEEP_SCALE;
+            sweep->sheet[(top + y) * sweep->sheetw + left + x] = SDL_MapRGB(surface->format, r / n, g / n, b / n);
+        }
+    }
+    SDL_UnlockSurface(surface);
+}
+
+void sweep_once(struct sweep* sweep, int run)
+{
+    struct exec_env env;
+    batch_env_init(&env);
+    
+    /* Seed the Swept Variables */
+    float* values = malloc_or_die(sweep->varcount * sizeof(float));
+    sweep_values(sweep, run, values);
+    
+    int i;
+    for(i = 0; i < sweep->varcount; i++)
+    {
+        var_set(&env, sweep->vars[i].name, values[i]);
+    }
+    free(values);
+    
+    double start = sweep_clock();
+    bool ran = batch_exec(&env, sweep->script);
+    double ms = sweep_clock() - start;
+    
+    if(ran && sweep->hasSheet)
+    {
+        sweep_thumbnail(sweep, env.turt->surface, run);
+    }
+    else if(ran)
+    {
+        char label[256];
+        char image[1024];
+        
+        sweep_label(sweep, run, '-', label, sizeof(label));
+        batch_image_name(image, sizeof(image), sweep->script, sweep->imagedir);
+        
+        /* script-depth=1-angle=55.png */
+        image[strlen(image) - strlen(".png")] = '\0';
+        strncat(image, "-", sizeof(image) - strlen(image) - 1);
+        strncat(image, label, sizeof(image) - strlen(image) - 1);
+        strncat(image, ".png", sizeof(image) - strlen(image) - 1);
+        
+        batch_save(&env, image);
+    }
+    
+    fflush(stdout);
+    
+    struct sweep_result* result = &sweep->shared->results[run];
+    result->errors = env.errors;
+    result->ms = ms;
+    result->done = true;
+    
+    batch_env_free(&env);
+}
+
+int sweep_worker(void* data)
+{
+    struct sweep* sweep = data;
+    
+    for(;;)
+    {
+        int run = __atomic_fetch_add(&sweep->shared->next, 1, __ATOMIC_RELAXED);
+        if(run >= sweep->runs)
+        {
+            break;
+        }
+        
+        sweep_once(sweep, run);
+    }
+    
+    return 0;
+}
+
+int sweep_run(struct batch_options* options)
+{
+    struct sweep sweep;
+    int i;
+    
+    sweep.script = options->paths[0];
+    sweep.vars = malloc_or_die(options->varcount * sizeof(struct sweep_var));
+    sweep.varcount = options->varcount;
+    sweep.runs = 1;
+    
+    for(i = 0; i < options->varcount; i++)
+    {
+        if(!sweep_parse(options->vars[i], &sweep.vars[i]))
+        {
+            fprintf(stderr, "*** %s: expected name=lo..hi or name=a,b,c\n", options->vars[i]);
+            return EXIT_FAILURE;
+        }
+        
+        sweep.runs *= sweep.vars[i].count;
+        if(sweep.runs > SWEEP_MAX_RUNS)
+        {
+            fprintf(stderr, "*** More than %d runs\n", SWEEP_MAX_RUNS);
+            return EXIT_FAILURE;
+        }
+    }
+    
+    /* A Named Image Is a Contact Sheet, a Directory Gets One Image per Run */
+    bool outputIsDir = false;
+    if(options->output != NULL && !batch_output_dir(options->output, &outputIsDir))
+    {
+        return EXIT_FAILURE;
+    }
+    sweep.hasSheet = options->output != NULL && !outputIsDir;
+    sweep.imagedir = sweep.hasSheet ? NULL : options->output;
+    
+    sweep.columns = sweep.varcount > 1 ? sweep.vars[sweep.varcount - 1].count : 1;
+    while(sweep.varcount == 1 && sweep.columns * sweep.columns < sweep.runs)
+    {
+        sweep.columns ++;
+    }
+    
+    int rows = (sweep.runs + sweep.columns - 1) / sweep.columns;
+    sweep.sheetw = sweep.hasSheet ? SWEEP_GAP + sweep.columns * (BATCH_WIDTH / SWEEP_SCALE + SWEEP_GAP) : 0;
+    sweep.sheeth = sweep.hasSheet ? SWEEP_GAP + rows * (BATCH_HEIGHT / SWEEP_SCALE + SWEEP_GAP) : 0;
+    
+    /* Results and Contact Sheet Are Written by Every Thread */
+    sweep.shared = malloc_or_die(sizeof(struct sweep_shared) + sweep.runs * sizeof(struct sweep_result));
+    memset(sweep.shared, 0, sizeof(struct sweep_shared) + sweep.runs * sizeof(struct sweep_result));
+    sweep.sheet = sweep.hasSheet ? malloc_or_die((size_t) sweep.sheetw * sweep.sheeth * sizeof(Uint32)) : NULL;
+    
+    TT_InitHeadless(BATCH_WIDTH, BATCH_HEIGHT);
+    
+    /* Same Pixel Format as the Canvases */
+    struct Turtle* sheet = NULL;
+    if(sweep.hasSheet)
+    {
+        sheet = TT_Create(sweep.sheetw, sweep.sheeth, 0, 0, 0);
+        
+        Uint32 grey = SDL_MapRGB(sheet->surface->format, 64, 64, 64);
+        for(i = 0; i < sweep.sheetw * sweep.sheeth; i++)
+        {
+            sweep.sheet[i] = grey;
+        }
+    }
+    
+    int jobs = batch_jobs(options->jobs, sweep.runs);
+    
+    double start = sweep_clock();
+    
+    if(jobs <= 1)
+    {
+        sweep_worker(&sweep);
+    }
+    else
+    {
+        SDL_Thread** threads = malloc_or_die(jobs * sizeof(SDL_Thread*));
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        
+        for(i = 0; i < jobs; i++)
+        {
+            threads[i] = SDL_CreateThread(sweep_worker, &sweep);
+            if(threads[i] == NULL)
+            {
+                fprintf(stderr, "*** FATAL: SDL_CreateThread failed: %s\n", SDL_GetError());
+                exit(EXIT_FAILURE);
+            }
+        }
+        
+        for(i = 0; i < jobs; i++)
+        {
+            SDL_WaitThread(threads[i], NULL);
+        }
+        free(threads);
+    }
+    
+    double ms = sweep_clock() - start;
+    bool ok = true;
+    
+    /* Timings, in Contact Sheet Order */
+    for(i = 0; i < sweep.runs; i++)
+    {
+        struct sweep_result* result = &sweep.shared->results[i];
+        char label[256];
+        
+        sweep_label(&sweep, i, ' ', label, sizeof(label));
+        
+        if(!result->done)
+        {
+            printf("%s: did not finish\n", label);
+            ok = false;
+        }
+        else if(result->errors > 0)
+        {
+            printf("%s: %.2f ms, %d error(s)\n", label, result->ms, result->errors);
+            ok = false;
+        }
+        else
+        {
+            printf("%s: %.2f ms\n", label, result->ms);
+        }
+    }
+    printf("%d runs on %d thread(s) in %.2f ms\n", sweep.runs, jobs > 1 ? jobs : 1, ms);
+    
+    if(sheet != NULL)
+    {
+        /* Copy the Contact Sheet Onto a Surface to Save It */
+        SDL_LockSurface(sheet->surface);
+        int y;
+        for(y = 0; y < sweep.sheeth; y++)
+        {
+            memcpy((Uint8*) sheet->surface->pixels + y * sheet->surface->pitch, &sweep.sheet[y * sweep.sheetw], sweep.sheetw * sizeof(Uint32));
+        }
+        SDL_UnlockSurface(sheet->surface);
+        
+        bool saved = has_suffix(options->output, ".ppm") ? TT_SavePPM(sheet, options->output) : TT_SavePNG(sheet, options->output);
+        if(!saved)
+        {
+            fprintf(stderr, "*** Unable to write %s\n", options->output);
+            ok = false;
+        }
+        TT_Destroy(sheet);
+    }
+    
+    /* Cleanup */
+    free(sweep.shared);
+    free(sweep.sheet);
+    for(i = 0; i < sweep.varcount; i++)
+    {
+        free(sweep.vars[i].values);
+    }
+    free(sweep.vars);
+    
+    TT_EndProgram();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * MTurtle Console
+ * Headless batch runner
+ */
+
+#ifndef __CONSOLEV2_BATCH_H_
+#define __CONSOLEV2_BATCH_H_
+
+#include <stdbool.h>
+
+/*
+ * CUSTOM TYPES
+ */
+
+/*
+ * Batch mode runs scripts without a window or a terminal: echo goes to
+ * stdout, errors to stderr, and each script's drawing is saved as a
+ * PNG, or a PPM when the output name ends in .ppm. Each script starts
+ * from a new turtle and no variables.
+ */
+
+#define BATCH_WIDTH 640
+#define BATCH_HEIGHT 480
+
+/*
+ * A sweep runs one script once for each combination of values given for
+ * some of its variables, which are set before the script starts. Runs
+ * are shared out among threads as they finish, each drawing on its
+ * own canvas, and are either saved one image per run or put side by
+ * side on a contact sheet, one row per combination of all variables
+ * but the last.
+ */
+
+#define SWEEP_MAX_RUNS 4096
+#define SWEEP_SCALE 4                   /* contact sheet thumbnails are this many times smaller */
+#define SWEEP_GAP 2                     /* pixels between thumbnails */
+
+struct batch_options {
+    char** paths;                   /* scripts, or directories of .turt scripts */
+    int pathcount;
+    const char* output;             /* image file, directory, or NULL to save next to each script */
+    int jobs;                       /* worker threads, 0 for one per core */
+    char** vars;                    /* sweep values, as depth=1..8 or angle=55,60,65 */
+    int varcount;
+};
+
+/*
+ * BATCH API
+ */
+
+/* Returns the Process Exit Code, Nonzero if Any Script Failed, One Thread per Core by Default */
+int batch_run(struct batch_options* options);
+
+/* Same for Each Run of a Sweep, One Thread per Core by Default */
+int sweep_run(struct batch_options* options);
+
+#endif /* __CONSOLEV2_BATCH_H_ */
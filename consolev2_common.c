@@ -23,16 +23,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdbool.h>
-#include <math.h>
 #include "MTurtle.h"
 #include "consolev2_common.h"
-
-#define PI 3.14159265
-#define RAD2DEG PI / 180.0
-
-extern struct ast_node* scan_file(char*);
+#include "consolev2_vm.h"
+#include "consolev2_worker.h"
 
 /*
  * UTILITY API
@@ -50,6 +48,57 @@ void* malloc_or_die(size_t size)
     return ptr;
 }
 
+void env_vprint(struct exec_env* env, FILE* out, const char* format, va_list args)
+{
+    char text[1024];
+    vsnprintf(text, sizeof(text), format, args);
+    
+    /* Batch Mode Has No Terminal */
+    if(env->term == NULL)
+    {
+        fputs(text, out);
+        return;
+    }
+    
+    if(env->worker == NULL || !env->worker->busy)
+    {
+        SDL_TerminalPrint(env->term, "%s", text);
+        return;
+    }
+    
+    /* Queue the Text in Pieces for the SDL Thread */
+    struct turtle_cmd cmd;
+    cmd.op = VM_ECHO;
+    cmd.str = NULL;
+    
+    const char* cursor = text;
+    while(*cursor != '\0')
+    {
+        strncpy(cmd.text, cursor, TURTLE_TEXT_SIZE - 1);
+        cmd.text[TURTLE_TEXT_SIZE - 1] = '\0';
+        cursor += strlen(cmd.text);
+        turtle_emit(env, &cmd);
+    }
+}
+
+void env_print(struct exec_env* env, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    env_vprint(env, stdout, format, args);
+    va_end(args);
+}
+
+void env_error(struct exec_env* env, const char* format, ...)
+{
+    env->errors ++;
+    
+    va_list args;
+    va_start(args, format);
+    env_vprint(env, stderr, format, args);
+    va_end(args);
+}
+
 int clamp(int val, int lower, int upper)
 {
     if(val < lower)
@@ -67,978 +116,1262 @@ int clamp(int val, int lower, int upper)
  * LOOKUP TABLE API
  */
 
-struct var_list* var_get(struct exec_env* env, char* name)
+/*
+ * Symbol names are interned: there is a single copy of each name, and
+ * each name is given a slot number when it is first seen. The resolver
+ * binds every variable reference to its slot, so that environments can
+ * store their variables in an array indexed by slot. The name pool is
+ * an open-addressing hash table with linear probing, kept at most half
+ * full.
+ *
+ * The lexer interns every identifier and string, so names are compared
+ * by pointer from then on. Each name is stored right after its slot
+ * number, which lets var_interned_slot find the slot without hashing.
+ * Only names get a slot: string literals are pooled without one, so
+ * that they do not make every environment's variable array longer.
+ *
+ * The pool is shared by every session in the process, so it is guarded
+ * by a mutex, made by var_init before any parse.
+ */
+
+struct symbol_name {
+    int slot;                       /* -1 for a string literal */
+    char text[];
+};
+
+struct symbol {
+    char* name;                     /* text of a struct symbol_name */
+    int slot;
+};
+
+struct symbol* symbol_table = NULL;
+int symbol_count = 0;
+int symbol_capacity = 0;
+int symbol_slots = 0;               /* slots given to names so far */
+SDL_mutex* symbol_lock = NULL;
+
+void var_init()
+{
+    symbol_lock = SDL_CreateMutex();
+    if(symbol_lock == NULL)
+    {
+        fprintf(stderr, "*** FATAL: SDL_CreateMutex failed: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+}
+
+void symbol_table_lock()
+{
+    SDL_LockMutex(symbol_lock);
+}
+
+void symbol_table_unlock()
+{
+    SDL_UnlockMutex(symbol_lock);
+}
+
+unsigned int hash_string(const char* str)
 {
-    struct var_list* cursor = env->varlist;
+    /* FNV-1a */
+    unsigned int h = 2166136261u;
     
-    while(cursor != NULL && strcmp(cursor->name, name) != 0)
+    while(*str != '\0')
     {
-        cursor = cursor->next;
+        h = (h ^ (unsigned char) *str) * 16777619u;
+        str ++;
     }
     
-    return cursor;
+    return h;
 }
 
-struct var_list* var_set(struct exec_env* env, char* name, float val)
+struct symbol* symbol_find(struct symbol* table, int capacity, const char* name)
 {
-    /* Check for Existing Variable */
-    struct var_list* cursor = var_get(env, name);
+    int i = hash_string(name) & (capacity - 1);
     
-    if(cursor != NULL)
+    while(table[i].name != NULL && strcmp(table[i].name, name) != 0)
     {
-        /* Already Defined Variable */
-        if(strcmp(cursor->name, name) != 0)
-        {
-            fprintf(stderr, "CAUTION! Cursor name and symbol name do not match!\n");
-        }
-        
-        if(cursor->isFunc == true)
-        {
-            SDL_TerminalPrint(env->term, "-!- Cannot override function %s!\n", name);
-            return cursor;
-        }
-        
-        cursor->isFunc = false;
-        cursor->val = val;
+        i = (i + 1) & (capacity - 1);
     }
-    else
+    
+    return &table[i];
+}
+
+struct symbol* symbol_lookup(const char* name)
+{
+    if(symbol_capacity == 0)
     {
-        /* New Variable */
-        cursor = malloc_or_die(sizeof(struct var_list));
-        
-        cursor->name = strdup(name);
-        cursor->isFunc = false;
-        cursor->val = val;
-        
-        if(env->varlist == NULL)
+        return NULL;
+    }
+    
+    struct symbol* sym = symbol_find(symbol_table, symbol_capacity, name);
+    return sym->name != NULL ? sym : NULL;
+}
+
+struct symbol* symbol_intern(const char* name, bool isName)
+{
+    struct symbol* sym = symbol_lookup(name);
+    if(sym != NULL && isName && sym->slot == -1)
+    {
+        /* A String Used as a Name at Last */
+        sym->slot = symbol_slots ++;
+        ((struct symbol_name*) (sym->name - offsetof(struct symbol_name, text)))->slot = sym->slot;
+    }
+    if(sym != NULL)
+    {
+        return sym;
+    }
+    
+    /* Grow Pool */
+    if(2 * (symbol_count + 1) > symbol_capacity)
+    {
+        int capacity = symbol_capacity > 0 ? 2 * symbol_capacity : 256;
+        struct symbol* table = calloc(capacity, sizeof(struct symbol));
+        if(table == NULL)
         {
-            /* First Variable */
-            env->varlist = cursor;
+            fprintf(stderr, "*** FATAL: calloc failed!\n");
+            exit(EXIT_FAILURE);
         }
-        else
+        
+        int i;
+        for(i = 0; i < symbol_capacity; i++)
         {
-            /* Put to End of List */
-            struct var_list* cursor2 = env->varlist;
-            while(cursor2->next != NULL)
+            if(symbol_table[i].name != NULL)
             {
-                cursor2 = cursor2->next;
+                *symbol_find(table, capacity, symbol_table[i].name) = symbol_table[i];
             }
-            
-            cursor2->next = cursor;
         }
         
-        cursor->next = NULL;
+        free(symbol_table);
+        symbol_table = table;
+        symbol_capacity = capacity;
+    }
+    
+    struct symbol_name* text = malloc(sizeof(struct symbol_name) + strlen(name) + 1);
+    if(text == NULL)
+    {
+        fprintf(stderr, "*** FATAL: malloc failed!\n");
+        exit(EXIT_FAILURE);
     }
+    text->slot = isName ? symbol_slots ++ : -1;
+    strcpy(text->text, name);
+    
+    sym = symbol_find(symbol_table, symbol_capacity, name);
+    sym->name = text->text;
+    sym->slot = text->slot;
+    symbol_count ++;
+    
+    return sym;
+}
+
+char* var_intern(const char* name)
+{
+    symbol_table_lock();
+    char* text = symbol_intern(name, true)->name;
+    symbol_table_unlock();
+    
+    return text;
+}
+
+char* var_intern_string(const char* str)
+{
+    symbol_table_lock();
+    char* text = symbol_intern(str, false)->name;
+    symbol_table_unlock();
+    
+    return text;
+}
+
+char* var_intern_lookup(const char* name)
+{
+    symbol_table_lock();
+    struct symbol* sym = symbol_lookup(name);
+    char* text = sym != NULL ? sym->name : NULL;
+    symbol_table_unlock();
+    
+    return text;
+}
+
+int var_slot(const char* name)
+{
+    symbol_table_lock();
+    int slot = symbol_intern(name, true)->slot;
+    symbol_table_unlock();
+    
+    return slot;
 }
 
-struct var_list* func_set(struct exec_env* env, char* name, int arg_count, char** arg_vector, struct ast_node* body)
+int var_slot_lookup(const char* name)
 {
-    /* Check for Existing Variable */
-    struct var_list* cursor = var_get(env, name);
+    symbol_table_lock();
+    struct symbol* sym = symbol_lookup(name);
+    int slot = sym != NULL ? sym->slot : -1;
+    symbol_table_unlock();
     
-    if(cursor != NULL)
+    return slot;
+}
+
+int var_interned_slot(const char* name)
+{
+    return ((struct symbol_name*) (name - offsetof(struct symbol_name, text)))->slot;
+}
+
+struct var_list* var_reserve(struct exec_env* env, int slot)
+{
+    if(slot >= env->varcapacity)
     {
-        /* Already Defined Variable */
-        if(strcmp(cursor->name, name) != 0)
+        int capacity = env->varcapacity > 0 ? env->varcapacity : 32;
+        while(capacity <= slot)
         {
-            fprintf(stderr, "CAUTION! Cursor name and symbol name do not match!\n");
+            capacity *= 2;
         }
         
-        if(cursor->isFunc == true)
+        struct var_list* vars = realloc(env->vars, capacity * sizeof(struct var_list));
+        if(vars == NULL)
         {
-            SDL_TerminalPrint(env->term, "-!- Cannot override function %s!\n", name);
-            return cursor;
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
         }
         
-        cursor->isFunc = true;
-        cursor->func.argc = arg_count;
-        cursor->func.argv = arg_vector;
-        cursor->func.body = body;
+        memset(vars + env->varcapacity, 0, (capacity - env->varcapacity) * sizeof(struct var_list));
+        env->vars = vars;
+        env->varcapacity = capacity;
+    }
+    
+    return &env->vars[slot];
+}
+
+struct var_list* var_get_slot(struct exec_env* env, int slot)
+{
+    if(slot < 0 || slot >= env->varcapacity || !env->vars[slot].isDefined)
+    {
+        return NULL;
+    }
+    
+    return &env->vars[slot];
+}
+
+struct var_list* var_set_slot(struct exec_env* env, int slot, char* name, float val)
+{
+    struct var_list* var = var_reserve(env, slot);
+    
+    if(var->isDefined && var->isFunc)
+    {
+        env_error(env, "-!- Cannot override function %s!\n", var->name);
+        return var;
     }
-    else
+    
+    if(!var->isDefined)
     {
         /* New Variable */
-        cursor = malloc_or_die(sizeof(struct var_list));
-        
-        cursor->name = strdup(name);
-        cursor->isFunc = true;
-        cursor->func.argc = arg_count;
-        cursor->func.argv = arg_vector;
-        cursor->func.body = body;
-        
-        if(env->varlist == NULL)
-        {
-            /* First Variable */
-            env->varlist = cursor;
-        }
-        else
-        {
-            /* Put to End of List */
-            struct var_list* cursor2 = env->varlist;
-            while(cursor2->next != NULL)
-            {
-                cursor2 = cursor2->next;
-            }
-            
-            cursor2->next = cursor;
-        }
-        
-        cursor->next = NULL;
+        var->name = name;
+        var->isDefined = true;
+        var->isFunc = false;
     }
     
-    SDL_TerminalPrint(env->term, "%s is defined\n", cursor->name);
+    var->val = val;
+    
+    return var;
+}
+
+struct var_list* var_get(struct exec_env* env, char* name)
+{
+    return var_get_slot(env, var_interned_slot(name));
+}
+
+struct var_list* var_set(struct exec_env* env, char* name, float val)
+{
+    return var_set_slot(env, var_interned_slot(name), name, val);
 }
 
-void var_copy_env(struct exec_env* src, struct exec_env* dest)
+struct var_list* func_set(struct exec_env* env, char* name, int arg_count, char** arg_vector, struct ast_node* body, int frame_size)
 {
-    struct var_list* cursor1 = src->varlist;
-    struct var_list* cursor2 = NULL;
-    struct var_list* temp = NULL;
+    struct var_list* var = var_reserve(env, var_interned_slot(name));
+    
+    if(var->isDefined && var->isFunc)
+    {
+        /* Already Defined Function */
+        env_error(env, "-!- Cannot override function %s!\n", var->name);
+        free(arg_vector);
+        return var;
+    }
+    
+    var->name = name;
+    var->isDefined = true;
+    var->isFunc = true;
+    var->func.argc = arg_count;
+    var->func.argv = arg_vector;
+    var->func.body = ast_clone(body);
+    var->func.framesize = frame_size;
+    var->func.code = NULL;
+    var->func.purity = PURITY_UNKNOWN;
+    var->func.memo = NULL;
     
-    while(cursor1 != NULL)
+    env_print(env, "%s is defined\n", var->name);
+    
+    return var;
+}
+
+void var_clear_all(struct exec_env* env)
+{
+    int i;
+    for(i = 0; i < env->varcapacity; i++)
     {
-        temp = malloc_or_die(sizeof(struct var_list));
+        struct var_list* var = &env->vars[i];
         
-        temp->next = NULL;
-        temp->name = strdup(cursor1->name);
-        temp->isFunc = cursor1->isFunc;
-        if(cursor1->isFunc == false)
+        if(var->isDefined && var->isFunc)
         {
-            temp->val = cursor1->val;
+            /* Names Are Interned, Only the Vector Is Ours */
+            free(var->func.argv);
+            ast_destroy(var->func.body);
+            vm_free(var->func.code);
+            free(var->func.memo);
         }
-        else
+    }
+    
+    free(env->vars);
+    env->vars = NULL;
+    env->varcapacity = 0;
+}
+
+/*
+ * AST ARENA API
+ */
+
+/* Arena of the Tree Being Parsed, One per Thread as Sessions May Parse at Once */
+__thread struct ast_arena ast_parse_arena = {NULL, 0, 0};
+
+ast_index ast_alloc(ast_type type)
+{
+    struct ast_arena* arena = &ast_parse_arena;
+    
+    if(arena->count == 0)
+    {
+        /* Keep Position 0 for AST_NONE */
+        arena->count = 1;
+    }
+    
+    if(arena->count >= arena->capacity)
+    {
+        arena->capacity = arena->capacity > 0 ? 2 * arena->capacity : 64;
+        arena->nodes = realloc(arena->nodes, arena->capacity * sizeof(struct ast_node));
+        if(arena->nodes == NULL)
         {
-            temp->func.argc = cursor1->func.argc;
-            temp->func.argv = cursor1->func.argv;
-            temp->func.body = cursor1->func.body;
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
         }
-        
-        if(dest->varlist == NULL)
+    }
+    
+    ast_index index = arena->count ++;
+    
+    struct ast_node* ast = &arena->nodes[index];
+    memset(ast, 0, sizeof(struct ast_node));
+    ast->type = type;
+    ast->index = index;
+    
+    return index;
+}
+
+struct ast_node* ast_at(ast_index index)
+{
+    /* Only Valid Until the Next ast_alloc */
+    return index == AST_NONE ? NULL : &ast_parse_arena.nodes[index];
+}
+
+struct ast_node* ast_arena_take(ast_index root)
+{
+    /*
+     * Hand the parse arena over to the finished tree: the next parse
+     * starts a new one, and ast_destroy releases this one with a
+     * single free.
+     */
+    
+    struct ast_node* nodes = ast_parse_arena.nodes;
+    
+    ast_parse_arena.nodes = NULL;
+    ast_parse_arena.count = 0;
+    ast_parse_arena.capacity = 0;
+    
+    if(root == AST_NONE)
+    {
+        free(nodes);
+        return NULL;
+    }
+    
+    return &nodes[root];
+}
+
+int ast_children(struct ast_node* ast, ast_index** children)
+{
+    switch(ast->type)
+    {
+    case AST_BOOLEXPR:
+        children[0] = &ast->data.boolexpr.left;
+        children[1] = &ast->data.boolexpr.right;
+        return 2;
+    case AST_IF:
+        children[0] = &ast->data.ifexpr.condition;
+        children[1] = &ast->data.ifexpr.ifactions;
+        children[2] = &ast->data.ifexpr.elseactions;
+        return 3;
+    case AST_WHILE:
+        children[0] = &ast->data.whileexpr.condition;
+        children[1] = &ast->data.whileexpr.loopactions;
+        children[2] = &ast->data.whileexpr.preheader;
+        return 3;
+    case AST_FOR:
+        children[0] = &ast->data.forexpr.begin;
+        children[1] = &ast->data.forexpr.end;
+        children[2] = &ast->data.forexpr.loopactions;
+        children[3] = &ast->data.forexpr.preheader;
+        return 4;
+    case AST_ASSIGN:
+        children[0] = &ast->data.assignexpr.val;
+        return 1;
+    case AST_SPFUNC:
+        children[0] = &ast->data.spfuncexpr.left;
+        children[1] = &ast->data.spfuncexpr.right;
+        return 2;
+    case AST_TURTLE:
+        children[0] = &ast->data.turtleexpr.param;
+        return 1;
+    case AST_REPEAT:
+        children[0] = &ast->data.repeatexpr.count;
+        children[1] = &ast->data.repeatexpr.loopactions;
+        children[2] = &ast->data.repeatexpr.preheader;
+        return 3;
+    case AST_FUNC:
+        children[0] = &ast->data.funcexpr.params;
+        children[1] = &ast->data.funcexpr.body;
+        return 2;
+    case AST_SET_COLOR:
+        children[0] = &ast->data.setcolorexpr.r;
+        children[1] = &ast->data.setcolorexpr.g;
+        children[2] = &ast->data.setcolorexpr.b;
+        return 3;
+    case AST_STRING:
+    case AST_INTEGER:
+    case AST_FLOAT:
+    case AST_SYMREF:
+        return 0;
+    default:
+        children[0] = &ast->data.expr.left;
+        children[1] = &ast->data.expr.right;
+        return 2;
+    }
+}
+
+ast_index ast_count(struct ast_node* ast)
+{
+    ast_index* children[4];
+    int n = ast_children(ast, children);
+    ast_index count = 1;
+    
+    int i;
+    for(i = 0; i < n; i++)
+    {
+        if(*children[i] != AST_NONE)
         {
-            dest->varlist = temp;
+            count += ast_count(AST_CHILD(ast, *children[i]));
         }
-        else
+    }
+    
+    return count;
+}
+
+ast_index ast_copy(struct ast_node* nodes, ast_index* count, struct ast_node* ast)
+{
+    ast_index index = (*count) ++;
+    
+    nodes[index] = *ast;
+    nodes[index].index = index;
+    
+    ast_index* children[4];
+    int n = ast_children(&nodes[index], children);
+    
+    int i;
+    for(i = 0; i < n; i++)
+    {
+        if(*children[i] != AST_NONE)
         {
-            if(cursor2 == NULL)
-            {
-                fprintf(stderr, "CAUTION! cursor2 is NULL and should not be NULL!\n");
-            }
-            cursor2->next = temp;
+            *children[i] = ast_copy(nodes, count, AST_CHILD(ast, *children[i]));
         }
-        
-        cursor2 = temp;
-        
-        cursor1 = cursor1->next;
     }
+    
+    return index;
 }
 
-void var_clear_all(struct exec_env* env)
+struct ast_node* ast_clone(struct ast_node* ast)
 {
-    struct var_list* cursor = env->varlist;
+    /*
+     * Copy a subtree to an arena of its own, nodes in depth-first
+     * order. Function bodies are cloned so they outlive the command
+     * that defined them.
+     */
     
-    while(cursor != NULL)
+    if(ast == NULL)
     {
-        struct var_list* temp = cursor;
-        cursor = cursor->next;
-        
-        free(temp->name);
-        
-        free(temp);
+        return NULL;
     }
     
-    env->varlist = NULL;
+    ast_index count = 1;
+    struct ast_node* nodes = malloc_or_die((ast_count(ast) + 1) * sizeof(struct ast_node));
+    
+    return &nodes[ast_copy(nodes, &count, ast)];
 }
 
 /*
  * AST GENERATION API
  */
 
-struct ast_node* ast_make(ast_type type, struct ast_node* left, struct ast_node* right)
+ast_index ast_make(ast_type type, ast_index left, ast_index right)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(type);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = type;
     ast->data.expr.left = left;
     ast->data.expr.right = right;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_boolexpr(boolop_type op, struct ast_node* left, struct ast_node* right)
+ast_index ast_make_boolexpr(boolop_type op, ast_index left, ast_index right)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_BOOLEXPR);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_BOOLEXPR;
     ast->data.boolexpr.left = left;
     ast->data.boolexpr.right = right;
     ast->data.boolexpr.op = op;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_if(struct ast_node* condition, struct ast_node* ifactions, struct ast_node* elseactions)
+ast_index ast_make_if(ast_index condition, ast_index ifactions, ast_index elseactions)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_IF);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_IF;
     ast->data.ifexpr.condition = condition;
     ast->data.ifexpr.ifactions = ifactions;
     ast->data.ifexpr.elseactions = elseactions;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_while(struct ast_node* condition, struct ast_node* loopactions)
+ast_index ast_make_while(ast_index condition, ast_index loopactions)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_WHILE);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_WHILE;
     ast->data.whileexpr.condition = condition;
     ast->data.whileexpr.loopactions = loopactions;
+    ast->data.whileexpr.preheader = AST_NONE;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_for(char* cursorname, struct ast_node* begin, struct ast_node* end, struct ast_node* loopactions)
+ast_index ast_make_for(char* cursorname, ast_index begin, ast_index end, ast_index loopactions)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_FOR);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_FOR;
     ast->data.forexpr.cursorname = cursorname;
+    ast->data.forexpr.slot = -1;
+    ast->data.forexpr.local = -1;
     ast->data.forexpr.begin = begin;
     ast->data.forexpr.end = end;
     ast->data.forexpr.loopactions = loopactions;
+    ast->data.forexpr.preheader = AST_NONE;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_repeat(struct ast_node* count, struct ast_node* loopactions)
+ast_index ast_make_repeat(ast_index count, ast_index loopactions)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_REPEAT);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_REPEAT;
     ast->data.repeatexpr.count = count;
     ast->data.repeatexpr.loopactions = loopactions;
+    ast->data.repeatexpr.preheader = AST_NONE;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_function(char* name, struct ast_node* params, struct ast_node* body)
+ast_index ast_make_function(char* name, ast_index params, ast_index body)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_FUNC);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_FUNC;
-    ast->data.funcexpr.name = strdup(name);
+    ast->data.funcexpr.name = name;
     ast->data.funcexpr.params = params;
     ast->data.funcexpr.body = body;
+    ast->data.funcexpr.framesize = 0;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_symref(char* name)
+ast_index ast_make_symref(char* name)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_SYMREF);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_SYMREF;
-    ast->data.symrefexpr.name = strdup(name);
+    ast->data.symrefexpr.name = name;
+    ast->data.symrefexpr.slot = -1;
+    ast->data.symrefexpr.local = -1;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_assign(char* name, struct ast_node* val)
+ast_index ast_make_assign(char* name, ast_index val)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_ASSIGN);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_ASSIGN;
-    ast->data.assignexpr.name = strdup(name);
+    ast->data.assignexpr.name = name;
+    ast->data.assignexpr.slot = -1;
+    ast->data.assignexpr.local = -1;
     ast->data.assignexpr.val = val;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_spfunc(spfunc_type type, struct ast_node* left, struct ast_node* right)
+ast_index ast_make_spfunc(spfunc_type type, ast_index left, ast_index right)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_SPFUNC);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_SPFUNC;
     ast->data.spfuncexpr.left = left;
     ast->data.spfuncexpr.right = right;
     ast->data.spfuncexpr.type = type;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_turtle(turt_action_type type, struct ast_node* param)
+ast_index ast_make_turtle(turt_action_type type, ast_index param)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_TURTLE);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_TURTLE;
     ast->data.turtleexpr.param = param;
     ast->data.turtleexpr.type = type;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_integer(int intval)
+ast_index ast_make_integer(int intval)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_INTEGER);
     
-    ast->type = AST_INTEGER;
-    ast->data.intval = intval;
+    ast_at(index)->data.intval = intval;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_float(float fltval)
+ast_index ast_make_float(float fltval)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_FLOAT);
     
-    ast->type = AST_FLOAT;
-    ast->data.fltval = fltval;
+    ast_at(index)->data.fltval = fltval;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_string(char* strval)
+ast_index ast_make_string(char* strval)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_STRING);
     
-    ast->type = AST_STRING;
-    ast->data.strval = strdup(strval);
+    /* Interned Like Names, So Trees Own No Strings */
+    ast_at(index)->data.strval = strval;
     
-    return ast;
+    return index;
 }
 
-struct ast_node* ast_make_setcolor(struct ast_node* r, struct ast_node* g, struct ast_node* b)
+ast_index ast_make_setcolor(ast_index r, ast_index g, ast_index b)
 {
-    struct ast_node* ast = malloc_or_die(sizeof(struct ast_node));
+    ast_index index = ast_alloc(AST_SET_COLOR);
+    struct ast_node* ast = ast_at(index);
     
-    ast->type = AST_SET_COLOR;
     ast->data.setcolorexpr.r = r;
     ast->data.setcolorexpr.g = g;
     ast->data.setcolorexpr.b = b;
     
-    return ast;
+    return index;
 }
 
 /*
- * AST EXECUTION API
+ * AST RESOLUTION API
+ */
+
+/*
+ * Variables are global, except inside function bodies: there, the
+ * parameters and every variable the function assigns to are locals.
+ * Locals live in the function's call frame, numbered from 0 with the
+ * parameters first. A local that has not been set yet is looked up
+ * in the globals, as is every other variable.
  */
 
-void ast_run(struct exec_env* env, struct ast_node* ast)
+struct resolve_scope {
+    char** names;                   /* interned */
+    int count;
+    int capacity;
+};
+
+int scope_find(struct resolve_scope* scope, char* name)
 {
-    if(env->hasReturned == true || ast == NULL)
+    int i;
+    for(i = 0; i < scope->count; i++)
     {
-        return;
+        if(scope->names[i] == name)
+        {
+            return i;
+        }
     }
     
-    /*
-     * We execute each node of our AST depending of its type.
-     */
-    
-    if(ast->type == AST_STATEMENTS)
+    return -1;
+}
+
+int scope_add(struct resolve_scope* scope, char* name)
+{
+    int local = scope_find(scope, name);
+    if(local >= 0)
     {
-        ast_run(env, ast->data.expr.left);
-        ast_run(env, ast->data.expr.right);
+        return local;
     }
-    else if(ast->type == AST_EXIT)
+    
+    if(scope->count >= scope->capacity)
     {
-        env->shouldExit = true;
+        scope->capacity = scope->capacity > 0 ? 2 * scope->capacity : 8;
+        scope->names = realloc(scope->names, scope->capacity * sizeof(char*));
+        if(scope->names == NULL)
+        {
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
+        }
     }
-    else if(ast->type == AST_SHOWHELP)
+    
+    scope->names[scope->count] = name;
+    return scope->count ++;
+}
+
+void scope_collect(struct resolve_scope* scope, struct ast_node* ast)
+{
+    if(ast == NULL)
     {
-        SDL_TerminalPrint(env->term, "Available commands:\n"
-                          "exit: quit application\n"
-                          "fwd n: move forward from n pixels\n"
-                          "back n: move backward from n pixels\n"
-                          "left x: turn x degrees to the left\n"
-                          "right x: turn x degress to the right\n"
-                          "pendown: start drawing\n"
-                          "penup: start moving without drawing\n"
-                          "write x: put x as text at the turtle's current position\n"
-                          "hideturtle: hide cursor\n"
-                          "showturtle: show cursor\n"
-                          "Please see the README file for advanced syntax\n");
+        return;
     }
-    else if(ast->type == AST_ECHO)
+    
+    switch(ast->type)
     {
-        SDL_TerminalPrint(env->term, "%s\n", ast_eval_as_string(env, ast->data.expr.left));
-    }
-    else if(ast->type == AST_TURTLE)
-    {
-        turt_action_type tt_action = ast->data.turtleexpr.type;
-        
-        if(tt_action == TURT_FORWARD)
-        {
-            int param = ast_eval_as_int(env, ast->data.turtleexpr.param);
-            if(param == 0)
-            {
-                param = 20;
-            }
-            TT_Forward(env->turt, param);
-        }
-        else if(tt_action == TURT_BACKWARD)
-        {
-            int param = ast_eval_as_int(env, ast->data.turtleexpr.param);
-            if(param == 0)
-            {
-                param = 20;
-            }
-            TT_Backward(env->turt, param);
-        }
-        else if(tt_action == TURT_LEFT)
-        {
-            float param = ast_eval_as_float(env, ast->data.turtleexpr.param);
-            if(param == 0.0f)
-            {
-                param = 90.0f;
-            }
-            TT_Left(env->turt, param);
-        }
-        else if(tt_action == TURT_RIGHT)
-        {
-            float param = ast_eval_as_float(env, ast->data.turtleexpr.param);
-            if(param == 0.0f)
-            {
-                param = 90.0f;
-            }
-            TT_Right(env->turt, param);
-        }
-        else if(tt_action == TURT_PENDOWN)
-        {
-            TT_PenDown(env->turt);
-        }
-        else if(tt_action == TURT_PENUP)
-        {
-            TT_PenUp(env->turt);
-        }
-        else if(tt_action == TURT_HIDE)
-        {
-            TT_HideTurtle(env->turt);
-        }
-        else if(tt_action == TURT_SHOW)
-        {
-            TT_ShowTurtle(env->turt);
-        }
-        else if(tt_action == TURT_WRITE)
-        {
-            char* param = ast_eval_as_string(env, ast->data.turtleexpr.param);
-            TT_WriteText(env->turt, param);
-        }
-        else if(tt_action == TURT_CENTERED_CIRCLE)
-        {
-            int param = ast_eval_as_int(env, ast->data.turtleexpr.param);
-            if(param == 0)
-            {
-                param = 20;
-            }
-            TT_CenteredCircle(env->turt, param);
-        }
-        else if(tt_action == TURT_CIRCLE)
-        {
-            int param = ast_eval_as_int(env, ast->data.turtleexpr.param);
-            if(param == 0)
-            {
-                param = 20;
-            }
-            TT_Circle(env->turt, param);
-        }
-        else if(tt_action == TURT_HOME)
-        {
-            TT_Home(env->turt);
-        }
-        else if(tt_action == TURT_CLEAR)
-        {
-            TT_Clear(env->turt);
-        }
-        else if(tt_action == TURT_RESET)
-        {
-            TT_Reset(env->turt);
-        }
-        else /* invalid turt_action */
-        {
-            fprintf(stderr, "*** FATAL: invalid turt_action\n");
-            exit(EXIT_FAILURE);
-        }
-    }
-    else if(ast->type == AST_SET_COLOR)
-    {
-        int r = clamp(ast_eval_as_int(env, ast->data.setcolorexpr.r), 0, 255);
-        int g = clamp(ast_eval_as_int(env, ast->data.setcolorexpr.g), 0, 255);
-        int b = clamp(ast_eval_as_int(env, ast->data.setcolorexpr.b), 0, 255);
-        
-        TT_SetColor(env->turt, r, g, b);
+    case AST_ASSIGN:
+        scope_add(scope, ast->data.assignexpr.name);
+        break;
+    case AST_FOR:
+        scope_add(scope, ast->data.forexpr.cursorname);
+        scope_collect(scope, AST_CHILD(ast, ast->data.forexpr.preheader));
+        scope_collect(scope, AST_CHILD(ast, ast->data.forexpr.loopactions));
+        break;
+    case AST_IF:
+        scope_collect(scope, AST_CHILD(ast, ast->data.ifexpr.ifactions));
+        scope_collect(scope, AST_CHILD(ast, ast->data.ifexpr.elseactions));
+        break;
+    case AST_WHILE:
+        scope_collect(scope, AST_CHILD(ast, ast->data.whileexpr.preheader));
+        scope_collect(scope, AST_CHILD(ast, ast->data.whileexpr.loopactions));
+        break;
+    case AST_REPEAT:
+        scope_collect(scope, AST_CHILD(ast, ast->data.repeatexpr.preheader));
+        scope_collect(scope, AST_CHILD(ast, ast->data.repeatexpr.loopactions));
+        break;
+    case AST_STATEMENTS:
+        scope_collect(scope, AST_CHILD(ast, ast->data.expr.left));
+        scope_collect(scope, AST_CHILD(ast, ast->data.expr.right));
+        break;
+    default:
+        break;
     }
-    else if(ast->type == AST_ASSIGN)
+}
+
+int scope_local(struct resolve_scope* scope, char* name)
+{
+    if(scope == NULL)
     {
-        /*
-         * This language does currently not have variable scopes.
-         * All variables are global.
-         */
-        float val = ast_eval_as_float(env, ast->data.assignexpr.val);
-        var_set(env, ast->data.assignexpr.name, val);
+        return -1;
     }
-    else if(ast->type == AST_IF)
+    
+    return scope_find(scope, name);
+}
+
+void ast_resolve_scope(struct ast_node* ast, struct resolve_scope* scope)
+{
+    if(ast == NULL)
     {
-        if(ast_eval_boolexpr(env, ast->data.ifexpr.condition))
-        {
-            ast_run(env, ast->data.ifexpr.ifactions);
-        }
-        else
-        {
-            ast_run(env, ast->data.ifexpr.elseactions);
-        }
+        return;
     }
-    else if(ast->type == AST_WHILE)
+    
+    /*
+     * Bind every variable reference to its slots, so that evaluation
+     * does not have to look names up.
+     */
+    
+    switch(ast->type)
     {
-        while(ast_eval_boolexpr(env, ast->data.whileexpr.condition))
-        {
-            ast_run(env, ast->data.whileexpr.loopactions);
-        }
-    }
-    else if(ast->type == AST_FOR)
+    case AST_SYMREF:
+        ast->data.symrefexpr.slot = var_interned_slot(ast->data.symrefexpr.name);
+        ast->data.symrefexpr.local = scope_local(scope, ast->data.symrefexpr.name);
+        break;
+    case AST_ASSIGN:
+        ast->data.assignexpr.slot = var_interned_slot(ast->data.assignexpr.name);
+        ast->data.assignexpr.local = scope_local(scope, ast->data.assignexpr.name);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.assignexpr.val), scope);
+        break;
+    case AST_FOR:
+        ast->data.forexpr.slot = var_interned_slot(ast->data.forexpr.cursorname);
+        ast->data.forexpr.local = scope_local(scope, ast->data.forexpr.cursorname);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.forexpr.begin), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.forexpr.end), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.forexpr.preheader), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.forexpr.loopactions), scope);
+        break;
+    case AST_BOOLEXPR:
+        ast_resolve_scope(AST_CHILD(ast, ast->data.boolexpr.left), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.boolexpr.right), scope);
+        break;
+    case AST_IF:
+        ast_resolve_scope(AST_CHILD(ast, ast->data.ifexpr.condition), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.ifexpr.ifactions), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.ifexpr.elseactions), scope);
+        break;
+    case AST_WHILE:
+        ast_resolve_scope(AST_CHILD(ast, ast->data.whileexpr.condition), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.whileexpr.preheader), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.whileexpr.loopactions), scope);
+        break;
+    case AST_SPFUNC:
+        ast_resolve_scope(AST_CHILD(ast, ast->data.spfuncexpr.left), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.spfuncexpr.right), scope);
+        break;
+    case AST_TURTLE:
+        ast_resolve_scope(AST_CHILD(ast, ast->data.turtleexpr.param), scope);
+        break;
+    case AST_REPEAT:
+        ast_resolve_scope(AST_CHILD(ast, ast->data.repeatexpr.count), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.repeatexpr.preheader), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.repeatexpr.loopactions), scope);
+        break;
+    case AST_FUNC:
     {
-        int i = ast_eval_as_int(env, ast->data.forexpr.begin);
-        int end = ast_eval_as_int(env, ast->data.forexpr.end);
+        /* New Scope: Parameters, Then Assigned Variables */
+        struct resolve_scope inner = {NULL, 0, 0};
+        struct ast_node* cursor = AST_CHILD(ast, ast->data.funcexpr.params);
         
-        while(i <= end)
+        while(cursor != NULL && cursor->type == AST_PARAM)
         {
-            var_set(env,  ast->data.forexpr.cursorname, (float) i);
-            ast_run(env, ast->data.forexpr.loopactions);
-            i ++;
+            scope_add(&inner, AST_CHILD(cursor, cursor->data.expr.left)->data.strval);
+            cursor = AST_CHILD(cursor, cursor->data.expr.right);
         }
         
-        var_set(env, ast->data.forexpr.cursorname, (float) i);
+        scope_collect(&inner, AST_CHILD(ast, ast->data.funcexpr.body));
+        ast_resolve_scope(AST_CHILD(ast, ast->data.funcexpr.body), &inner);
+        
+        ast->data.funcexpr.framesize = inner.count;
+        free(inner.names);
+        break;
     }
-    else if(ast->type == AST_REPEAT)
-    {
-        int count = ast_eval_as_int(env, ast->data.repeatexpr.count);
-        int i = 1;
-
-        while(i <= count)
-        {
-            ast_run(env, ast->data.repeatexpr.loopactions);
-            i ++;
-        }
+    case AST_SET_COLOR:
+        ast_resolve_scope(AST_CHILD(ast, ast->data.setcolorexpr.r), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.setcolorexpr.g), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.setcolorexpr.b), scope);
+        break;
+    case AST_STRING:
+    case AST_INTEGER:
+    case AST_FLOAT:
+        break;
+    default:
+        ast_resolve_scope(AST_CHILD(ast, ast->data.expr.left), scope);
+        ast_resolve_scope(AST_CHILD(ast, ast->data.expr.right), scope);
+        break;
     }
-    else if(ast->type == AST_LOADFILE)
-    {
-        struct ast_node* ast2 = scan_file(ast_eval_as_string(env, ast->data.expr.left));
+}
+
+void ast_resolve(struct ast_node* ast)
+{
+    ast_resolve_scope(ast, NULL);
+}
+
+/*
+ * AST EXECUTION API
+ */
+
+void print_help(struct exec_env* env)
+{
+    env_print(env, "Available commands:\n"
+              "exit: quit application\n"
+              "fwd n: move forward from n pixels\n"
+              "back n: move backward from n pixels\n"
+              "left x: turn x degrees to the left\n"
+              "right x: turn x degress to the right\n"
+              "pendown: start drawing\n"
+              "penup: start moving without drawing\n"
+              "arc r, x: move along an arc of radius r, turning x degrees to the left\n"
+              "write x: put x as text at the turtle's current position\n"
+              "hideturtle: hide cursor\n"
+              "showturtle: show cursor\n"
+              "stats: show how often function results were reused\n"
+              "Please see the README file for advanced syntax\n");
+}
 
-        ast_run(env, ast2);
-        ast_destroy(ast2);
+void func_define(struct exec_env* env, struct ast_node* ast)
+{
+    /* Count Args */
+    int arg_count = 0;
+    struct ast_node* cursor = AST_CHILD(ast, ast->data.funcexpr.params);
+    
+    while(cursor != NULL && cursor->type == AST_PARAM)
+    {
+        arg_count ++;
+        cursor = AST_CHILD(cursor, cursor->data.expr.right);
     }
-    else if(ast->type == AST_CALL)
+    
+    /* Make Arg Vector */
+    char** arg_vector = NULL;
+    if(arg_count > 0)
     {
-        /* Lookup Function in Symbol Table */
-        char* name = ast_eval_as_string(env, ast->data.expr.left);
-        struct var_list* var = var_get(env, name);
+        arg_vector = malloc(sizeof(char*) * arg_count);
         
-        if(var == NULL)
-        {
-            SDL_TerminalPrint(env->term, "-!- Undefined function: %s\n", name);
-            return;
-        }
-        
-        if(!(var->isFunc))
-        {
-            SDL_TerminalPrint(env->term, "-!- %s: is not a function\n", name);
-            return;
-        }
-        
-        /* Prepare Environment */
-        struct exec_env env2;
-        env2.screen = env->screen;
-        env2.turt = env->turt;
-        env2.term = env->term;
-        env2.hasReturned = false;
-        env2.shouldExit = false;
-        env2.varlist = NULL;
-        
-        var_copy_env(env, &env2);
-        
-        /* Push Params */
-        struct ast_node* cursor = ast->data.expr.right;
+        cursor = AST_CHILD(ast, ast->data.funcexpr.params);
         int i = 0;
-        while(cursor != NULL && cursor->type == AST_EXPRS)
-        {
-            if(i >= var->func.argc) break;
-            
-            char* param_name = var->func.argv[i];
-            float param_val = ast_eval_as_float(env, cursor->data.expr.left);
-            var_set(&env2, param_name, param_val);
-            
-            i++;
-            cursor = cursor->data.expr.right;
-        }
         
-        /* Call Function */
-        ast_run(&env2, var->func.body);
-        
-        /* Cleanup */
-        var_clear_all(&env2);
-        if(env2.shouldExit == true)
-        {
-            /* Propagate Exit */
-            env->shouldExit = true;
-        }
-    }
-    else if(ast->type == AST_RETURN)
-    {
-        if(ast->data.expr.left != NULL)
+        while(cursor != NULL && cursor->type == AST_PARAM)
         {
-            env->returnValue = ast_eval_as_float(env, ast->data.expr.left);
+            if(i >= arg_count) break;
+            arg_vector[i] = AST_CHILD(cursor, cursor->data.expr.left)->data.strval;
+            
+            i ++;
+            cursor = AST_CHILD(cursor, cursor->data.expr.right);
         }
-        
-        env->hasReturned = true;
     }
-    else if(ast->type == AST_FUNC)
+    
+    /* Put Function to Symbol Table */
+    func_set(env, ast->data.funcexpr.name, arg_count, arg_vector, AST_CHILD(ast, ast->data.funcexpr.body), ast->data.funcexpr.framesize);
+}
+
+int frame_push(struct exec_env* env, int size)
+{
+    /*
+     * Push a frame on the call stack. The stack only grows when a call
+     * goes deeper than any call before it.
+     */
+    
+    int base = env->stacksize;
+    
+    if(base + size > env->stackcapacity)
     {
-        /* Count Args */
-        int arg_count = 0;
-        struct ast_node* cursor = ast->data.funcexpr.params;
-        
-        while(cursor != NULL && cursor->type == AST_PARAM)
+        int capacity = env->stackcapacity > 0 ? env->stackcapacity : 256;
+        while(capacity < base + size)
         {
-            arg_count ++;
-            cursor = cursor->data.expr.right;
+            capacity *= 2;
         }
         
-        /* Make Arg Vector */
-        char** arg_vector = NULL;
-        if(arg_count > 0)
+        struct frame_slot* stack = realloc(env->stack, capacity * sizeof(struct frame_slot));
+        if(stack == NULL)
         {
-            arg_vector = malloc(sizeof(char*) * arg_count);
-            
-            cursor = ast->data.funcexpr.params;
-            int i = 0;
-            
-            while(cursor != NULL && cursor->type == AST_PARAM)
-            {
-                if(i >= arg_count) break;
-                arg_vector[i] = ast_eval_as_string(env, cursor->data.expr.left);
-                
-                i ++;
-                cursor = cursor->data.expr.right;
-            }
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
         }
         
-        /* Put Function to Symbol Table */
-        func_set(env, ast->data.funcexpr.name, arg_count, arg_vector, ast->data.funcexpr.body);
+        env->stack = stack;
+        env->stackcapacity = capacity;
     }
-    else
+    
+    int i;
+    for(i = 0; i < size; i++)
     {
-        fprintf(stderr, "*** FATAL: invalid AST node for EXEC context\n");
-        exit(EXIT_FAILURE);
+        env->stack[base + i].isSet = false;
     }
+    env->stacksize = base + size;
+    
+    return base;
 }
 
-bool ast_eval_boolexpr(struct exec_env* env, struct ast_node* ast)
+/*
+ * MEMOIZATION API
+ */
+
+struct purity_check {
+    struct exec_env* env;
+    struct var_list* var;           /* function being checked */
+    bool* assigned;                 /* locals surely set at this point */
+    int size;
+};
+
+bool* purity_save(struct purity_check* check)
 {
-    if(ast == NULL)
-    {
-        fprintf(stderr, "*** FATAL: AST node for EVAL_BOOLEXPR context is NULL!\n");
-        exit(EXIT_FAILURE);
-    }
-    if(ast->type == AST_BOOLEXPR)
-    {
-        float left = ast_eval_as_float(env, ast->data.boolexpr.left);
-        float right = ast_eval_as_float(env, ast->data.boolexpr.right);
-        switch(ast->data.boolexpr.op)
-        {
-        case OP_EQ:
-            return left == right;
-            break;
-        case OP_NEQ:
-            return left != right;
-            break;
-        case OP_LESS:
-            return left < right;
-            break;
-        case OP_GREATER:
-            return left > right;
-            break;
-        case OP_LEQ:
-            return left <= right;
-            break;
-        case OP_GEQ:
-            return left >= right;
-            break;
-        default:
-            fprintf(stderr, "*** FATAL: Invalid relational operation\n");
-            exit(EXIT_FAILURE);
-            break;
-        }
-    }
-    else if(ast->type == AST_NOT)
-    {
-        return !(ast_eval_boolexpr(env, ast->data.expr.left));
-    }
-    else if(ast->type == AST_AND)
-    {
-        return ast_eval_boolexpr(env, ast->data.expr.left) && ast_eval_boolexpr(env, ast->data.expr.right);
-    }
-    else if(ast->type == AST_OR)
-    {
-        return ast_eval_boolexpr(env, ast->data.expr.left) || ast_eval_boolexpr(env, ast->data.expr.right);
-    }
-    else
-    {
-        fprintf(stderr, "*** FATAL: Invalid boolexpr node\n");
-        exit(EXIT_FAILURE);
-    }
+    bool* saved = malloc_or_die(check->size * sizeof(bool));
+    memcpy(saved, check->assigned, check->size * sizeof(bool));
+    
+    return saved;
 }
 
-int ast_eval_as_int(struct exec_env* env, struct ast_node* ast)
+bool purity_walk(struct purity_check* check, struct ast_node* ast);
+
+bool purity_call(struct purity_check* check, struct ast_node* ast)
 {
-    if(ast == NULL)
-    {
-        fprintf(stderr, "*** FATAL: AST node for EVAL_INT context is NULL!\n");
-        exit(EXIT_FAILURE);
-    }
+    int argc = 0;
+    struct ast_node* cursor = AST_CHILD(ast, ast->data.expr.right);
     
-    if(ast->type == AST_INTEGER)
+    while(cursor != NULL && cursor->type == AST_EXPRS)
     {
-        return ast->data.intval;
+        if(!purity_walk(check, AST_CHILD(cursor, cursor->data.expr.left)))
+        {
+            return false;
+        }
+        
+        argc ++;
+        cursor = AST_CHILD(cursor, cursor->data.expr.right);
     }
-    else
+    
+    /* Missing Arguments Read the Globals of the Same Name */
+    struct var_list* callee = var_get(check->env, AST_CHILD(ast, ast->data.expr.left)->data.strval);
+    if(callee == NULL || !(callee->isFunc) || argc < callee->func.argc)
     {
-        float fltval = ast_eval_as_float(env, ast);
-        return (int) fltval;
+        return false;
     }
+    
+    /* Functions Still Being Checked Are Only Trusted to Recurse Directly */
+    return callee == check->var || func_is_pure(check->env, callee);
 }
 
-float ast_eval_as_float(struct exec_env* env, struct ast_node* ast)
+bool purity_walk(struct purity_check* check, struct ast_node* ast)
 {
     if(ast == NULL)
     {
-        fprintf(stderr, "*** FATAL: AST node for EVAL_FLOAT context is NULL!\n");
-        exit(EXIT_FAILURE);
+        return true;
     }
     
-    if(ast->type == AST_FLOAT)
-    {
-        return ast->data.fltval;
-    }
-    else if(ast->type == AST_INTEGER)
-    {
-        return (float) ast->data.intval;
-    }
-    if(ast->type == AST_PLUS)
-    {
-        return ast_eval_as_float(env, ast->data.expr.left) + ast_eval_as_float(env, ast->data.expr.right);
-    }
-    else if(ast->type == AST_MINUS)
-    {
-        return ast_eval_as_float(env, ast->data.expr.left) - ast_eval_as_float(env, ast->data.expr.right);
-    }
-    else if(ast->type == AST_TIMES)
-    {
-        return ast_eval_as_float(env, ast->data.expr.left) * ast_eval_as_float(env, ast->data.expr.right);
-    }
-    else if(ast->type == AST_DIV)
+    switch(ast->type)
     {
-        float right = ast_eval_as_float(env, ast->data.expr.right);
-        if(right == 0.0f)
+    case AST_INTEGER:
+    case AST_FLOAT:
+        return true;
+    case AST_SYMREF:
+        /* Unset Locals Read the Global of the Same Name */
+        return ast->data.symrefexpr.local >= 0 && check->assigned[ast->data.symrefexpr.local];
+    case AST_ASSIGN:
+        if(ast->data.assignexpr.local < 0 || !purity_walk(check, AST_CHILD(ast, ast->data.assignexpr.val)))
         {
-            SDL_TerminalPrint(env->term, "-!- Division by zero will result in undefined behaviour!\n");
-            return 0.0f;
+            return false;
         }
-        return ast_eval_as_float(env, ast->data.expr.left) / right;
-    }
-    else if(ast->type == AST_MOD)
+        
+        check->assigned[ast->data.assignexpr.local] = true;
+        return true;
+    case AST_PLUS:
+    case AST_MINUS:
+    case AST_TIMES:
+    case AST_DIV:
+    case AST_MOD:
+    case AST_UNARY_MINUS:
+    case AST_AND:
+    case AST_OR:
+    case AST_NOT:
+    case AST_STATEMENTS:
+    case AST_RETURN:
+        return purity_walk(check, AST_CHILD(ast, ast->data.expr.left)) && purity_walk(check, AST_CHILD(ast, ast->data.expr.right));
+    case AST_BOOLEXPR:
+        return purity_walk(check, AST_CHILD(ast, ast->data.boolexpr.left)) && purity_walk(check, AST_CHILD(ast, ast->data.boolexpr.right));
+    case AST_SPFUNC:
+        return purity_walk(check, AST_CHILD(ast, ast->data.spfuncexpr.left)) && purity_walk(check, AST_CHILD(ast, ast->data.spfuncexpr.right));
+    case AST_CALL:
+        return purity_call(check, ast);
+    case AST_IF:
     {
-        float right = ast_eval_as_float(env, ast->data.expr.right);
-        if(right == 0.0f)
+        if(!purity_walk(check, AST_CHILD(ast, ast->data.ifexpr.condition)))
         {
-            SDL_TerminalPrint(env->term, "-!- Modulo by zero will result in undefined behaviour!\n");
-            return 0.0f;
+            return false;
         }
-        return (float) fmod(ast_eval_as_float(env, ast->data.expr.left), right);
-    }
-    else if(ast->type == AST_UNARY_MINUS)
-    {
-        return 0.0f - ast_eval_as_float(env, ast->data.expr.left);
-    }
-    else if(ast->type == AST_SYMREF)
-    {
-        struct var_list* var = var_get(env, strdup(ast->data.symrefexpr.name));
-        if(var == NULL)
+        
+        /* Set After the Branch Only if Set by Both Arms */
+        bool* before = purity_save(check);
+        bool pure = purity_walk(check, AST_CHILD(ast, ast->data.ifexpr.ifactions));
+        bool* after = purity_save(check);
+        
+        memcpy(check->assigned, before, check->size * sizeof(bool));
+        pure = pure && purity_walk(check, AST_CHILD(ast, ast->data.ifexpr.elseactions));
+        
+        int i;
+        for(i = 0; i < check->size; i++)
         {
-            SDL_TerminalPrint(env->term, "-!- Undefined variable %s, defaulting to 0!\n", ast->data.symrefexpr.name);
-            return 0.0f;
+            check->assigned[i] = check->assigned[i] && after[i];
         }
-        return var->val;
+        
+        free(before);
+        free(after);
+        return pure;
     }
-    else if(ast->type == AST_SPFUNC)
+    case AST_WHILE:
+    case AST_REPEAT:
+    case AST_FOR:
     {
-        spfunc_type type = ast->data.spfuncexpr.type;
-        struct ast_node* left = ast->data.spfuncexpr.left;
-        struct ast_node* right = ast->data.spfuncexpr.right;
+        /* Loop Bodies, and What Was Hoisted Out of Them, May Not Run at All */
+        struct ast_node* loopactions;
+        struct ast_node* preheader;
+        bool pure;
         
-        if(type == SPFUNC_COS)
-        {
-            return (float) cos(ast_eval_as_float(env, left) * RAD2DEG);
-        }
-        else if(type == SPFUNC_SIN)
-        {
-            return (float) sin(ast_eval_as_float(env, left) * RAD2DEG);
-        }
-        else if(type == SPFUNC_TAN)
-        {
-            return (float) tan(ast_eval_as_float(env, left) * RAD2DEG);
-        }
-        else if(type == SPFUNC_ABS)
-        {
-            return (float) fabs(ast_eval_as_float(env, left));
-        }
-        else if(type == SPFUNC_SQRT)
-        {
-            return (float) sqrt(ast_eval_as_float(env, left));
-        }
-        else if(type == SPFUNC_LOG)
-        {
-            return (float) log(ast_eval_as_float(env, left));
-        }
-        else if(type == SPFUNC_LOG10)
-        {
-            return (float) log10(ast_eval_as_float(env, left));
-        }
-        else if(type == SPFUNC_EXP)
-        {
-            return (float) exp(ast_eval_as_float(env, left));
-        }
-        else if(type == SPFUNC_RMDR)
-        {
-            float rightval = ast_eval_as_float(env, right);
-            if(rightval == 0.0f)
-            {
-                SDL_TerminalPrint(env->term, "-!- Division by zero will result in undefined behaviour!\n");
-                return 0.0f;
-            }
-            float r = (float) fmod(ast_eval_as_float(env, ast->data.expr.left), rightval);
-            return r < 0 ? r + rightval : r;
-        }
-        else if(type == SPFUNC_MAX)
-        {
-            float leftval = ast_eval_as_float(env, left);
-            float rightval = ast_eval_as_float(env, right);
-            return leftval > rightval ? leftval : rightval;
-        }
-        else if(type == SPFUNC_MIN)
+        if(ast->type == AST_WHILE)
         {
-            float leftval = ast_eval_as_float(env, left);
-            float rightval = ast_eval_as_float(env, right);
-            return leftval < rightval ? leftval : rightval;
+            pure = purity_walk(check, AST_CHILD(ast, ast->data.whileexpr.condition));
+            loopactions = AST_CHILD(ast, ast->data.whileexpr.loopactions);
+            preheader = AST_CHILD(ast, ast->data.whileexpr.preheader);
         }
-        else if(type == SPFUNC_CEIL)
+        else if(ast->type == AST_REPEAT)
         {
-            return (float) ceil(ast_eval_as_float(env, left));
-        }
-        else if(type == SPFUNC_FLOOR)
-        {
-            return (float) floor(ast_eval_as_float(env, left));
+            pure = purity_walk(check, AST_CHILD(ast, ast->data.repeatexpr.count));
+            loopactions = AST_CHILD(ast, ast->data.repeatexpr.loopactions);
+            preheader = AST_CHILD(ast, ast->data.repeatexpr.preheader);
         }
         else
         {
-            fprintf(stderr, "*** FATAL: invalid spfunc_type");
-            exit(EXIT_FAILURE);
+            pure = ast->data.forexpr.local >= 0
+                && purity_walk(check, AST_CHILD(ast, ast->data.forexpr.begin))
+                && purity_walk(check, AST_CHILD(ast, ast->data.forexpr.end));
+            loopactions = AST_CHILD(ast, ast->data.forexpr.loopactions);
+            preheader = AST_CHILD(ast, ast->data.forexpr.preheader);
         }
-    }
-    else if(ast->type == AST_CALL)
-    {
-        /* Lookup Function in Symbol Table */
-        char* name = ast_eval_as_string(env, ast->data.expr.left);
-        struct var_list* var = var_get(env, name);
         
-        if(var == NULL)
+        if(!pure)
         {
-            SDL_TerminalPrint(env->term, "-!- Undefined function: %s\n", name);
-            return;
+            return false;
         }
         
-        if(!(var->isFunc))
+        bool* before = purity_save(check);
+        if(ast->type == AST_FOR)
         {
-            SDL_TerminalPrint(env->term, "-!- %s: is not a function\n", name);
-            return;
+            check->assigned[ast->data.forexpr.local] = true;
         }
         
-        /* Prepare Environment */
-        struct exec_env env2;
-        env2.screen = env->screen;
-        env2.turt = env->turt;
-        env2.term = env->term;
-        env2.hasReturned = false;
-        env2.shouldExit = false;
-        env2.varlist = NULL;
+        pure = purity_walk(check, preheader) && purity_walk(check, loopactions);
         
-        var_copy_env(env, &env2);
+        memcpy(check->assigned, before, check->size * sizeof(bool));
+        free(before);
+        return pure;
+    }
+    default:
+        /* Turtle Actions, Output, Definitions and Such */
+        return false;
+    }
+}
+
+bool func_is_pure(struct exec_env* env, struct var_list* var)
+{
+    if(var->func.purity == PURITY_UNKNOWN)
+    {
+        var->func.purity = PURITY_CHECKING;
         
-        /* Push Params */
-        struct ast_node* cursor = ast->data.expr.right;
-        int i = 0;
-        while(cursor != NULL && cursor->type == AST_EXPRS)
+        /* Parameters Come First in the Frame and Are Always Set */
+        struct purity_check check;
+        check.env = env;
+        check.var = var;
+        check.size = (var->func.framesize > var->func.argc ? var->func.framesize : var->func.argc) + 1;
+        check.assigned = calloc(check.size, sizeof(bool));
+        if(check.assigned == NULL)
         {
-            if(i >= var->func.argc) break;
-            
-            char* param_name = var->func.argv[i];
-            float param_val = ast_eval_as_float(env, cursor->data.expr.left);
-            var_set(&env2, param_name, param_val);
-            
-            i++;
-            cursor = cursor->data.expr.right;
+            fprintf(stderr, "*** FATAL: calloc failed!\n");
+            exit(EXIT_FAILURE);
         }
         
-        /* Call Function */
-        ast_run(&env2, var->func.body);
-        
-        /* Cleanup */
-        var_clear_all(&env2);
-        if(env2.shouldExit == true)
+        int i;
+        for(i = 0; i < var->func.argc; i++)
         {
-            /* Propagate Exit */
-            env->shouldExit = true;
+            check.assigned[i] = true;
         }
         
-        return env2.returnValue;
-    }
-    else
-    {
-        fprintf(stderr, "*** FATAL: invalid AST node for EVAL_FLOAT context");
-        exit(EXIT_FAILURE);
+        var->func.purity = purity_walk(&check, var->func.body) ? PURITY_PURE : PURITY_IMPURE;
+        free(check.assigned);
     }
+    
+    return var->func.purity == PURITY_PURE;
 }
 
-char* ast_eval_as_string(struct exec_env* env, struct ast_node* ast)
+struct memo_entry* memo_lookup(struct var_list* var, const float* args)
 {
-    if(ast == NULL)
-    {
-        fprintf(stderr, "*** FATAL: AST node for EVAL_STR context is NULL!\n");
-        exit(EXIT_FAILURE);
-    }
+    /*
+     * Return the entry for these arguments. Unless it is set, the entry
+     * has just been claimed for them: the result is stored there when
+     * the call returns, provided its stamp has not changed meanwhile.
+     */
     
-    char* str = malloc_or_die(1024 * sizeof(char));
+    int argc = var->func.argc;
+    struct memo_cache* memo = var->func.memo;
     
-    if(ast->type == AST_STRING)
+    if(memo == NULL)
     {
-        sprintf(str, ast->data.strval);
+        size_t size = sizeof(struct memo_cache) + MEMO_CAPACITY * argc * sizeof(float);
+        memo = malloc_or_die(size);
+        memset(memo, 0, size);
+        var->func.memo = memo;
     }
-    else if(ast->type == AST_BOOLEXPR || ast->type == AST_AND || ast->type == AST_OR || ast->type == AST_NOT)
+    
+    /* FNV-1a on the Arguments' Bytes */
+    unsigned int h = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*) args;
+    size_t i;
+    for(i = 0; i < argc * sizeof(float); i++)
     {
-        bool boolval = ast_eval_boolexpr(env, ast);
-        sprintf(str, boolval == true ? "True" : "False");
+        h = (h ^ bytes[i]) * 16777619u;
     }
-    else if(ast->type == AST_INTEGER)
+    
+    int index = h & (MEMO_CAPACITY - 1);
+    struct memo_entry* entry = &memo->entries[index];
+    float* key = memo->keys + index * argc;
+    
+    if(entry->isSet && memcmp(key, args, argc * sizeof(float)) == 0)
     {
-        sprintf(str, "%d", ast->data.intval);
+        memo->hits ++;
+        return entry;
     }
-    else
+    
+    memo->misses ++;
+    memcpy(key, args, argc * sizeof(float));
+    entry->isSet = false;
+    entry->stamp ++;
+    
+    return entry;
+}
+
+void memo_print_stats(struct exec_env* env)
+{
+    bool any = false;
+    
+    int i;
+    for(i = 0; i < env->varcapacity; i++)
     {
-        float fltval = ast_eval_as_float(env, ast);
-        sprintf(str, "%g", fltval);
+        struct var_list* var = &env->vars[i];
+        if(!(var->isDefined) || !(var->isFunc))
+        {
+            continue;
+        }
+        
+        any = true;
+        if(var->func.purity == PURITY_UNKNOWN)
+        {
+            env_print(env, "%s: never called\n", var->name);
+        }
+        else if(var->func.purity != PURITY_PURE)
+        {
+            env_print(env, "%s: not pure, not memoized\n", var->name);
+        }
+        else
+        {
+            unsigned int hits = var->func.memo != NULL ? var->func.memo->hits : 0;
+            unsigned int calls = var->func.memo != NULL ? hits + var->func.memo->misses : 0;
+            env_print(env, "%s: %u calls, %u hits (%d%%)\n", var->name, calls, hits, calls > 0 ? (int) (100.0 * hits / calls) : 0);
+        }
     }
     
-    return str;
+    if(!any)
+    {
+        env_print(env, "No functions defined\n");
+    }
 }
 
 /*
@@ -1047,84 +1380,11 @@ char* ast_eval_as_string(struct exec_env* env, struct ast_node* ast)
 
 void ast_destroy(struct ast_node* ast)
 {
+    /* Releases the Whole Arena Holding ast */
     if(ast == NULL)
     {
         return;
     }
     
-    switch(ast->type)
-    {
-    case AST_PLUS:
-    case AST_MINUS:
-    case AST_TIMES:
-    case AST_DIV:
-    case AST_MOD:
-    case AST_UNARY_MINUS:
-    case AST_AND:
-    case AST_OR:
-    case AST_NOT:
-    case AST_EXIT:
-    case AST_SHOWHELP:
-    case AST_ECHO:
-    case AST_LOADFILE:
-    case AST_STATEMENTS:
-        ast_destroy(ast->data.expr.left);
-        ast_destroy(ast->data.expr.right);
-        break;
-    case AST_BOOLEXPR:
-        ast_destroy(ast->data.boolexpr.left);
-        ast_destroy(ast->data.boolexpr.right);
-        break;
-    case AST_STRING:
-        free(ast->data.strval);
-        break;
-    case AST_IF:
-        ast_destroy(ast->data.ifexpr.condition);
-        ast_destroy(ast->data.ifexpr.ifactions);
-        ast_destroy(ast->data.ifexpr.elseactions);
-        break;
-    case AST_WHILE:
-        ast_destroy(ast->data.whileexpr.condition);
-        ast_destroy(ast->data.whileexpr.loopactions);
-        break;
-    case AST_FOR:
-        ast_destroy(ast->data.forexpr.begin);
-        ast_destroy(ast->data.forexpr.end);
-        ast_destroy(ast->data.forexpr.loopactions);
-        free(ast->data.forexpr.cursorname);
-        break;
-    case AST_SYMREF:
-        free(ast->data.symrefexpr.name);
-        break;
-    case AST_ASSIGN:
-        ast_destroy(ast->data.assignexpr.val);
-        free(ast->data.assignexpr.name);
-        break;
-    case AST_SPFUNC:
-        ast_destroy(ast->data.spfuncexpr.left);
-        ast_destroy(ast->data.spfuncexpr.right);
-        break;
-    case AST_TURTLE:
-        ast_destroy(ast->data.turtleexpr.param);
-        break;
-    case AST_REPEAT:
-        ast_destroy(ast->data.repeatexpr.loopactions);
-        break;
-    case AST_SET_COLOR:
-        ast_destroy(ast->data.setcolorexpr.r);
-        ast_destroy(ast->data.setcolorexpr.g);
-        ast_destroy(ast->data.setcolorexpr.b);
-        break;
-    /*case AST_FUNC:
-        ast_destroy(ast->data.funcexpr.params);
-        ast_destroy(ast->data.funcexpr.body);
-        break;*/
-    default:
-        break;
-    }
-    
-    if(ast->type != AST_FUNC)
-    {
-        free(ast);
-    }
+    free(ast - ast->index);
 }
@@ -24,6 +24,7 @@
 #ifndef __CONSOLEV2_COMMON_H_
 #define __CONSOLEV2_COMMON_H_
 
+#include <stdint.h>
 #include <SDL/SDL.h>
 #include <SDL/SDL_terminal.h>
 
@@ -31,6 +32,18 @@
  * CUSTOM TYPES
  */
 
+struct vm_chunk;
+
+/*
+ * The nodes of a tree are stored in one array, its arena, and refer to
+ * each other by their position in it. Position 0 is never used, so that
+ * AST_NONE can stand for a missing child.
+ */
+
+typedef uint32_t ast_index;
+
+#define AST_NONE 0
+
 typedef enum {
     AST_PLUS,
     AST_MINUS,
@@ -54,6 +67,7 @@ typedef enum {
     AST_TURTLE,
     AST_EXIT,
     AST_SHOWHELP,
+    AST_STATS,
     AST_ECHO,
     AST_LOADFILE,
     AST_STATEMENTS,
@@ -103,6 +117,7 @@ typedef enum {
     TURT_WRITE,
     TURT_CENTERED_CIRCLE,
     TURT_CIRCLE,
+    TURT_ARC,
     TURT_HOME,
     TURT_CLEAR,
     TURT_RESET
@@ -110,41 +125,50 @@ typedef enum {
 
 struct ast_node {
     ast_type type;
+    ast_index index;                /* position in the arena */
     union {
         struct {
-            struct ast_node* left;
-            struct ast_node* right;
+            ast_index left;
+            ast_index right;
         } expr;
         struct {
-            struct ast_node* left;
-            struct ast_node* right;
+            ast_index left;
+            ast_index right;
             boolop_type op;
         } boolexpr;
         struct {
-            struct ast_node* condition;
-            struct ast_node* ifactions;
-            struct ast_node* elseactions;
+            ast_index condition;
+            ast_index ifactions;
+            ast_index elseactions;
         } ifexpr;
         struct {
-            struct ast_node* condition;
-            struct ast_node* loopactions;
+            ast_index condition;
+            ast_index loopactions;
+            ast_index preheader;    /* see opt_hoist */
         } whileexpr;
         struct {
             char* cursorname;
-            struct ast_node* begin;
-            struct ast_node* end;
-            struct ast_node* loopactions;
+            int slot;
+            int local;
+            ast_index begin;
+            ast_index end;
+            ast_index loopactions;
+            ast_index preheader;
         } forexpr;
         struct {
             char* name;
+            int slot;
+            int local;
         } symrefexpr;
         struct {
             char* name;
-            struct ast_node* val;
+            int slot;
+            int local;
+            ast_index val;
         } assignexpr;
         struct {
-            struct ast_node* left;
-            struct ast_node* right;
+            ast_index left;
+            ast_index right;
             spfunc_type type;
         } spfuncexpr;
         int intval;
@@ -152,45 +176,95 @@ struct ast_node {
         char* strval;
         struct {
             turt_action_type type;
-            struct ast_node* param;
+            ast_index param;
         } turtleexpr;
         struct {
-            struct ast_node* count;
-            struct ast_node* loopactions;
+            ast_index count;
+            ast_index loopactions;
+            ast_index preheader;
         } repeatexpr;
         struct {
             char* name;
-            struct ast_node* params;
-            struct ast_node* body;
+            ast_index params;
+            ast_index body;
+            int framesize;
         } funcexpr;
         struct {
-            struct ast_node* r;
-            struct ast_node* g;
-            struct ast_node* b;
+            ast_index r;
+            ast_index g;
+            ast_index b;
         } setcolorexpr;
     } data;
 };
 
+/*
+ * Functions without side effects, that only read their parameters and
+ * locals they have set, have their results remembered by argument
+ * values. Each cache is direct-mapped: newer results evict older ones.
+ */
+
+#define MEMO_CAPACITY 256           /* per function, a power of two */
+
+typedef enum {
+    PURITY_UNKNOWN,
+    PURITY_CHECKING,
+    PURITY_PURE,
+    PURITY_IMPURE
+} purity_type;
+
+struct memo_entry {
+    unsigned int stamp;             /* changes whenever the entry is claimed */
+    bool isSet;
+    float result;
+};
+
+struct memo_cache {
+    unsigned int hits;
+    unsigned int misses;
+    struct memo_entry entries[MEMO_CAPACITY];
+    float keys[];                   /* argc arguments per entry */
+};
+
 struct var_list {
-    char* name;
+    char* name;                     /* interned, see var_intern */
     float val;
-    struct var_list* next;
+    bool isDefined;
     bool isFunc;
     struct {
         int argc;
         char** argv;
         struct ast_node* body;
+        int framesize;
+        struct vm_chunk* code;      /* compiled on first call */
+        purity_type purity;         /* found on first call, see func_is_pure */
+        struct memo_cache* memo;    /* results of pure calls */
     } func;
 };
 
+struct frame_slot {
+    float val;
+    bool isSet;
+};
+
+struct ast_arena {
+    struct ast_node* nodes;
+    ast_index count;
+    ast_index capacity;
+};
+
 struct exec_env {
     SDL_Terminal* term;
     SDL_Surface* screen;
     struct Turtle* turt;
-    struct var_list* varlist;
+    struct var_list* vars;          /* indexed by slot, see var_slot */
+    int varcapacity;
+    struct frame_slot* stack;       /* call frames, see frame_push */
+    int stacksize;
+    int stackcapacity;
+    int frame;                      /* base of current frame, -1 at top level */
     bool shouldExit;
-    bool hasReturned;
-    float returnValue;
+    struct worker* worker;          /* thread running programs, or NULL */
+    int errors;                     /* messages printed with env_error */
 };
 
 /*
@@ -199,67 +273,121 @@ struct exec_env {
 
 void* malloc_or_die(size_t size);
 
+/* Print to the Terminal, Through the Worker's Queue if Any, or stdout in Batch Mode */
+void env_print(struct exec_env* env, const char* format, ...);
+
+/* Same for Errors, Counted in env->errors, stderr in Batch Mode */
+void env_error(struct exec_env* env, const char* format, ...);
+
 /*
  * LOOKUP TABLE API
  */
 
+/* Call Once at Startup, Before Any Parse */
+void var_init();
+
+char* var_intern(const char* name);
+
+/* Same for String Literals, Which Get No Slot */
+char* var_intern_string(const char* str);
+
+char* var_intern_lookup(const char* name);
+
+int var_slot(const char* name);
+
+int var_slot_lookup(const char* name);
+
+/* Slot of a Name Returned by var_intern, Without Hashing */
+int var_interned_slot(const char* name);
+
+struct var_list* var_get_slot(struct exec_env* env, int slot);
+
+struct var_list* var_set_slot(struct exec_env* env, int slot, char* name, float val);
+
 struct var_list* var_get(struct exec_env* env, char* name);
 
 struct var_list* var_set(struct exec_env* env, char* name, float val);
 
-struct var_list* func_set(struct exec_env* env, char* name, int arg_count, char** arg_vector, struct ast_node* body);
-
-void var_copy_env(struct exec_env* src, struct exec_env* dest);
+struct var_list* func_set(struct exec_env* env, char* name, int arg_count, char** arg_vector, struct ast_node* body, int frame_size);
 
 void var_clear_all(struct exec_env* env);
 
+/* Node of the Same Arena, NULL for AST_NONE */
+#define AST_CHILD(ast, child) ((child) == AST_NONE ? NULL : (ast) - (ast)->index + (child))
+
+/*
+ * AST ARENA API
+ */
+
+ast_index ast_alloc(ast_type type);
+
+struct ast_node* ast_at(ast_index index);
+
+struct ast_node* ast_arena_take(ast_index root);
+
+struct ast_node* ast_clone(struct ast_node* ast);
+
 /*
  * AST GENERATION API
  */
 
-struct ast_node* ast_make(ast_type type, struct ast_node* left, struct ast_node* right);
+/* Names and Strings Must Have Been Interned, See var_intern and var_intern_string */
+
+ast_index ast_make(ast_type type, ast_index left, ast_index right);
+
+ast_index ast_make_boolexpr(boolop_type op, ast_index left, ast_index right);
+
+ast_index ast_make_if(ast_index condition, ast_index ifactions, ast_index elseactions);
 
-struct ast_node* ast_make_boolexpr(boolop_type op, struct ast_node* left, struct ast_node* right);
+ast_index ast_make_while(ast_index condition, ast_index loopactions);
 
-struct ast_node* ast_make_if(struct ast_node* condition, struct ast_node* ifactions, struct ast_node* elseactions);
+ast_index ast_make_for(char* cursorname, ast_index begin, ast_index end, ast_index loopactions);
 
-struct ast_node* ast_make_while(struct ast_node* condition, struct ast_node* loopactions);
+ast_index ast_make_repeat(ast_index count, ast_index loopactions);
 
-struct ast_node* ast_make_for(char* cursorname, struct ast_node* begin, struct ast_node* end, struct ast_node* loopactions);
+ast_index ast_make_function(char* name, ast_index params, ast_index body);
 
-struct ast_node* ast_make_repeat(struct ast_node* count, struct ast_node* loopactions);
+ast_index ast_make_symref(char* name);
 
-struct ast_node* ast_make_function(char* name, struct ast_node* params, struct ast_node* body);
+ast_index ast_make_assign(char* name, ast_index val);
 
-struct ast_node* ast_make_symref(char* name);
+ast_index ast_make_spfunc(spfunc_type type, ast_index left, ast_index right);
 
-struct ast_node* ast_make_assign(char* name, struct ast_node* val);
+ast_index ast_make_turtle(turt_action_type type, ast_index param);
 
-struct ast_node* ast_make_spfunc(spfunc_type type, struct ast_node* left, struct ast_node* right);
+ast_index ast_make_integer(int intval);
 
-struct ast_node* ast_make_turtle(turt_action_type type, struct ast_node* param);
+ast_index ast_make_float(float fltval);
 
-struct ast_node* ast_make_integer(int intval);
+ast_index ast_make_string(char* strval);
 
-struct ast_node* ast_make_float(float fltval);
+ast_index ast_make_setcolor(ast_index r, ast_index g, ast_index b);
 
-struct ast_node* ast_make_string(char* strval);
+/*
+ * AST RESOLUTION API
+ */
 
-struct ast_node* ast_make_setcolor(struct ast_node* r, struct ast_node* g, struct ast_node* b);
+void ast_resolve(struct ast_node* ast);
 
 /*
  * AST EXECUTION API
  */
 
-void ast_run(struct exec_env* env, struct ast_node* ast);
+void print_help(struct exec_env* env);
+
+void func_define(struct exec_env* env, struct ast_node* ast);
 
-bool ast_eval_boolexpr(struct exec_env* env, struct ast_node* ast);
+int frame_push(struct exec_env* env, int size);
+
+/*
+ * MEMOIZATION API
+ */
 
-int ast_eval_as_int(struct exec_env* env, struct ast_node* ast);
+bool func_is_pure(struct exec_env* env, struct var_list* var);
 
-float ast_eval_as_float(struct exec_env* env, struct ast_node* ast);
+struct memo_entry* memo_lookup(struct var_list* var, const float* args);
 
-char* ast_eval_as_string(struct exec_env* env, struct ast_node* ast);
+void memo_print_stats(struct exec_env* env);
 
 /*
  * AST CLEANUP API
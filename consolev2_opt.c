@@ -0,0 +1,1021 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * MTurtle Console
+ * AST optimizer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include "MTurtle.h"
+#include "consolev2_common.h"
+#include "consolev2_opt.h"
+
+#define PI 3.14159265
+#define RAD2DEG PI / 180.0
+
+extern int ast_children(struct ast_node* ast, ast_index** children);
+
+bool ast_dump_trees = false;
+
+/*
+ * NAME SETS
+ */
+
+struct opt_names {
+    char** names;                   /* interned */
+    int count;
+    int capacity;
+};
+
+bool names_contain(struct opt_names* set, char* name)
+{
+    int i;
+    for(i = 0; i < set->count; i++)
+    {
+        if(set->names[i] == name)
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void names_add(struct opt_names* set, char* name)
+{
+    if(names_contain(set, name))
+    {
+        return;
+    }
+    
+    if(set->count >= set->capacity)
+    {
+        set->capacity = set->capacity > 0 ? 2 * set->capacity : 8;
+        set->names = realloc(set->names, set->capacity * sizeof(char*));
+        if(set->names == NULL)
+        {
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    set->names[set->count ++] = name;
+}
+
+/*
+ * CONSTANT FOLDING
+ */
+
+bool opt_is_const(struct ast_node* ast)
+{
+    return ast != NULL && (ast->type == AST_INTEGER || ast->type == AST_FLOAT);
+}
+
+float opt_const_value(struct ast_node* ast)
+{
+    return ast->type == AST_INTEGER ? (float) ast->data.intval : ast->data.fltval;
+}
+
+bool opt_is_nonzero_const(struct ast_node* ast)
+{
+    return opt_is_const(ast) && opt_const_value(ast) != 0.0f;
+}
+
+void opt_replace(struct ast_node* ast, float val)
+{
+    /*
+     * The node becomes the constant, its operands are left unused in
+     * the arena. Folded values are always floats: an AST_INTEGER would
+     * be printed with %d rather than %g, unlike the expression it
+     * replaces.
+     */
+    
+    ast->type = AST_FLOAT;
+    ast->data.fltval = val;
+}
+
+void opt_expr(struct ast_node* ast)
+{
+    if(ast == NULL)
+    {
+        return;
+    }
+    
+    switch(ast->type)
+    {
+    case AST_PLUS:
+    case AST_MINUS:
+    case AST_TIMES:
+    case AST_DIV:
+    case AST_MOD:
+    {
+        struct ast_node* leftnode = AST_CHILD(ast, ast->data.expr.left);
+        struct ast_node* rightnode = AST_CHILD(ast, ast->data.expr.right);
+        
+        opt_expr(leftnode);
+        opt_expr(rightnode);
+        
+        if(!opt_is_const(leftnode) || !opt_is_const(rightnode))
+        {
+            return;
+        }
+        
+        /* Same Arithmetic as the Interpreters */
+        float left = opt_const_value(leftnode);
+        float right = opt_const_value(rightnode);
+        
+        if(ast->type == AST_PLUS)
+        {
+            opt_replace(ast, left + right);
+        }
+        else if(ast->type == AST_MINUS)
+        {
+            opt_replace(ast, left - right);
+        }
+        else if(ast->type == AST_TIMES)
+        {
+            opt_replace(ast, left * right);
+        }
+        else if(right != 0.0f)
+        {
+            /* Division by Zero Keeps its Runtime Warning */
+            opt_replace(ast, ast->type == AST_DIV ? left / right : (float) fmod(left, right));
+        }
+        break;
+    }
+    case AST_UNARY_MINUS:
+    {
+        struct ast_node* operand = AST_CHILD(ast, ast->data.expr.left);
+        
+        opt_expr(operand);
+        if(opt_is_const(operand))
+        {
+            opt_replace(ast, 0.0f - opt_const_value(operand));
+        }
+        break;
+    }
+    case AST_SPFUNC:
+    {
+        struct ast_node* left = AST_CHILD(ast, ast->data.spfuncexpr.left);
+        struct ast_node* right = AST_CHILD(ast, ast->data.spfuncexpr.right);
+        
+        opt_expr(left);
+        opt_expr(right);
+        
+        if(!opt_is_const(left) || (right != NULL && !opt_is_const(right)))
+        {
+            return;
+        }
+        
+        float x = opt_const_value(left);
+        float y = right != NULL ? opt_const_value(right) : 0.0f;
+        
+        switch(ast->data.spfuncexpr.type)
+        {
+        case SPFUNC_COS:
+            opt_replace(ast, (float) cos(x * RAD2DEG));
+            break;
+        case SPFUNC_SIN:
+            opt_replace(ast, (float) sin(x * RAD2DEG));
+            break;
+        case SPFUNC_TAN:
+            opt_replace(ast, (float) tan(x * RAD2DEG));
+            break;
+        case SPFUNC_ABS:
+            opt_replace(ast, (float) fabs(x));
+            break;
+        case SPFUNC_SQRT:
+            opt_replace(ast, (float) sqrt(x));
+            break;
+        case SPFUNC_LOG:
+            opt_replace(ast, (float) log(x));
+            break;
+        case SPFUNC_LOG10:
+            opt_replace(ast, (float) log10(x));
+            break;
+        case SPFUNC_EXP:
+            opt_replace(ast, (float) exp(x));
+            break;
+        case SPFUNC_RMDR:
+            if(y != 0.0f)
+            {
+                float r = (float) fmod(x, y);
+                opt_replace(ast, r < 0 ? r + y : r);
+            }
+            break;
+        case SPFUNC_MAX:
+            opt_replace(ast, x > y ? x : y);
+            break;
+        case SPFUNC_MIN:
+            opt_replace(ast, x < y ? x : y);
+            break;
+        case SPFUNC_CEIL:
+            opt_replace(ast, (float) ceil(x));
+            break;
+        case SPFUNC_FLOOR:
+            opt_replace(ast, (float) floor(x));
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+    case AST_BOOLEXPR:
+        opt_expr(AST_CHILD(ast, ast->data.boolexpr.left));
+        opt_expr(AST_CHILD(ast, ast->data.boolexpr.right));
+        break;
+    case AST_NOT:
+    case AST_AND:
+    case AST_OR:
+        opt_expr(AST_CHILD(ast, ast->data.expr.left));
+        opt_expr(AST_CHILD(ast, ast->data.expr.right));
+        break;
+    case AST_CALL:
+    {
+        struct ast_node* cursor = AST_CHILD(ast, ast->data.expr.right);
+        while(cursor != NULL && cursor->type == AST_EXPRS)
+        {
+            opt_expr(AST_CHILD(cursor, cursor->data.expr.left));
+            cursor = AST_CHILD(cursor, cursor->data.expr.right);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+int opt_bool_value(struct ast_node* ast)
+{
+    /*
+     * Returns 1 or 0 for a condition known at parse time, -1 otherwise.
+     * Operands that may have side effects are never skipped.
+     */
+    
+    if(ast->type == AST_BOOLEXPR)
+    {
+        if(!opt_is_const(AST_CHILD(ast, ast->data.boolexpr.left)) || !opt_is_const(AST_CHILD(ast, ast->data.boolexpr.right)))
+        {
+            return -1;
+        }
+        
+        float left = opt_const_value(AST_CHILD(ast, ast->data.boolexpr.left));
+        float right = opt_const_value(AST_CHILD(ast, ast->data.boolexpr.right));
+        
+        switch(ast->data.boolexpr.op)
+        {
+        case OP_EQ:
+            return left == right;
+        case OP_NEQ:
+            return left != right;
+        case OP_LESS:
+            return left < right;
+        case OP_GREATER:
+            return left > right;
+        case OP_LEQ:
+            return left <= right;
+        case OP_GEQ:
+            return left >= right;
+        default:
+            return -1;
+        }
+    }
+    else if(ast->type == AST_NOT)
+    {
+        int val = opt_bool_value(AST_CHILD(ast, ast->data.expr.left));
+        return val < 0 ? -1 : !val;
+    }
+    else if(ast->type == AST_AND || ast->type == AST_OR)
+    {
+        int shortcut = ast->type == AST_AND ? 0 : 1;
+        int left = opt_bool_value(AST_CHILD(ast, ast->data.expr.left));
+        
+        if(left == shortcut)
+        {
+            return shortcut;
+        }
+        return left < 0 ? -1 : opt_bool_value(AST_CHILD(ast, ast->data.expr.right));
+    }
+    
+    return -1;
+}
+
+/*
+ * LOOP-INVARIANT HOISTING
+ */
+
+struct opt_context {
+    struct opt_names* locals;       /* set locals, NULL at top level */
+    int depth;                      /* loops around the current statement */
+};
+
+struct opt_loop {
+    struct opt_context* ctx;
+    struct opt_names assigned;      /* variables the loop may change */
+    bool hasCall;                   /* calls or loads in the loop */
+    bool mayLeave;                  /* the rest of the iteration may not run */
+    ast_index preheader;            /* hoisted assignments */
+    int temps;                      /* hoisted so far */
+};
+
+void opt_collect_assigned(struct ast_node* ast, struct opt_names* assigned, bool* hasCall)
+{
+    if(ast == NULL)
+    {
+        return;
+    }
+    
+    switch(ast->type)
+    {
+    case AST_ASSIGN:
+        names_add(assigned, ast->data.assignexpr.name);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.assignexpr.val), assigned, hasCall);
+        break;
+    case AST_FOR:
+        names_add(assigned, ast->data.forexpr.cursorname);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.forexpr.begin), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.forexpr.end), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.forexpr.preheader), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.forexpr.loopactions), assigned, hasCall);
+        break;
+    case AST_IF:
+        opt_collect_assigned(AST_CHILD(ast, ast->data.ifexpr.condition), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.ifexpr.ifactions), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.ifexpr.elseactions), assigned, hasCall);
+        break;
+    case AST_WHILE:
+        opt_collect_assigned(AST_CHILD(ast, ast->data.whileexpr.condition), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.whileexpr.preheader), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.whileexpr.loopactions), assigned, hasCall);
+        break;
+    case AST_REPEAT:
+        opt_collect_assigned(AST_CHILD(ast, ast->data.repeatexpr.count), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.repeatexpr.preheader), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.repeatexpr.loopactions), assigned, hasCall);
+        break;
+    case AST_BOOLEXPR:
+        opt_collect_assigned(AST_CHILD(ast, ast->data.boolexpr.left), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.boolexpr.right), assigned, hasCall);
+        break;
+    case AST_SPFUNC:
+        opt_collect_assigned(AST_CHILD(ast, ast->data.spfuncexpr.left), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.spfuncexpr.right), assigned, hasCall);
+        break;
+    case AST_TURTLE:
+        opt_collect_assigned(AST_CHILD(ast, ast->data.turtleexpr.param), assigned, hasCall);
+        break;
+    case AST_SET_COLOR:
+        opt_collect_assigned(AST_CHILD(ast, ast->data.setcolorexpr.r), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.setcolorexpr.g), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.setcolorexpr.b), assigned, hasCall);
+        break;
+    case AST_CALL:
+    case AST_LOADFILE:
+        *hasCall = true;
+        opt_collect_assigned(AST_CHILD(ast, ast->data.expr.right), assigned, hasCall);
+        break;
+    case AST_FUNC:
+        names_add(assigned, ast->data.funcexpr.name);
+        break;
+    case AST_SYMREF:
+    case AST_STRING:
+    case AST_INTEGER:
+    case AST_FLOAT:
+        break;
+    default:
+        opt_collect_assigned(AST_CHILD(ast, ast->data.expr.left), assigned, hasCall);
+        opt_collect_assigned(AST_CHILD(ast, ast->data.expr.right), assigned, hasCall);
+        break;
+    }
+}
+
+bool opt_is_invariant(struct opt_loop* loop, struct ast_node* ast)
+{
+    /*
+     * Functions only ever assign their own locals, but a script loaded
+     * from a function body may assign globals: globals are only
+     * invariant in loops without calls.
+     */
+    
+    switch(ast->type)
+    {
+    case AST_INTEGER:
+    case AST_FLOAT:
+        return true;
+    case AST_SYMREF:
+    {
+        char* name = ast->data.symrefexpr.name;
+        if(names_contain(&loop->assigned, name))
+        {
+            return false;
+        }
+        
+        return !loop->hasCall || (loop->ctx->locals != NULL && names_contain(loop->ctx->locals, name));
+    }
+    case AST_PLUS:
+    case AST_MINUS:
+    case AST_TIMES:
+        return opt_is_invariant(loop, AST_CHILD(ast, ast->data.expr.left)) && opt_is_invariant(loop, AST_CHILD(ast, ast->data.expr.right));
+    case AST_DIV:
+    case AST_MOD:
+        /* Division by Zero Warns Every Time */
+        return opt_is_nonzero_const(AST_CHILD(ast, ast->data.expr.right)) && opt_is_invariant(loop, AST_CHILD(ast, ast->data.expr.left));
+    case AST_UNARY_MINUS:
+        return opt_is_invariant(loop, AST_CHILD(ast, ast->data.expr.left));
+    case AST_SPFUNC:
+        if(ast->data.spfuncexpr.type == SPFUNC_RMDR && !opt_is_nonzero_const(AST_CHILD(ast, ast->data.spfuncexpr.right)))
+        {
+            return false;
+        }
+        return opt_is_invariant(loop, AST_CHILD(ast, ast->data.spfuncexpr.left)) &&
+               (ast->data.spfuncexpr.right == AST_NONE || opt_is_invariant(loop, AST_CHILD(ast, ast->data.spfuncexpr.right)));
+    default:
+        return false;
+    }
+}
+
+ast_index opt_detach(ast_index index)
+{
+    /* Move a Node Elsewhere in the Arena, Its Old Position Is Reused */
+    ast_index moved = ast_alloc(ast_at(index)->type);
+    
+    *ast_at(moved) = *ast_at(index);
+    ast_at(moved)->index = moved;
+    
+    return moved;
+}
+
+void opt_hoist_expr(struct opt_loop* loop, ast_index index)
+{
+    struct ast_node* ast = ast_at(index);
+    if(ast == NULL || loop->mayLeave)
+    {
+        return;
+    }
+    
+    switch(ast->type)
+    {
+    case AST_PLUS:
+    case AST_MINUS:
+    case AST_TIMES:
+    case AST_DIV:
+    case AST_MOD:
+    case AST_UNARY_MINUS:
+    case AST_SPFUNC:
+        if(opt_is_invariant(loop, ast))
+        {
+            /*
+             * Evaluate once, before the loop. Temporaries are named after
+             * the loop depth: sibling loops reuse them, nested ones don't.
+             * Loops reaching other code through calls or loads hoist no
+             * globals, so nothing else can overwrite them meanwhile.
+             */
+            char str[32];
+            snprintf(str, sizeof(str), "$%d_%d", loop->ctx->depth, loop->temps ++);
+            char* name = var_intern(str);
+            
+            ast_index assign = ast_make_assign(name, opt_detach(index));
+            loop->preheader = loop->preheader == AST_NONE ? assign : ast_make(AST_STATEMENTS, loop->preheader, assign);
+            
+            ast = ast_at(index);
+            ast->type = AST_SYMREF;
+            ast->data.symrefexpr.name = name;
+            ast->data.symrefexpr.slot = -1;
+            ast->data.symrefexpr.local = -1;
+            
+            if(loop->ctx->locals != NULL)
+            {
+                names_add(loop->ctx->locals, name);
+            }
+            return;
+        }
+        
+        if(ast->type == AST_SPFUNC)
+        {
+            opt_hoist_expr(loop, ast->data.spfuncexpr.left);
+            opt_hoist_expr(loop, ast_at(index)->data.spfuncexpr.right);
+        }
+        else
+        {
+            opt_hoist_expr(loop, ast->data.expr.left);
+            opt_hoist_expr(loop, ast_at(index)->data.expr.right);
+        }
+        break;
+    case AST_BOOLEXPR:
+        opt_hoist_expr(loop, ast->data.boolexpr.left);
+        opt_hoist_expr(loop, ast_at(index)->data.boolexpr.right);
+        break;
+    case AST_NOT:
+    case AST_AND:
+    case AST_OR:
+        /* The Right Operand May Be Short-Circuited */
+        opt_hoist_expr(loop, ast->data.expr.left);
+        break;
+    case AST_CALL:
+    {
+        ast_index cursor = ast->data.expr.right;
+        while(cursor != AST_NONE && ast_at(cursor)->type == AST_EXPRS)
+        {
+            opt_hoist_expr(loop, ast_at(cursor)->data.expr.left);
+            cursor = ast_at(cursor)->data.expr.right;
+        }
+        loop->mayLeave = true;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool opt_may_leave(struct ast_node* ast)
+{
+    /* Whether the Statements After This One Might Not Run */
+    if(ast == NULL)
+    {
+        return false;
+    }
+    
+    switch(ast->type)
+    {
+    case AST_EXIT:
+    case AST_RETURN:
+    case AST_CALL:
+    case AST_LOADFILE:
+    case AST_WHILE:
+        return true;
+    case AST_FUNC:
+        return false;
+    default:
+    {
+        ast_index* children[4];
+        int count = ast_children(ast, children);
+        
+        for(int i = 0; i < count; i ++)
+        {
+            if(opt_may_leave(AST_CHILD(ast, *children[i])))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    }
+}
+
+void opt_hoist_statement(struct opt_loop* loop, ast_index index)
+{
+    /*
+     * Only what every iteration evaluates is hoisted: conditions but
+     * not the arms of ifs, the headers but not the bodies of nested
+     * loops, and nothing after a statement that may leave the loop
+     * or never finish. Hoisting allocates nodes, which may move the
+     * arena: nodes are looked up again by index after each call.
+     */
+    
+    struct ast_node* ast = ast_at(index);
+    if(ast == NULL || loop->mayLeave)
+    {
+        return;
+    }
+    
+    switch(ast->type)
+    {
+    case AST_STATEMENTS:
+        opt_hoist_statement(loop, ast->data.expr.left);
+        opt_hoist_statement(loop, ast_at(index)->data.expr.right);
+        return;
+    case AST_IF:
+        opt_hoist_expr(loop, ast->data.ifexpr.condition);
+        break;
+    case AST_WHILE:
+        opt_hoist_expr(loop, ast->data.whileexpr.condition);
+        break;
+    case AST_FOR:
+        opt_hoist_expr(loop, ast->data.forexpr.begin);
+        opt_hoist_expr(loop, ast_at(index)->data.forexpr.end);
+        break;
+    case AST_REPEAT:
+        opt_hoist_expr(loop, ast->data.repeatexpr.count);
+        break;
+    case AST_ASSIGN:
+        opt_hoist_expr(loop, ast->data.assignexpr.val);
+        break;
+    case AST_TURTLE:
+        if(ast->data.turtleexpr.type == TURT_ARC)
+        {
+            ast_index params = ast->data.turtleexpr.param;
+            opt_hoist_expr(loop, ast_at(params)->data.expr.left);
+            opt_hoist_expr(loop, ast_at(ast_at(params)->data.expr.right)->data.expr.left);
+        }
+        else
+        {
+            opt_hoist_expr(loop, ast->data.turtleexpr.param);
+        }
+        break;
+    case AST_SET_COLOR:
+        opt_hoist_expr(loop, ast->data.setcolorexpr.r);
+        opt_hoist_expr(loop, ast_at(index)->data.setcolorexpr.g);
+        opt_hoist_expr(loop, ast_at(index)->data.setcolorexpr.b);
+        break;
+    case AST_ECHO:
+    case AST_RETURN:
+        opt_hoist_expr(loop, ast->data.expr.left);
+        break;
+    case AST_CALL:
+        opt_hoist_expr(loop, index);
+        break;
+    default:
+        break;
+    }
+    
+    if(opt_may_leave(ast_at(index)))
+    {
+        loop->mayLeave = true;
+    }
+}
+
+ast_index opt_hoist(struct opt_context* ctx, ast_index index)
+{
+    struct opt_loop loop;
+    loop.ctx = ctx;
+    loop.assigned.names = NULL;
+    loop.assigned.count = 0;
+    loop.assigned.capacity = 0;
+    loop.hasCall = false;
+    loop.mayLeave = false;
+    loop.preheader = AST_NONE;
+    loop.temps = 0;
+    
+    struct ast_node* ast = ast_at(index);
+    opt_collect_assigned(ast, &loop.assigned, &loop.hasCall);
+    
+    /*
+     * A while condition is evaluated at least once, what it hoists can
+     * run before the loop. Whatever the body hoists goes to the loop's
+     * preheader, which the compiler only runs once the loop is entered.
+     */
+    ast_index entry = AST_NONE;
+    if(ast->type == AST_WHILE)
+    {
+        opt_hoist_expr(&loop, ast->data.whileexpr.condition);
+        entry = loop.preheader;
+        loop.preheader = AST_NONE;
+        opt_hoist_statement(&loop, ast_at(index)->data.whileexpr.loopactions);
+        ast_at(index)->data.whileexpr.preheader = loop.preheader;
+    }
+    else if(ast->type == AST_FOR)
+    {
+        opt_hoist_statement(&loop, ast->data.forexpr.loopactions);
+        ast_at(index)->data.forexpr.preheader = loop.preheader;
+    }
+    else
+    {
+        opt_hoist_statement(&loop, ast->data.repeatexpr.loopactions);
+        ast_at(index)->data.repeatexpr.preheader = loop.preheader;
+    }
+    
+    free(loop.assigned.names);
+    
+    if(entry == AST_NONE)
+    {
+        return index;
+    }
+    return ast_make(AST_STATEMENTS, entry, index);
+}
+
+/*
+ * STATEMENTS
+ */
+
+ast_index opt_statement(struct opt_context* ctx, ast_index index);
+
+void opt_printable(struct ast_node* ast)
+{
+    if(ast->type != AST_STRING)
+    {
+        opt_expr(ast);
+    }
+}
+
+void opt_function(ast_index index)
+{
+    /*
+     * Parameters are always set, unlike other locals which read the
+     * global of the same name until they are first assigned.
+     */
+    struct opt_names locals = {NULL, 0, 0};
+    struct ast_node* ast = ast_at(index);
+    struct ast_node* cursor = AST_CHILD(ast, ast->data.funcexpr.params);
+    
+    while(cursor != NULL && cursor->type == AST_PARAM)
+    {
+        names_add(&locals, AST_CHILD(cursor, cursor->data.expr.left)->data.strval);
+        cursor = AST_CHILD(cursor, cursor->data.expr.right);
+    }
+    
+    struct opt_context ctx;
+    ctx.locals = &locals;
+    ctx.depth = 0;
+    
+    ast_index body = opt_statement(&ctx, ast->data.funcexpr.body);
+    ast_at(index)->data.funcexpr.body = body;
+    
+    free(locals.names);
+}
+
+ast_index opt_statement(struct opt_context* ctx, ast_index index)
+{
+    struct ast_node* ast = ast_at(index);
+    if(ast == NULL)
+    {
+        return AST_NONE;
+    }
+    
+    switch(ast->type)
+    {
+    case AST_STATEMENTS:
+    {
+        ast_index left = opt_statement(ctx, ast->data.expr.left);
+        ast_index right = opt_statement(ctx, ast_at(index)->data.expr.right);
+        
+        if(left == AST_NONE || right == AST_NONE)
+        {
+            return left == AST_NONE ? right : left;
+        }
+        
+        ast = ast_at(index);
+        ast->data.expr.left = left;
+        ast->data.expr.right = right;
+        return index;
+    }
+    case AST_IF:
+    {
+        opt_expr(AST_CHILD(ast, ast->data.ifexpr.condition));
+        int val = opt_bool_value(AST_CHILD(ast, ast->data.ifexpr.condition));
+        
+        if(val >= 0)
+        {
+            /* Drop the Unreachable Arm */
+            return opt_statement(ctx, val ? ast->data.ifexpr.ifactions : ast->data.ifexpr.elseactions);
+        }
+        
+        ast_index ifactions = opt_statement(ctx, ast->data.ifexpr.ifactions);
+        ast_index elseactions = opt_statement(ctx, ast_at(index)->data.ifexpr.elseactions);
+        
+        ast = ast_at(index);
+        ast->data.ifexpr.ifactions = ifactions;
+        ast->data.ifexpr.elseactions = elseactions;
+        return index;
+    }
+    case AST_WHILE:
+    {
+        opt_expr(AST_CHILD(ast, ast->data.whileexpr.condition));
+        if(opt_bool_value(AST_CHILD(ast, ast->data.whileexpr.condition)) == 0)
+        {
+            return AST_NONE;
+        }
+        
+        ctx->depth ++;
+        ast_index loopactions = opt_statement(ctx, ast->data.whileexpr.loopactions);
+        ctx->depth --;
+        ast_at(index)->data.whileexpr.loopactions = loopactions;
+        return opt_hoist(ctx, index);
+    }
+    case AST_FOR:
+    {
+        opt_expr(AST_CHILD(ast, ast->data.forexpr.begin));
+        opt_expr(AST_CHILD(ast, ast->data.forexpr.end));
+        
+        ctx->depth ++;
+        ast_index loopactions = opt_statement(ctx, ast->data.forexpr.loopactions);
+        ctx->depth --;
+        ast_at(index)->data.forexpr.loopactions = loopactions;
+        return opt_hoist(ctx, index);
+    }
+    case AST_REPEAT:
+    {
+        struct ast_node* count = AST_CHILD(ast, ast->data.repeatexpr.count);
+        
+        opt_expr(count);
+        if(opt_is_const(count) && (int) opt_const_value(count) < 1)
+        {
+            return AST_NONE;
+        }
+        
+        ctx->depth ++;
+        ast_index loopactions = opt_statement(ctx, ast->data.repeatexpr.loopactions);
+        ctx->depth --;
+        ast_at(index)->data.repeatexpr.loopactions = loopactions;
+        return opt_hoist(ctx, index);
+    }
+    case AST_ASSIGN:
+        opt_expr(AST_CHILD(ast, ast->data.assignexpr.val));
+        return index;
+    case AST_TURTLE:
+        if(ast->data.turtleexpr.type == TURT_ARC)
+        {
+            struct ast_node* params = AST_CHILD(ast, ast->data.turtleexpr.param);
+            struct ast_node* next = AST_CHILD(params, params->data.expr.right);
+            opt_expr(AST_CHILD(params, params->data.expr.left));
+            opt_expr(AST_CHILD(next, next->data.expr.left));
+        }
+        else if(ast->data.turtleexpr.param != AST_NONE)
+        {
+            opt_printable(AST_CHILD(ast, ast->data.turtleexpr.param));
+        }
+        return index;
+    case AST_SET_COLOR:
+        opt_expr(AST_CHILD(ast, ast->data.setcolorexpr.r));
+        opt_expr(AST_CHILD(ast, ast->data.setcolorexpr.g));
+        opt_expr(AST_CHILD(ast, ast->data.setcolorexpr.b));
+        return index;
+    case AST_ECHO:
+        opt_printable(AST_CHILD(ast, ast->data.expr.left));
+        return index;
+    case AST_RETURN:
+        opt_expr(AST_CHILD(ast, ast->data.expr.left));
+        return index;
+    case AST_CALL:
+        opt_expr(ast);
+        return index;
+    case AST_FUNC:
+        opt_function(index);
+        return index;
+    default:
+        return index;
+    }
+}
+
+/*
+ * AST OPTIMIZATION API
+ */
+
+ast_index ast_optimize(ast_index root)
+{
+    if(ast_dump_trees)
+    {
+        fprintf(stderr, "=== AST before optimization\n");
+        ast_dump(stderr, ast_at(root), 0);
+    }
+    
+    struct opt_context ctx;
+    ctx.locals = NULL;
+    ctx.depth = 0;
+    root = opt_statement(&ctx, root);
+    
+    if(ast_dump_trees)
+    {
+        fprintf(stderr, "=== AST after optimization\n");
+        ast_dump(stderr, ast_at(root), 0);
+    }
+    
+    return root;
+}
+
+void ast_dump(FILE* out, struct ast_node* ast, int depth)
+{
+    static const char* type_names[] = {
+        "PLUS", "MINUS", "TIMES", "DIV", "MOD", "UNARY_MINUS", "BOOLEXPR",
+        "STRING", "INTEGER", "FLOAT", "SYMREF", "IF", "WHILE", "FOR", "ASSIGN",
+        "SPFUNC", "AND", "OR", "NOT", "TURTLE", "EXIT", "SHOWHELP", "STATS",
+        "ECHO", "LOADFILE", "STATEMENTS", "REPEAT", "EXPRS", "CALL", "FUNC",
+        "PARAM", "RETURN", "SET_COLOR"
+    };
+    static const char* spfunc_names[] = {
+        "cos", "sin", "tan", "abs", "sqrt", "log", "log10", "exp", "rmdr",
+        "max", "min", "ceil", "floor"
+    };
+    static const char* boolop_names[] = {"==", "!=", "<", ">", "<=", ">="};
+    
+    fprintf(out, "%*s", 2 * depth, "");
+    
+    if(ast == NULL)
+    {
+        fprintf(out, "(null)\n");
+        return;
+    }
+    
+    fprintf(out, "%s", type_names[ast->type]);
+    
+    switch(ast->type)
+    {
+    case AST_STRING:
+        fprintf(out, " \"%s\"\n", ast->data.strval);
+        break;
+    case AST_INTEGER:
+        fprintf(out, " %d\n", ast->data.intval);
+        break;
+    case AST_FLOAT:
+        fprintf(out, " %g\n", ast->data.fltval);
+        break;
+    case AST_SYMREF:
+        fprintf(out, " %s\n", ast->data.symrefexpr.name);
+        break;
+    case AST_ASSIGN:
+        fprintf(out, " %s\n", ast->data.assignexpr.name);
+        ast_dump(out, AST_CHILD(ast, ast->data.assignexpr.val), depth + 1);
+        break;
+    case AST_BOOLEXPR:
+        fprintf(out, " %s\n", boolop_names[ast->data.boolexpr.op]);
+        ast_dump(out, AST_CHILD(ast, ast->data.boolexpr.left), depth + 1);
+        ast_dump(out, AST_CHILD(ast, ast->data.boolexpr.right), depth + 1);
+        break;
+    case AST_SPFUNC:
+        fprintf(out, " %s\n", spfunc_names[ast->data.spfuncexpr.type]);
+        ast_dump(out, AST_CHILD(ast, ast->data.spfuncexpr.left), depth + 1);
+        if(ast->data.spfuncexpr.right != AST_NONE)
+        {
+            ast_dump(out, AST_CHILD(ast, ast->data.spfuncexpr.right), depth + 1);
+        }
+        break;
+    case AST_IF:
+        fprintf(out, "\n");
+        ast_dump(out, AST_CHILD(ast, ast->data.ifexpr.condition), depth + 1);
+        ast_dump(out, AST_CHILD(ast, ast->data.ifexpr.ifactions), depth + 1);
+        if(ast->data.ifexpr.elseactions != AST_NONE)
+        {
+            ast_dump(out, AST_CHILD(ast, ast->data.ifexpr.elseactions), depth + 1);
+        }
+        break;
+    case AST_WHILE:
+        fprintf(out, "\n");
+        ast_dump(out, AST_CHILD(ast, ast->data.whileexpr.condition), depth + 1);
+        if(ast->data.whileexpr.preheader != AST_NONE)
+        {
+            ast_dump(out, AST_CHILD(ast, ast->data.whileexpr.preheader), depth + 1);
+        }
+        ast_dump(out, AST_CHILD(ast, ast->data.whileexpr.loopactions), depth + 1);
+        break;
+    case AST_FOR:
+        fprintf(out, " %s\n", ast->data.forexpr.cursorname);
+        ast_dump(out, AST_CHILD(ast, ast->data.forexpr.begin), depth + 1);
+        ast_dump(out, AST_CHILD(ast, ast->data.forexpr.end), depth + 1);
+        if(ast->data.forexpr.preheader != AST_NONE)
+        {
+            ast_dump(out, AST_CHILD(ast, ast->data.forexpr.preheader), depth + 1);
+        }
+        ast_dump(out, AST_CHILD(ast, ast->data.forexpr.loopactions), depth + 1);
+        break;
+    case AST_REPEAT:
+        fprintf(out, "\n");
+        ast_dump(out, AST_CHILD(ast, ast->data.repeatexpr.count), depth + 1);
+        if(ast->data.repeatexpr.preheader != AST_NONE)
+        {
+            ast_dump(out, AST_CHILD(ast, ast->data.repeatexpr.preheader), depth + 1);
+        }
+        ast_dump(out, AST_CHILD(ast, ast->data.repeatexpr.loopactions), depth + 1);
+        break;
+    case AST_TURTLE:
+        fprintf(out, " %d\n", ast->data.turtleexpr.type);
+        if(ast->data.turtleexpr.param != AST_NONE)
+        {
+            ast_dump(out, AST_CHILD(ast, ast->data.turtleexpr.param), depth + 1);
+        }
+        break;
+    case AST_SET_COLOR:
+        fprintf(out, "\n");
+        ast_dump(out, AST_CHILD(ast, ast->data.setcolorexpr.r), depth + 1);
+        ast_dump(out, AST_CHILD(ast, ast->data.setcolorexpr.g), depth + 1);
+        ast_dump(out, AST_CHILD(ast, ast->data.setcolorexpr.b), depth + 1);
+        break;
+    case AST_FUNC:
+        fprintf(out, " %s\n", ast->data.funcexpr.name);
+        if(ast->data.funcexpr.params != AST_NONE)
+        {
+            ast_dump(out, AST_CHILD(ast, ast->data.funcexpr.params), depth + 1);
+        }
+        ast_dump(out, AST_CHILD(ast, ast->data.funcexpr.body), depth + 1);
+        break;
+    default:
+        fprintf(out, "\n");
+        if(ast->data.expr.left != AST_NONE)
+        {
+            ast_dump(out, AST_CHILD(ast, ast->data.expr.left), depth + 1);
+        }
+        if(ast->data.expr.right != AST_NONE)
+        {
+            ast_dump(out, AST_CHILD(ast, ast->data.expr.right), depth + 1);
+        }
+        break;
+    }
+}
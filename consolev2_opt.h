@@ -0,0 +1,42 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * MTurtle Console
+ * AST optimizer
+ */
+
+#ifndef __CONSOLEV2_OPT_H_
+#define __CONSOLEV2_OPT_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "consolev2_common.h"
+
+/* Dump Trees to stderr Before and After Optimization */
+extern bool ast_dump_trees;
+
+/*
+ * AST OPTIMIZATION API
+ */
+
+ast_index ast_optimize(ast_index root);
+
+void ast_dump(FILE* out, struct ast_node* ast, int depth);
+
+#endif /* __CONSOLEV2_OPT_H_ */
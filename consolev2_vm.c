@@ -0,0 +1,1681 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * MTurtle Console
+ * Bytecode compiler and virtual machine
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include "MTurtle.h"
+#include "consolev2_common.h"
+#include "consolev2_vm.h"
+#include "consolev2_worker.h"
+
+#define PI 3.14159265
+#define RAD2DEG PI / 180.0
+
+#define VM_CHUNK_INITIAL_CAPACITY 64
+#define VM_CALLS_INITIAL_CAPACITY 64
+#define VM_COUNTERS_INITIAL_CAPACITY 16
+#define VM_MAX_LOADS 10                 /* files loading each other */
+
+/* Threaded Dispatch Needs GCC's Labels as Values */
+#ifdef __GNUC__
+#define VM_THREADED
+#endif
+
+extern struct ast_node* scan_file(struct exec_env*, const char*);
+extern int clamp(int val, int lower, int upper);
+
+/*
+ * VM COMPILER API
+ */
+
+struct vm_compiler {
+    struct vm_chunk* chunk;
+    int depth;                      /* operand stack depth at this point */
+    bool function;                  /* compiling a function body */
+    bool tail;                      /* next statement ends the function */
+};
+
+void vm_compile_expr(struct vm_compiler* c, struct ast_node* ast);
+void vm_compile_statement(struct vm_compiler* c, struct ast_node* ast);
+
+void vm_emit(struct vm_compiler* c, union vm_word word)
+{
+    struct vm_chunk* chunk = c->chunk;
+    
+    if(chunk->size >= chunk->capacity)
+    {
+        chunk->capacity = chunk->capacity > 0 ? 2 * chunk->capacity : VM_CHUNK_INITIAL_CAPACITY;
+        chunk->code = realloc(chunk->code, chunk->capacity * sizeof(union vm_word));
+        if(chunk->code == NULL)
+        {
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    chunk->code[chunk->size ++] = word;
+}
+
+void vm_emit_op(struct vm_compiler* c, vm_opcode op, int effect)
+{
+    union vm_word word;
+    word.i = op;
+    vm_emit(c, word);
+    
+    c->depth += effect;
+    if(c->depth > c->chunk->maxdepth)
+    {
+        c->chunk->maxdepth = c->depth;
+    }
+}
+
+void vm_emit_int(struct vm_compiler* c, int i)
+{
+    union vm_word word;
+    word.i = i;
+    vm_emit(c, word);
+}
+
+void vm_emit_float(struct vm_compiler* c, float f)
+{
+    union vm_word word;
+    word.f = f;
+    vm_emit(c, word);
+}
+
+void vm_emit_string(struct vm_compiler* c, char* s)
+{
+    union vm_word word;
+    word.s = s;
+    vm_emit(c, word);
+}
+
+void vm_emit_ast(struct vm_compiler* c, struct ast_node* ast)
+{
+    union vm_word word;
+    word.ast = ast;
+    vm_emit(c, word);
+}
+
+/*
+ * Jumps are relative to their operand. vm_emit_jump leaves the operand
+ * to be filled in by vm_patch once the target is known, vm_emit_target
+ * jumps back to an already known target.
+ */
+
+int vm_emit_jump(struct vm_compiler* c, vm_opcode op, int effect)
+{
+    vm_emit_op(c, op, effect);
+    vm_emit_int(c, 0);
+    
+    return c->chunk->size - 1;
+}
+
+void vm_emit_target(struct vm_compiler* c, vm_opcode op, int effect, int target)
+{
+    vm_emit_op(c, op, effect);
+    vm_emit_int(c, target - c->chunk->size);
+}
+
+void vm_patch(struct vm_compiler* c, int at)
+{
+    c->chunk->code[at].i = c->chunk->size - at;
+}
+
+void vm_compile_store(struct vm_compiler* c, int local, int slot, char* name)
+{
+    if(local >= 0)
+    {
+        vm_emit_op(c, VM_STORE_LOCAL, -1);
+        vm_emit_int(c, local);
+    }
+    else
+    {
+        vm_emit_op(c, VM_STORE_GLOBAL, -1);
+        vm_emit_int(c, slot);
+        vm_emit_string(c, name);
+    }
+}
+
+void vm_compile_print(struct vm_compiler* c, vm_opcode op, struct ast_node* ast)
+{
+    /* Strings as Is, Conditions as True or False, Integers Without Decimals */
+    if(ast->type == AST_STRING)
+    {
+        vm_emit_op(c, op, 0);
+        vm_emit_int(c, VM_FORMAT_STRING);
+        vm_emit_string(c, ast->data.strval);
+        return;
+    }
+    
+    vm_compile_expr(c, ast);
+    vm_emit_op(c, op, -1);
+    
+    if(ast->type == AST_BOOLEXPR || ast->type == AST_AND || ast->type == AST_OR || ast->type == AST_NOT)
+    {
+        vm_emit_int(c, VM_FORMAT_BOOL);
+    }
+    else if(ast->type == AST_INTEGER)
+    {
+        vm_emit_int(c, VM_FORMAT_INT);
+    }
+    else
+    {
+        vm_emit_int(c, VM_FORMAT_FLOAT);
+    }
+    vm_emit_string(c, NULL);
+}
+
+void vm_compile_call(struct vm_compiler* c, struct ast_node* ast, vm_opcode op)
+{
+    /* Push Every Argument, the Callee Keeps What It Needs */
+    int argc = 0;
+    struct ast_node* cursor = AST_CHILD(ast, ast->data.expr.right);
+    
+    while(cursor != NULL && cursor->type == AST_EXPRS)
+    {
+        vm_compile_expr(c, AST_CHILD(cursor, cursor->data.expr.left));
+        argc ++;
+        cursor = AST_CHILD(cursor, cursor->data.expr.right);
+    }
+    
+    char* name = AST_CHILD(ast, ast->data.expr.left)->data.strval;
+    vm_emit_op(c, op, 1 - argc);
+    vm_emit_int(c, var_interned_slot(name));
+    vm_emit_int(c, argc);
+    vm_emit_string(c, name);
+}
+
+void vm_compile_expr(struct vm_compiler* c, struct ast_node* ast)
+{
+    if(ast == NULL)
+    {
+        fprintf(stderr, "*** FATAL: AST node for VM_EXPR context is NULL!\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    switch(ast->type)
+    {
+    case AST_INTEGER:
+        vm_emit_op(c, VM_PUSH, 1);
+        vm_emit_float(c, (float) ast->data.intval);
+        break;
+    case AST_FLOAT:
+        vm_emit_op(c, VM_PUSH, 1);
+        vm_emit_float(c, ast->data.fltval);
+        break;
+    case AST_PLUS:
+    case AST_MINUS:
+    case AST_TIMES:
+    case AST_DIV:
+    case AST_MOD:
+    {
+        static const vm_opcode ops[] = {VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_MOD};
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.expr.left));
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.expr.right));
+        vm_emit_op(c, ops[ast->type - AST_PLUS], -1);
+        break;
+    }
+    case AST_UNARY_MINUS:
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.expr.left));
+        vm_emit_op(c, VM_NEG, 0);
+        break;
+    case AST_SYMREF:
+        if(ast->data.symrefexpr.local >= 0)
+        {
+            vm_emit_op(c, VM_LOAD_LOCAL, 1);
+            vm_emit_int(c, ast->data.symrefexpr.local);
+        }
+        else
+        {
+            vm_emit_op(c, VM_LOAD_GLOBAL, 1);
+        }
+        vm_emit_int(c, ast->data.symrefexpr.slot);
+        vm_emit_string(c, ast->data.symrefexpr.name);
+        break;
+    case AST_SPFUNC:
+    {
+        static const vm_opcode ops[] = {
+            VM_COS, VM_SIN, VM_TAN, VM_ABS, VM_SQRT, VM_LOG, VM_LOG10,
+            VM_EXP, VM_RMDR, VM_MAX, VM_MIN, VM_CEIL, VM_FLOOR
+        };
+        spfunc_type type = ast->data.spfuncexpr.type;
+        
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.spfuncexpr.left));
+        if(type == SPFUNC_RMDR || type == SPFUNC_MAX || type == SPFUNC_MIN)
+        {
+            vm_compile_expr(c, AST_CHILD(ast, ast->data.spfuncexpr.right));
+            vm_emit_op(c, ops[type], -1);
+        }
+        else
+        {
+            vm_emit_op(c, ops[type], 0);
+        }
+        break;
+    }
+    case AST_CALL:
+        vm_compile_call(c, ast, VM_CALL);
+        break;
+    case AST_BOOLEXPR:
+    {
+        static const vm_opcode ops[] = {VM_EQ, VM_NEQ, VM_LESS, VM_GREATER, VM_LEQ, VM_GEQ};
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.boolexpr.left));
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.boolexpr.right));
+        vm_emit_op(c, ops[ast->data.boolexpr.op], -1);
+        break;
+    }
+    case AST_NOT:
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.expr.left));
+        vm_emit_op(c, VM_NOT, 0);
+        break;
+    case AST_AND:
+    case AST_OR:
+    {
+        /* Short Circuit */
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.expr.left));
+        int shortcut = vm_emit_jump(c, ast->type == AST_AND ? VM_JUMP_IF_FALSE : VM_JUMP_IF_TRUE, -1);
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.expr.right));
+        int end = vm_emit_jump(c, VM_JUMP, -1);
+        
+        vm_patch(c, shortcut);
+        vm_emit_op(c, VM_PUSH, 1);
+        vm_emit_float(c, ast->type == AST_AND ? 0.0f : 1.0f);
+        vm_patch(c, end);
+        break;
+    }
+    default:
+        fprintf(stderr, "*** FATAL: invalid AST node for VM_EXPR context\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void vm_compile_turtle(struct vm_compiler* c, struct ast_node* ast)
+{
+    struct ast_node* param = AST_CHILD(ast, ast->data.turtleexpr.param);
+    
+    switch(ast->data.turtleexpr.type)
+    {
+    case TURT_FORWARD:
+        vm_compile_expr(c, param);
+        vm_emit_op(c, VM_TURT_FORWARD, -1);
+        break;
+    case TURT_BACKWARD:
+        vm_compile_expr(c, param);
+        vm_emit_op(c, VM_TURT_BACKWARD, -1);
+        break;
+    case TURT_LEFT:
+        vm_compile_expr(c, param);
+        vm_emit_op(c, VM_TURT_LEFT, -1);
+        break;
+    case TURT_RIGHT:
+        vm_compile_expr(c, param);
+        vm_emit_op(c, VM_TURT_RIGHT, -1);
+        break;
+    case TURT_PENDOWN:
+        vm_emit_op(c, VM_TURT_PENDOWN, 0);
+        break;
+    case TURT_PENUP:
+        vm_emit_op(c, VM_TURT_PENUP, 0);
+        break;
+    case TURT_HIDE:
+        vm_emit_op(c, VM_TURT_HIDE, 0);
+        break;
+    case TURT_SHOW:
+        vm_emit_op(c, VM_TURT_SHOW, 0);
+        break;
+    case TURT_WRITE:
+        vm_compile_print(c, VM_TURT_WRITE, param);
+        break;
+    case TURT_CENTERED_CIRCLE:
+        vm_compile_expr(c, param);
+        vm_emit_op(c, VM_TURT_CENTERED_CIRCLE, -1);
+        break;
+    case TURT_CIRCLE:
+        vm_compile_expr(c, param);
+        vm_emit_op(c, VM_TURT_CIRCLE, -1);
+        break;
+    case TURT_ARC:
+    {
+        struct ast_node* next = AST_CHILD(param, param->data.expr.right);
+        vm_compile_expr(c, AST_CHILD(param, param->data.expr.left));
+        vm_compile_expr(c, AST_CHILD(next, next->data.expr.left));
+        vm_emit_op(c, VM_TURT_ARC, -2);
+        break;
+    }
+    case TURT_HOME:
+        vm_emit_op(c, VM_TURT_HOME, 0);
+        break;
+    case TURT_CLEAR:
+        vm_emit_op(c, VM_TURT_CLEAR, 0);
+        break;
+    case TURT_RESET:
+        vm_emit_op(c, VM_TURT_RESET, 0);
+        break;
+    default:
+        fprintf(stderr, "*** FATAL: invalid turt_action\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void vm_compile_statement(struct vm_compiler* c, struct ast_node* ast)
+{
+    /* Only the Last Statements of a Function Are in Tail Position */
+    bool tail = c->tail;
+    c->tail = false;
+    
+    if(ast == NULL)
+    {
+        return;
+    }
+    
+    switch(ast->type)
+    {
+    case AST_STATEMENTS:
+        vm_compile_statement(c, AST_CHILD(ast, ast->data.expr.left));
+        c->tail = tail;
+        vm_compile_statement(c, AST_CHILD(ast, ast->data.expr.right));
+        break;
+    case AST_EXIT:
+        vm_emit_op(c, VM_EXIT, 0);
+        break;
+    case AST_SHOWHELP:
+        vm_emit_op(c, VM_HELP, 0);
+        break;
+    case AST_STATS:
+        vm_emit_op(c, VM_STATS, 0);
+        break;
+    case AST_ECHO:
+        vm_compile_print(c, VM_ECHO, AST_CHILD(ast, ast->data.expr.left));
+        break;
+    case AST_TURTLE:
+        vm_compile_turtle(c, ast);
+        break;
+    case AST_SET_COLOR:
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.setcolorexpr.r));
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.setcolorexpr.g));
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.setcolorexpr.b));
+        vm_emit_op(c, VM_SET_COLOR, -3);
+        break;
+    case AST_ASSIGN:
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.assignexpr.val));
+        vm_compile_store(c, ast->data.assignexpr.local, ast->data.assignexpr.slot, ast->data.assignexpr.name);
+        break;
+    case AST_IF:
+    {
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.ifexpr.condition));
+        int elsejump = vm_emit_jump(c, VM_JUMP_IF_FALSE, -1);
+        c->tail = tail;
+        vm_compile_statement(c, AST_CHILD(ast, ast->data.ifexpr.ifactions));
+        
+        if(ast->data.ifexpr.elseactions != AST_NONE)
+        {
+            int end = vm_emit_jump(c, VM_JUMP, 0);
+            vm_patch(c, elsejump);
+            c->tail = tail;
+            vm_compile_statement(c, AST_CHILD(ast, ast->data.ifexpr.elseactions));
+            vm_patch(c, end);
+        }
+        else
+        {
+            vm_patch(c, elsejump);
+        }
+        break;
+    }
+    case AST_WHILE:
+    {
+        /*
+         * Hoisted expressions only run once the loop is entered: the
+         * first test is copied in front of them, then jumps into the body.
+         */
+        int skipjump = -1;
+        int enterjump = -1;
+        if(ast->data.whileexpr.preheader != AST_NONE)
+        {
+            vm_compile_expr(c, AST_CHILD(ast, ast->data.whileexpr.condition));
+            skipjump = vm_emit_jump(c, VM_JUMP_IF_FALSE, -1);
+            vm_compile_statement(c, AST_CHILD(ast, ast->data.whileexpr.preheader));
+            enterjump = vm_emit_jump(c, VM_JUMP, 0);
+        }
+        
+        int top = c->chunk->size;
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.whileexpr.condition));
+        int exitjump = vm_emit_jump(c, VM_JUMP_IF_FALSE, -1);
+        if(enterjump >= 0)
+        {
+            vm_patch(c, enterjump);
+        }
+        vm_compile_statement(c, AST_CHILD(ast, ast->data.whileexpr.loopactions));
+        vm_emit_target(c, VM_JUMP, 0, top);
+        vm_patch(c, exitjump);
+        if(skipjump >= 0)
+        {
+            vm_patch(c, skipjump);
+        }
+        break;
+    }
+    case AST_FOR:
+    {
+        /* The Counter and the End Value Stay on the Counter Stack */
+        int local = ast->data.forexpr.local;
+        int slot = ast->data.forexpr.slot;
+        char* name = ast->data.forexpr.cursorname;
+        
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.forexpr.begin));
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.forexpr.end));
+        vm_emit_op(c, VM_FOR_START, -2);
+        
+        int skipjump = -1;
+        int enterjump = -1;
+        if(ast->data.forexpr.preheader != AST_NONE)
+        {
+            skipjump = vm_emit_jump(c, VM_FOR_TEST, 1);
+            vm_compile_store(c, local, slot, name);
+            vm_compile_statement(c, AST_CHILD(ast, ast->data.forexpr.preheader));
+            enterjump = vm_emit_jump(c, VM_JUMP, 0);
+        }
+        
+        int top = c->chunk->size;
+        int exitjump = vm_emit_jump(c, VM_FOR_TEST, 1);
+        vm_compile_store(c, local, slot, name);
+        if(enterjump >= 0)
+        {
+            vm_patch(c, enterjump);
+        }
+        vm_compile_statement(c, AST_CHILD(ast, ast->data.forexpr.loopactions));
+        vm_emit_target(c, VM_FOR_NEXT, 0, top);
+        
+        vm_patch(c, exitjump);
+        if(skipjump >= 0)
+        {
+            vm_patch(c, skipjump);
+        }
+        vm_emit_op(c, VM_FOR_END, 1);
+        vm_compile_store(c, local, slot, name);
+        break;
+    }
+    case AST_REPEAT:
+    {
+        /* The Remaining Count Stays on the Counter Stack */
+        vm_compile_expr(c, AST_CHILD(ast, ast->data.repeatexpr.count));
+        vm_emit_op(c, VM_REPEAT_START, -1);
+        
+        int skipjump = -1;
+        int enterjump = -1;
+        if(ast->data.repeatexpr.preheader != AST_NONE)
+        {
+            skipjump = vm_emit_jump(c, VM_REPEAT_TEST, 0);
+            vm_compile_statement(c, AST_CHILD(ast, ast->data.repeatexpr.preheader));
+            enterjump = vm_emit_jump(c, VM_JUMP, 0);
+        }
+        
+        int top = c->chunk->size;
+        int exitjump = vm_emit_jump(c, VM_REPEAT_TEST, 0);
+        if(enterjump >= 0)
+        {
+            vm_patch(c, enterjump);
+        }
+        vm_compile_statement(c, AST_CHILD(ast, ast->data.repeatexpr.loopactions));
+        vm_emit_target(c, VM_JUMP, 0, top);
+        
+        vm_patch(c, exitjump);
+        if(skipjump >= 0)
+        {
+            vm_patch(c, skipjump);
+        }
+        vm_emit_op(c, VM_REPEAT_END, 0);
+        break;
+    }
+    case AST_LOADFILE:
+        vm_emit_op(c, VM_LOAD, 0);
+        vm_emit_string(c, AST_CHILD(ast, ast->data.expr.left)->data.strval);
+        break;
+    case AST_CALL:
+        if(tail)
+        {
+            /* The Function Returns 0 Right After, Whatever the Callee Returns */
+            vm_compile_call(c, ast, VM_TAIL_CALL);
+            vm_emit_int(c, true);
+        }
+        else
+        {
+            vm_compile_expr(c, ast);
+        }
+        vm_emit_op(c, VM_POP, -1);
+        break;
+    case AST_RETURN:
+        if(c->function && ast->data.expr.left != AST_NONE && AST_CHILD(ast, ast->data.expr.left)->type == AST_CALL)
+        {
+            vm_compile_call(c, AST_CHILD(ast, ast->data.expr.left), VM_TAIL_CALL);
+            vm_emit_int(c, false);
+        }
+        else if(ast->data.expr.left != AST_NONE)
+        {
+            vm_compile_expr(c, AST_CHILD(ast, ast->data.expr.left));
+        }
+        else
+        {
+            vm_emit_op(c, VM_PUSH, 1);
+            vm_emit_float(c, 0.0f);
+        }
+        vm_emit_op(c, VM_RETURN, -1);
+        break;
+    case AST_FUNC:
+        vm_emit_op(c, VM_DEFINE, 0);
+        vm_emit_ast(c, ast);
+        break;
+    default:
+        fprintf(stderr, "*** FATAL: invalid AST node for VM_STATEMENT context\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+struct vm_chunk* vm_chunk_new()
+{
+    struct vm_chunk* chunk = malloc_or_die(sizeof(struct vm_chunk));
+    
+    chunk->code = NULL;
+    chunk->size = 0;
+    chunk->capacity = 0;
+    chunk->maxdepth = 0;
+    
+    return chunk;
+}
+
+struct vm_chunk* vm_compile(struct ast_node* ast)
+{
+    struct vm_compiler c;
+    c.chunk = vm_chunk_new();
+    c.depth = 0;
+    c.function = false;
+    c.tail = false;
+    
+    vm_compile_statement(&c, ast);
+    vm_emit_op(&c, VM_HALT, 0);
+    
+    return c.chunk;
+}
+
+struct vm_chunk* vm_compile_function(struct ast_node* body)
+{
+    struct vm_compiler c;
+    c.chunk = vm_chunk_new();
+    c.depth = 0;
+    c.function = true;
+    c.tail = true;
+    
+    /* Falling Off the End Returns 0 */
+    vm_compile_statement(&c, body);
+    vm_emit_op(&c, VM_PUSH, 1);
+    vm_emit_float(&c, 0.0f);
+    vm_emit_op(&c, VM_RETURN, -1);
+    
+    return c.chunk;
+}
+
+void vm_free(struct vm_chunk* chunk)
+{
+    if(chunk == NULL)
+    {
+        return;
+    }
+    
+    free(chunk->code);
+    free(chunk);
+}
+
+/*
+ * VM EXECUTION API
+ */
+
+const char* vm_format_value(char* buf, size_t size, vm_format format, char* str, float val)
+{
+    if(format == VM_FORMAT_STRING)
+    {
+        return str;
+    }
+    else if(format == VM_FORMAT_BOOL)
+    {
+        return val != 0.0f ? "True" : "False";
+    }
+    else if(format == VM_FORMAT_INT)
+    {
+        snprintf(buf, size, "%d", (int) val);
+    }
+    else
+    {
+        snprintf(buf, size, "%g", val);
+    }
+    
+    return buf;
+}
+
+void vm_turtle(struct exec_env* env, vm_opcode op, float a, float b, float c)
+{
+    /* Drawn Right Away, or Later by the SDL Thread */
+    struct turtle_cmd cmd;
+    cmd.op = op;
+    cmd.args[0] = a;
+    cmd.args[1] = b;
+    cmd.args[2] = c;
+    cmd.str = NULL;
+    
+    turtle_emit(env, &cmd);
+}
+
+float* vm_reserve_stack(float** stack, int* capacity, float* sp, int depth)
+{
+    /* Room for depth More Operands, Returns sp in the Moved Stack */
+    int height = sp - *stack;
+    
+    if(height + depth > *capacity)
+    {
+        while(height + depth > *capacity)
+        {
+            *capacity *= 2;
+        }
+        
+        *stack = realloc(*stack, *capacity * sizeof(float));
+        if(*stack == NULL)
+        {
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    return *stack + height;
+}
+
+int* vm_reserve_counters(int** counters, int* capacity, int* cp, int depth)
+{
+    /* Same for the Counter Stack */
+    int height = cp - *counters;
+    
+    if(height + depth > *capacity)
+    {
+        while(height + depth > *capacity)
+        {
+            *capacity *= 2;
+        }
+        
+        *counters = realloc(*counters, *capacity * sizeof(int));
+        if(*counters == NULL)
+        {
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    return *counters + height;
+}
+
+struct vm_call* vm_push_call(struct vm_call** calls, int* count, int* capacity)
+{
+    if(*count >= *capacity)
+    {
+        *capacity *= 2;
+        *calls = realloc(*calls, *capacity * sizeof(struct vm_call));
+        if(*calls == NULL)
+        {
+            fprintf(stderr, "*** FATAL: realloc failed!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    struct vm_call* call = &(*calls)[(*count) ++];
+    call->discard = false;
+    call->memo = NULL;
+    call->stamp = 0;
+    call->loaded = NULL;
+    call->ast = NULL;
+    
+    return call;
+}
+
+void vm_end_load(struct vm_call* call)
+{
+    vm_free(call->loaded);
+    ast_destroy(call->ast);
+}
+
+void vm_start(struct vm_state* state, struct exec_env* env, struct vm_chunk* chunk)
+{
+    state->env = env;
+    state->pc = chunk->code;
+    
+    /* Operand Stack */
+    state->stackcapacity = chunk->maxdepth + 1;
+    state->stack = malloc_or_die(state->stackcapacity * sizeof(float));
+    state->sp = 0;
+    
+    /* Counter Stack */
+    state->countercapacity = VM_COUNTERS_INITIAL_CAPACITY;
+    state->counters = malloc_or_die(state->countercapacity * sizeof(int));
+    state->countercount = 0;
+    
+    /* Call Stack */
+    state->callcapacity = VM_CALLS_INITIAL_CAPACITY;
+    state->callcount = 0;
+    state->calls = malloc_or_die(state->callcapacity * sizeof(struct vm_call));
+    state->loads = 0;
+    
+    /* Frames Are Restored if We Stop Inside a Call */
+    state->frame = env->frame;
+    state->stacksize = env->stacksize;
+}
+
+void vm_stop(struct vm_state* state)
+{
+    /* Files Still Being Loaded When Interrupted */
+    int i;
+    for(i = 0; i < state->callcount; i++)
+    {
+        if(state->calls[i].loaded != NULL)
+        {
+            vm_end_load(&state->calls[i]);
+        }
+    }
+    
+    state->env->frame = state->frame;
+    state->env->stacksize = state->stacksize;
+    
+    free(state->stack);
+    free(state->counters);
+    free(state->calls);
+}
+
+void vm_run(struct exec_env* env, struct vm_chunk* chunk)
+{
+    struct vm_state state;
+    
+    vm_start(&state, env, chunk);
+    vm_resume(&state, VM_NO_BUDGET);
+    vm_stop(&state);
+}
+
+vm_status vm_resume(struct vm_state* state, int budget)
+{
+#ifdef VM_THREADED
+    static void* dispatch[VM_OPCODE_COUNT] = {
+        [VM_HALT] = &&op_VM_HALT,
+        [VM_PUSH] = &&op_VM_PUSH,
+        [VM_POP] = &&op_VM_POP,
+        [VM_LOAD_GLOBAL] = &&op_VM_LOAD_GLOBAL,
+        [VM_LOAD_LOCAL] = &&op_VM_LOAD_LOCAL,
+        [VM_STORE_GLOBAL] = &&op_VM_STORE_GLOBAL,
+        [VM_STORE_LOCAL] = &&op_VM_STORE_LOCAL,
+        [VM_ADD] = &&op_VM_ADD,
+        [VM_SUB] = &&op_VM_SUB,
+        [VM_MUL] = &&op_VM_MUL,
+        [VM_DIV] = &&op_VM_DIV,
+        [VM_MOD] = &&op_VM_MOD,
+        [VM_NEG] = &&op_VM_NEG,
+        [VM_EQ] = &&op_VM_EQ,
+        [VM_NEQ] = &&op_VM_NEQ,
+        [VM_LESS] = &&op_VM_LESS,
+        [VM_GREATER] = &&op_VM_GREATER,
+        [VM_LEQ] = &&op_VM_LEQ,
+        [VM_GEQ] = &&op_VM_GEQ,
+        [VM_NOT] = &&op_VM_NOT,
+        [VM_COS] = &&op_VM_COS,
+        [VM_SIN] = &&op_VM_SIN,
+        [VM_TAN] = &&op_VM_TAN,
+        [VM_ABS] = &&op_VM_ABS,
+        [VM_SQRT] = &&op_VM_SQRT,
+        [VM_LOG] = &&op_VM_LOG,
+        [VM_LOG10] = &&op_VM_LOG10,
+        [VM_EXP] = &&op_VM_EXP,
+        [VM_CEIL] = &&op_VM_CEIL,
+        [VM_FLOOR] = &&op_VM_FLOOR,
+        [VM_RMDR] = &&op_VM_RMDR,
+        [VM_MAX] = &&op_VM_MAX,
+        [VM_MIN] = &&op_VM_MIN,
+        [VM_JUMP] = &&op_VM_JUMP,
+        [VM_JUMP_IF_FALSE] = &&op_VM_JUMP_IF_FALSE,
+        [VM_JUMP_IF_TRUE] = &&op_VM_JUMP_IF_TRUE,
+        [VM_FOR_START] = &&op_VM_FOR_START,
+        [VM_FOR_TEST] = &&op_VM_FOR_TEST,
+        [VM_FOR_NEXT] = &&op_VM_FOR_NEXT,
+        [VM_FOR_END] = &&op_VM_FOR_END,
+        [VM_REPEAT_START] = &&op_VM_REPEAT_START,
+        [VM_REPEAT_TEST] = &&op_VM_REPEAT_TEST,
+        [VM_REPEAT_END] = &&op_VM_REPEAT_END,
+        [VM_CALL] = &&op_VM_CALL,
+        [VM_TAIL_CALL] = &&op_VM_TAIL_CALL,
+        [VM_RETURN] = &&op_VM_RETURN,
+        [VM_DEFINE] = &&op_VM_DEFINE,
+        [VM_EXIT] = &&op_VM_EXIT,
+        [VM_HELP] = &&op_VM_HELP,
+        [VM_STATS] = &&op_VM_STATS,
+        [VM_ECHO] = &&op_VM_ECHO,
+        [VM_LOAD] = &&op_VM_LOAD,
+        [VM_SET_COLOR] = &&op_VM_SET_COLOR,
+        [VM_TURT_FORWARD] = &&op_VM_TURT_FORWARD,
+        [VM_TURT_BACKWARD] = &&op_VM_TURT_BACKWARD,
+        [VM_TURT_LEFT] = &&op_VM_TURT_LEFT,
+        [VM_TURT_RIGHT] = &&op_VM_TURT_RIGHT,
+        [VM_TURT_PENDOWN] = &&op_VM_TURT_PENDOWN,
+        [VM_TURT_PENUP] = &&op_VM_TURT_PENUP,
+        [VM_TURT_HIDE] = &&op_VM_TURT_HIDE,
+        [VM_TURT_SHOW] = &&op_VM_TURT_SHOW,
+        [VM_TURT_WRITE] = &&op_VM_TURT_WRITE,
+        [VM_TURT_CENTERED_CIRCLE] = &&op_VM_TURT_CENTERED_CIRCLE,
+        [VM_TURT_CIRCLE] = &&op_VM_TURT_CIRCLE,
+        [VM_TURT_ARC] = &&op_VM_TURT_ARC,
+        [VM_TURT_HOME] = &&op_VM_TURT_HOME,
+        [VM_TURT_CLEAR] = &&op_VM_TURT_CLEAR,
+        [VM_TURT_RESET] = &&op_VM_TURT_RESET
+    };
+#define VM_OP(op) op_##op:
+#define VM_NEXT() goto *dispatch[(pc++)->i]
+#else
+#define VM_OP(op) case op:
+#define VM_NEXT() continue
+#endif
+
+/* Loops Jump Back, Recursion Calls and Files Load Each Other, so Only These Spend the Budget */
+#define VM_TICK() if(budget > 0 && -- budget == 0) goto yield
+
+    struct exec_env* env = state->env;
+    
+    float* stack = state->stack;
+    float* sp = stack + state->sp;
+    int stackcapacity = state->stackcapacity;
+    
+    int* counters = state->counters;
+    int* cp = counters + state->countercount;
+    int countercapacity = state->countercapacity;
+    
+    struct vm_call* calls = state->calls;
+    int callcount = state->callcount;
+    int callcapacity = state->callcapacity;
+    int loads = state->loads;
+    
+    union vm_word* pc = state->pc;
+    struct frame_slot* locals = env->frame >= 0 ? env->stack + env->frame : NULL;
+    bool tailcall = false;
+    char buf[64];
+    vm_status status;
+
+#ifdef VM_THREADED
+    VM_NEXT();
+#else
+    for(;;)
+    {
+        switch((pc++)->i)
+        {
+#endif
+
+    VM_OP(VM_HALT)
+    {
+        if(callcount == 0 || calls[callcount - 1].loaded == NULL)
+        {
+            goto halt;
+        }
+        
+        /* End of a Loaded File */
+        callcount --;
+        loads --;
+        vm_end_load(&calls[callcount]);
+        
+        sp = stack + calls[callcount].sp;
+        cp = counters + calls[callcount].counters;
+        pc = calls[callcount].pc;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_PUSH)
+    {
+        *sp++ = pc[0].f;
+        pc ++;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_POP)
+    {
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_LOAD_GLOBAL)
+    load_global:
+    {
+        /* Inline Fast Path for Defined Variables */
+        int slot = pc[0].i;
+        if(slot < env->varcapacity && env->vars[slot].isDefined)
+        {
+            *sp++ = env->vars[slot].val;
+            pc += 2;
+            VM_NEXT();
+        }
+        
+        struct var_list* var = var_get_slot(env, slot);
+        if(var == NULL)
+        {
+            env_error(env, "-!- Undefined variable %s, defaulting to 0!\n", pc[1].s);
+            *sp++ = 0.0f;
+        }
+        else
+        {
+            *sp++ = var->val;
+        }
+        pc += 2;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_LOAD_LOCAL)
+    {
+        struct frame_slot* local = &locals[pc[0].i];
+        if(local->isSet)
+        {
+            *sp++ = local->val;
+            pc += 3;
+            VM_NEXT();
+        }
+        
+        /* Fall Back to Globals */
+        pc ++;
+        goto load_global;
+    }
+    
+    VM_OP(VM_STORE_GLOBAL)
+    {
+        int slot = pc[0].i;
+        if(slot < env->varcapacity && env->vars[slot].isDefined && !(env->vars[slot].isFunc))
+        {
+            env->vars[slot].val = *--sp;
+            pc += 2;
+            VM_NEXT();
+        }
+        
+        var_set_slot(env, slot, pc[1].s, *--sp);
+        pc += 2;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_STORE_LOCAL)
+    {
+        struct frame_slot* local = &locals[pc[0].i];
+        local->val = *--sp;
+        local->isSet = true;
+        pc ++;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_ADD)
+    {
+        sp[-2] = sp[-2] + sp[-1];
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_SUB)
+    {
+        sp[-2] = sp[-2] - sp[-1];
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_MUL)
+    {
+        sp[-2] = sp[-2] * sp[-1];
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_DIV)
+    {
+        if(sp[-1] == 0.0f)
+        {
+            env_error(env, "-!- Division by zero will result in undefined behaviour!\n");
+            sp[-2] = 0.0f;
+        }
+        else
+        {
+            sp[-2] = sp[-2] / sp[-1];
+        }
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_MOD)
+    {
+        if(sp[-1] == 0.0f)
+        {
+            env_error(env, "-!- Modulo by zero will result in undefined behaviour!\n");
+            sp[-2] = 0.0f;
+        }
+        else
+        {
+            sp[-2] = (float) fmod(sp[-2], sp[-1]);
+        }
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_NEG)
+    {
+        sp[-1] = 0.0f - sp[-1];
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_EQ)
+    {
+        sp[-2] = sp[-2] == sp[-1] ? 1.0f : 0.0f;
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_NEQ)
+    {
+        sp[-2] = sp[-2] != sp[-1] ? 1.0f : 0.0f;
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_LESS)
+    {
+        sp[-2] = sp[-2] < sp[-1] ? 1.0f : 0.0f;
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_GREATER)
+    {
+        sp[-2] = sp[-2] > sp[-1] ? 1.0f : 0.0f;
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_LEQ)
+    {
+        sp[-2] = sp[-2] <= sp[-1] ? 1.0f : 0.0f;
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_GEQ)
+    {
+        sp[-2] = sp[-2] >= sp[-1] ? 1.0f : 0.0f;
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_NOT)
+    {
+        sp[-1] = sp[-1] == 0.0f ? 1.0f : 0.0f;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_COS)
+    {
+        sp[-1] = (float) cos(sp[-1] * RAD2DEG);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_SIN)
+    {
+        sp[-1] = (float) sin(sp[-1] * RAD2DEG);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TAN)
+    {
+        sp[-1] = (float) tan(sp[-1] * RAD2DEG);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_ABS)
+    {
+        sp[-1] = (float) fabs(sp[-1]);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_SQRT)
+    {
+        sp[-1] = (float) sqrt(sp[-1]);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_LOG)
+    {
+        sp[-1] = (float) log(sp[-1]);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_LOG10)
+    {
+        sp[-1] = (float) log10(sp[-1]);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_EXP)
+    {
+        sp[-1] = (float) exp(sp[-1]);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_CEIL)
+    {
+        sp[-1] = (float) ceil(sp[-1]);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_FLOOR)
+    {
+        sp[-1] = (float) floor(sp[-1]);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_RMDR)
+    {
+        float right = sp[-1];
+        if(right == 0.0f)
+        {
+            env_error(env, "-!- Division by zero will result in undefined behaviour!\n");
+            sp[-2] = 0.0f;
+        }
+        else
+        {
+            float r = (float) fmod(sp[-2], right);
+            sp[-2] = r < 0 ? r + right : r;
+        }
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_MAX)
+    {
+        sp[-2] = sp[-2] > sp[-1] ? sp[-2] : sp[-1];
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_MIN)
+    {
+        sp[-2] = sp[-2] < sp[-1] ? sp[-2] : sp[-1];
+        sp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_JUMP)
+    {
+        pc += pc[0].i;
+        VM_TICK();
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_JUMP_IF_FALSE)
+    {
+        pc += *--sp == 0.0f ? pc[0].i : 1;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_JUMP_IF_TRUE)
+    {
+        pc += *--sp != 0.0f ? pc[0].i : 1;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_FOR_START)
+    {
+        /* Counter Stack: Counter, End Value */
+        cp = vm_reserve_counters(&counters, &countercapacity, cp, 2);
+        cp[0] = (int) sp[-2];
+        cp[1] = (int) sp[-1];
+        cp += 2;
+        sp -= 2;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_FOR_TEST)
+    {
+        if(cp[-2] > cp[-1])
+        {
+            pc += pc[0].i;
+        }
+        else
+        {
+            *sp++ = (float) cp[-2];
+            pc ++;
+        }
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_FOR_NEXT)
+    {
+        cp[-2] ++;
+        pc += pc[0].i;
+        VM_TICK();
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_FOR_END)
+    {
+        /* The Cursor Is Left One Past the End */
+        *sp++ = (float) cp[-2];
+        cp -= 2;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_REPEAT_START)
+    {
+        cp = vm_reserve_counters(&counters, &countercapacity, cp, 1);
+        *cp++ = (int) *--sp;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_REPEAT_TEST)
+    {
+        if(cp[-1] < 1)
+        {
+            pc += pc[0].i;
+        }
+        else
+        {
+            cp[-1] --;
+            pc ++;
+        }
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_REPEAT_END)
+    {
+        cp --;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TAIL_CALL)
+    {
+        tailcall = true;
+        goto call;
+    }
+    
+    VM_OP(VM_CALL)
+    call:
+    {
+        int argc = pc[1].i;
+        char* name = pc[2].s;
+        struct var_list* var = var_get_slot(env, pc[0].i);
+        bool discard = false;
+        
+        if(tailcall)
+        {
+            discard = pc[3].i;
+            pc ++;
+        }
+        pc += 3;
+        
+        if(var == NULL || !(var->isFunc))
+        {
+            if(var == NULL)
+            {
+                env_error(env, "-!- Undefined function: %s\n", name);
+            }
+            else
+            {
+                env_error(env, "-!- %s: is not a function\n", name);
+            }
+            
+            sp -= argc;
+            *sp++ = 0.0f;
+            tailcall = false;
+            VM_NEXT();
+        }
+        
+        /* Pure Functions Remember Their Results */
+        struct memo_entry* memo = NULL;
+        if(argc >= var->func.argc && func_is_pure(env, var))
+        {
+            memo = memo_lookup(var, sp - argc);
+            if(memo->isSet)
+            {
+                sp -= argc;
+                *sp++ = memo->result;
+                tailcall = false;
+                VM_NEXT();
+            }
+        }
+        
+        if(var->func.code == NULL)
+        {
+            var->func.code = vm_compile_function(var->func.body);
+        }
+        struct vm_chunk* callee = var->func.code;
+        
+        if(tailcall)
+        {
+            /* Drop Our Frame, the Callee Takes Its Place: Only Its Result Is Remembered */
+            env->stacksize = env->frame;
+            calls[callcount - 1].discard |= discard;
+            calls[callcount - 1].memo = memo;
+            calls[callcount - 1].stamp = memo != NULL ? memo->stamp : 0;
+        }
+        
+        /* Bind Arguments to Parameters */
+        int base = frame_push(env, var->func.framesize);
+        int count = argc < var->func.argc ? argc : var->func.argc;
+        int i;
+        for(i = 0; i < count; i++)
+        {
+            env->stack[base + i].val = sp[i - argc];
+            env->stack[base + i].isSet = true;
+        }
+        sp -= argc;
+        
+        if(tailcall)
+        {
+            /* Our Operands and Loops Are Dead Too */
+            sp = stack + calls[callcount - 1].sp;
+            cp = counters + calls[callcount - 1].counters;
+        }
+        
+        sp = vm_reserve_stack(&stack, &stackcapacity, sp, callee->maxdepth + 1);
+        
+        if(tailcall)
+        {
+            /* Keep the Caller's Record, the Callee Returns There */
+            tailcall = false;
+        }
+        else
+        {
+            struct vm_call* call = vm_push_call(&calls, &callcount, &callcapacity);
+            call->pc = pc;
+            call->sp = sp - stack;
+            call->counters = cp - counters;
+            call->frame = env->frame;
+            call->memo = memo;
+            call->stamp = memo != NULL ? memo->stamp : 0;
+        }
+        
+        env->frame = base;
+        locals = env->stack + base;
+        pc = callee->code;
+        VM_TICK();
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_RETURN)
+    {
+        float val = *--sp;
+        
+        /* Returning From Top Level Ends the Program */
+        if(callcount == 0)
+        {
+            goto halt;
+        }
+        
+        callcount --;
+        
+        if(calls[callcount].loaded != NULL)
+        {
+            /* Returning From a Loaded File Ends It */
+            vm_end_load(&calls[callcount]);
+            
+            sp = stack + calls[callcount].sp;
+            cp = counters + calls[callcount].counters;
+            pc = calls[callcount].pc;
+            VM_NEXT();
+        }
+        
+        struct memo_entry* memo = calls[callcount].memo;
+        if(memo != NULL && memo->stamp == calls[callcount].stamp)
+        {
+            memo->result = val;
+            memo->isSet = true;
+        }
+        
+        env->stacksize = env->frame;
+        env->frame = calls[callcount].frame;
+        locals = env->frame >= 0 ? env->stack + env->frame : NULL;
+        
+        sp = stack + calls[callcount].sp;
+        cp = counters + calls[callcount].counters;
+        *sp++ = calls[callcount].discard ? 0.0f : val;
+        pc = calls[callcount].pc;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_DEFINE)
+    {
+        func_define(env, pc[0].ast);
+        pc ++;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_EXIT)
+    {
+        env->shouldExit = true;
+        goto halt;
+    }
+    
+    VM_OP(VM_HELP)
+    {
+        print_help(env);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_STATS)
+    {
+        memo_print_stats(env);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_ECHO)
+    {
+        vm_format format = pc[0].i;
+        float val = format != VM_FORMAT_STRING ? *--sp : 0.0f;
+        env_print(env, "%s\n", vm_format_value(buf, sizeof(buf), format, pc[1].s, val));
+        pc += 2;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_LOAD)
+    {
+        if(loads >= VM_MAX_LOADS)
+        {
+            env_error(env, "-!- Unable to load %s: files nested more than %d deep\n", pc[0].s, VM_MAX_LOADS);
+            pc ++;
+            VM_NEXT();
+        }
+        
+        /* Unreadable Files Were Reported by scan_file, Empty Ones Have Nothing to Run */
+        struct ast_node* ast = scan_file(env, pc[0].s);
+        pc ++;
+        if(ast == NULL)
+        {
+            VM_NEXT();
+        }
+        
+        struct vm_chunk* loaded = vm_compile(ast);
+        
+        /* Runs Until VM_HALT, Top Level Code Has No Locals */
+        sp = vm_reserve_stack(&stack, &stackcapacity, sp, loaded->maxdepth + 1);
+        
+        struct vm_call* call = vm_push_call(&calls, &callcount, &callcapacity);
+        call->pc = pc;
+        call->sp = sp - stack;
+        call->counters = cp - counters;
+        call->frame = env->frame;
+        call->loaded = loaded;
+        call->ast = ast;
+        loads ++;
+        
+        pc = loaded->code;
+        VM_TICK();
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_SET_COLOR)
+    {
+        int r = clamp((int) sp[-3], 0, 255);
+        int g = clamp((int) sp[-2], 0, 255);
+        int b = clamp((int) sp[-1], 0, 255);
+        sp -= 3;
+        
+        vm_turtle(env, VM_SET_COLOR, r, g, b);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_FORWARD)
+    {
+        int param = (int) *--sp;
+        vm_turtle(env, VM_TURT_FORWARD, param != 0 ? param : 20, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_BACKWARD)
+    {
+        int param = (int) *--sp;
+        vm_turtle(env, VM_TURT_BACKWARD, param != 0 ? param : 20, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_LEFT)
+    {
+        float param = *--sp;
+        vm_turtle(env, VM_TURT_LEFT, param != 0.0f ? param : 90.0f, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_RIGHT)
+    {
+        float param = *--sp;
+        vm_turtle(env, VM_TURT_RIGHT, param != 0.0f ? param : 90.0f, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_PENDOWN)
+    {
+        vm_turtle(env, VM_TURT_PENDOWN, 0, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_PENUP)
+    {
+        vm_turtle(env, VM_TURT_PENUP, 0, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_HIDE)
+    {
+        vm_turtle(env, VM_TURT_HIDE, 0, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_SHOW)
+    {
+        vm_turtle(env, VM_TURT_SHOW, 0, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_WRITE)
+    {
+        vm_format format = pc[0].i;
+        float val = format != VM_FORMAT_STRING ? *--sp : 0.0f;
+        struct turtle_cmd cmd;
+        cmd.op = VM_TURT_WRITE;
+        
+        /* Strings Are Interned, Only Formatted Numbers Need Copying */
+        const char* text = vm_format_value(cmd.text, sizeof(cmd.text), format, pc[1].s, val);
+        cmd.str = text != cmd.text ? text : NULL;
+        turtle_emit(env, &cmd);
+        pc += 2;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_CENTERED_CIRCLE)
+    {
+        int param = (int) *--sp;
+        vm_turtle(env, VM_TURT_CENTERED_CIRCLE, param != 0 ? param : 20, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_CIRCLE)
+    {
+        int param = (int) *--sp;
+        vm_turtle(env, VM_TURT_CIRCLE, param != 0 ? param : 20, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_ARC)
+    {
+        vm_turtle(env, VM_TURT_ARC, (int) sp[-2], sp[-1], 0);
+        sp -= 2;
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_HOME)
+    {
+        vm_turtle(env, VM_TURT_HOME, 0, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_CLEAR)
+    {
+        vm_turtle(env, VM_TURT_CLEAR, 0, 0, 0);
+        VM_NEXT();
+    }
+    
+    VM_OP(VM_TURT_RESET)
+    {
+        vm_turtle(env, VM_TURT_RESET, 0, 0, 0);
+        VM_NEXT();
+    }
+
+#ifndef VM_THREADED
+        default:
+            fprintf(stderr, "*** FATAL: invalid VM opcode\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+
+yield:
+    status = VM_YIELDED;
+    goto save;
+    
+halt:
+    status = VM_DONE;
+    
+save:
+    state->pc = pc;
+    state->stack = stack;
+    state->sp = sp - stack;
+    state->stackcapacity = stackcapacity;
+    state->counters = counters;
+    state->countercount = cp - counters;
+    state->countercapacity = countercapacity;
+    state->calls = calls;
+    state->callcount = callcount;
+    state->callcapacity = callcapacity;
+    state->loads = loads;
+    
+    return status;
+
+#undef VM_OP
+#undef VM_NEXT
+#undef VM_TICK
+}
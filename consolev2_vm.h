@@ -0,0 +1,207 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * MTurtle Console
+ * Bytecode compiler and virtual machine
+ */
+
+#ifndef __CONSOLEV2_VM_H_
+#define __CONSOLEV2_VM_H_
+
+#include "consolev2_common.h"
+
+/*
+ * CUSTOM TYPES
+ */
+
+/*
+ * Instructions are one word holding the opcode, followed by their
+ * operands. Operand counts are given next to each opcode; "s" is the
+ * effect of the instruction on the operand stack, "c" on the counter
+ * stack. Loop counters are ints, like the end values they are compared
+ * to, so that counting past 2^24 still moves on.
+ */
+
+typedef enum {
+    VM_HALT,                        /* end of top level code */
+    VM_PUSH,                        /* float value; s +1 */
+    VM_POP,                         /* s -1 */
+    VM_LOAD_GLOBAL,                 /* slot, name; s +1 */
+    VM_LOAD_LOCAL,                  /* local, slot, name; s +1 */
+    VM_STORE_GLOBAL,                /* slot, name; s -1 */
+    VM_STORE_LOCAL,                 /* local; s -1 */
+    VM_ADD,                         /* s -1 */
+    VM_SUB,
+    VM_MUL,
+    VM_DIV,
+    VM_MOD,
+    VM_NEG,                         /* s 0 */
+    VM_EQ,                          /* s -1 */
+    VM_NEQ,
+    VM_LESS,
+    VM_GREATER,
+    VM_LEQ,
+    VM_GEQ,
+    VM_NOT,                         /* s 0 */
+    VM_COS,                         /* s 0 */
+    VM_SIN,
+    VM_TAN,
+    VM_ABS,
+    VM_SQRT,
+    VM_LOG,
+    VM_LOG10,
+    VM_EXP,
+    VM_CEIL,
+    VM_FLOOR,
+    VM_RMDR,                        /* s -1 */
+    VM_MAX,
+    VM_MIN,
+    VM_JUMP,                        /* target */
+    VM_JUMP_IF_FALSE,               /* target; s -1 */
+    VM_JUMP_IF_TRUE,                /* target; s -1 */
+    VM_FOR_START,                   /* s -2, c +2 */
+    VM_FOR_TEST,                    /* exit target; s +1, or 0 on exit */
+    VM_FOR_NEXT,                    /* loop target */
+    VM_FOR_END,                     /* s +1, c -2 */
+    VM_REPEAT_START,                /* s -1, c +1 */
+    VM_REPEAT_TEST,                 /* exit target */
+    VM_REPEAT_END,                  /* c -1 */
+    VM_CALL,                        /* slot, argc, name; s 1 - argc */
+    VM_TAIL_CALL,                   /* slot, argc, name, discard; s 1 - argc */
+    VM_RETURN,                      /* s -1 */
+    VM_DEFINE,                      /* AST_FUNC node */
+    VM_EXIT,
+    VM_HELP,
+    VM_STATS,
+    VM_ECHO,                        /* format, string; s -1 unless string */
+    VM_LOAD,                        /* file name */
+    VM_SET_COLOR,                   /* s -3 */
+    VM_TURT_FORWARD,                /* s -1 */
+    VM_TURT_BACKWARD,               /* s -1 */
+    VM_TURT_LEFT,                   /* s -1 */
+    VM_TURT_RIGHT,                  /* s -1 */
+    VM_TURT_PENDOWN,
+    VM_TURT_PENUP,
+    VM_TURT_HIDE,
+    VM_TURT_SHOW,
+    VM_TURT_WRITE,                  /* format, string; s -1 unless string */
+    VM_TURT_CENTERED_CIRCLE,        /* s -1 */
+    VM_TURT_CIRCLE,                 /* s -1 */
+    VM_TURT_ARC,                    /* s -2 */
+    VM_TURT_HOME,
+    VM_TURT_CLEAR,
+    VM_TURT_RESET,
+    VM_OPCODE_COUNT
+} vm_opcode;
+
+typedef enum {
+    VM_FORMAT_STRING,
+    VM_FORMAT_BOOL,
+    VM_FORMAT_INT,
+    VM_FORMAT_FLOAT
+} vm_format;
+
+union vm_word {
+    int i;
+    float f;
+    char* s;
+    struct ast_node* ast;
+};
+
+struct vm_chunk {
+    union vm_word* code;
+    int size;
+    int capacity;
+    int maxdepth;                   /* operand stack size needed */
+};
+
+/*
+ * A tail call replaces the frame of the running function instead of
+ * pushing a new one, so the callee returns straight to our caller and
+ * recursion through "return f(...)" runs in constant space. A call
+ * that merely ends the function discards its result: the record then
+ * remembers to return 0 in its place. Loaded files are run like calls
+ * without a frame of their own.
+ */
+
+struct vm_call {
+    union vm_word* pc;              /* return address */
+    int sp;                         /* caller's stack height, arguments popped */
+    int counters;                   /* caller's counter stack height */
+    int frame;                      /* caller's frame base */
+    bool discard;                   /* return 0, not the callee's value */
+    struct memo_entry* memo;        /* where to remember the result, or NULL */
+    unsigned int stamp;             /* of memo when claimed */
+    struct vm_chunk* loaded;        /* code of a loaded file, or NULL */
+    struct ast_node* ast;           /* tree of a loaded file */
+};
+
+/*
+ * A program runs in slices: vm_resume returns once its budget of jumps,
+ * calls and loads is spent, and the program carries on from there at the
+ * next vm_resume, until it is done or stopped.
+ */
+
+#define VM_NO_BUDGET 0
+
+typedef enum {
+    VM_DONE,
+    VM_YIELDED
+} vm_status;
+
+struct vm_state {
+    struct exec_env* env;
+    union vm_word* pc;              /* next instruction */
+    float* stack;                   /* operand stack */
+    int sp;                         /* operand stack height */
+    int stackcapacity;
+    int* counters;                  /* counter stack, of running loops */
+    int countercount;
+    int countercapacity;
+    struct vm_call* calls;
+    int callcount;
+    int callcapacity;
+    int loads;                      /* loaded files still running */
+    int frame;                      /* env->frame on start, restored on stop */
+    int stacksize;                  /* env->stacksize on start */
+};
+
+/*
+ * VM COMPILER API
+ */
+
+struct vm_chunk* vm_compile(struct ast_node* ast);
+
+struct vm_chunk* vm_compile_function(struct ast_node* body);
+
+void vm_free(struct vm_chunk* chunk);
+
+/*
+ * VM EXECUTION API
+ */
+
+void vm_start(struct vm_state* state, struct exec_env* env, struct vm_chunk* chunk);
+
+vm_status vm_resume(struct vm_state* state, int budget);
+
+void vm_stop(struct vm_state* state);
+
+void vm_run(struct exec_env* env, struct vm_chunk* chunk);
+
+#endif /* __CONSOLEV2_VM_H_ */
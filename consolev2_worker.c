@@ -0,0 +1,279 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * Evaluation thread and turtle command queue
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "MTurtle.h"
+#include "consolev2_common.h"
+#include "consolev2_vm.h"
+#include "consolev2_worker.h"
+
+/* Commands Applied Between Clock Checks While Draining */
+#define WORKER_DRAIN_BATCH 64
+
+/*
+ * TURTLE COMMAND API
+ */
+
+void turtle_apply(struct exec_env* env, struct turtle_cmd* cmd)
+{
+    /* Runs on the SDL Thread, Arguments Are Already Evaluated */
+    switch(cmd->op)
+    {
+    case VM_SET_COLOR:
+        TT_SetColor(env->turt, (int) cmd->args[0], (int) cmd->args[1], (int) cmd->args[2]);
+        break;
+    case VM_TURT_FORWARD:
+        TT_Forward(env->turt, (int) cmd->args[0]);
+        break;
+    case VM_TURT_BACKWARD:
+        TT_Backward(env->turt, (int) cmd->args[0]);
+        break;
+    case VM_TURT_LEFT:
+        TT_Left(env->turt, cmd->args[0]);
+        break;
+    case VM_TURT_RIGHT:
+        TT_Right(env->turt, cmd->args[0]);
+        break;
+    case VM_TURT_PENDOWN:
+        TT_PenDown(env->turt);
+        break;
+    case VM_TURT_PENUP:
+        TT_PenUp(env->turt);
+        break;
+    case VM_TURT_HIDE:
+        TT_HideTurtle(env->turt);
+        break;
+    case VM_TURT_SHOW:
+        TT_ShowTurtle(env->turt);
+        break;
+    case VM_TURT_WRITE:
+        TT_WriteText(env->turt, (char*) (cmd->str != NULL ? cmd->str : cmd->text));
+        break;
+    case VM_TURT_CENTERED_CIRCLE:
+        TT_CenteredCircle(env->turt, (int) cmd->args[0]);
+        break;
+    case VM_TURT_CIRCLE:
+        TT_Circle(env->turt, (int) cmd->args[0]);
+        break;
+    case VM_TURT_ARC:
+        TT_Arc(env->turt, (int) cmd->args[0], cmd->args[1]);
+        break;
+    case VM_TURT_HOME:
+        TT_Home(env->turt);
+        break;
+    case VM_TURT_CLEAR:
+        TT_Clear(env->turt);
+        break;
+    case VM_TURT_RESET:
+        TT_Reset(env->turt);
+        break;
+    case VM_ECHO:
+        SDL_TerminalPrint(env->term, "%s", cmd->str != NULL ? cmd->str : cmd->text);
+        break;
+    default:
+        break;
+    }
+}
+
+void worker_push(struct worker* w, struct turtle_cmd* cmd)
+{
+    /* Wait for Room, the SDL Thread Drains the Queue Until VM_HALT */
+    unsigned head = w->head;
+    
+    while(head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == WORKER_RING_SIZE)
+    {
+        SDL_Delay(1);
+    }
+    
+    w->ring[head & (WORKER_RING_SIZE - 1)] = *cmd;
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void turtle_emit(struct exec_env* env, struct turtle_cmd* cmd)
+{
+    /* The SDL Thread Only Emits When Idle, Parsing a Command */
+    if(env->worker != NULL && env->worker->busy)
+    {
+        /* Drawing Is Pointless Once Interrupted */
+        if(!__atomic_load_n(&env->worker->cancel, __ATOMIC_RELAXED))
+        {
+            worker_push(env->worker, cmd);
+        }
+    }
+    else
+    {
+        turtle_apply(env, cmd);
+    }
+}
+
+/*
+ * WORKER API
+ */
+
+int worker_main(void* data)
+{
+    struct worker* w = data;
+    
+    for(;;)
+    {
+        SDL_SemWait(w->jobs);
+        if(w->chunk == NULL)
+        {
+            break;
+        }
+        
+        struct vm_state state;
+        vm_start(&state, w->env, w->chunk);
+        
+        while(!__atomic_load_n(&w->cancel, __ATOMIC_RELAXED) && vm_resume(&state, WORKER_SLICE_BUDGET) == VM_YIELDED);
+        
+        vm_stop(&state);
+        
+        /* Tell the SDL Thread */
+        struct turtle_cmd done;
+        done.op = VM_HALT;
+        worker_push(w, &done);
+    }
+    
+    return 0;
+}
+
+void worker_start(struct worker* w, struct exec_env* env)
+{
+    w->env = env;
+    w->head = 0;
+    w->tail = 0;
+    w->chunk = NULL;
+    w->cancel = 0;
+    w->busy = false;
+    w->jobs = SDL_CreateSemaphore(0);
+    w->thread = w->jobs != NULL ? SDL_CreateThread(worker_main, w) : NULL;
+    
+    /* Without a Thread, Programs Run and Draw on the SDL Thread */
+    env->worker = w->thread != NULL ? w : NULL;
+}
+
+void worker_run(struct worker* w, struct vm_chunk* chunk)
+{
+    if(w->thread == NULL)
+    {
+        vm_run(w->env, chunk);
+        w->busy = false;
+        return;
+    }
+    
+    w->chunk = chunk;
+    w->cancel = 0;
+    w->busy = true;
+    SDL_SemPost(w->jobs);
+}
+
+void worker_cancel(struct worker* w)
+{
+    if(w->busy)
+    {
+        __atomic_store_n(&w->cancel, 1, __ATOMIC_RELAXED);
+    }
+}
+
+bool worker_drain(struct worker* w, Uint32 deadline)
+{
+    /*
+     * Apply queued commands until the frame is due. Returns true once
+     * the running chunk is done, after which the environment belongs
+     * to the SDL thread again.
+     */
+    if(!w->busy)
+    {
+        return true;
+    }
+    
+    unsigned tail = w->tail;
+    int batch = 0;
+    
+    for(;;)
+    {
+        unsigned head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        
+        while(tail != head)
+        {
+            struct turtle_cmd* cmd = &w->ring[tail & (WORKER_RING_SIZE - 1)];
+            
+            if(cmd->op == VM_HALT)
+            {
+                __atomic_store_n(&w->tail, tail + 1, __ATOMIC_RELEASE);
+                w->busy = false;
+                return true;
+            }
+            
+            turtle_apply(w->env, cmd);
+            tail ++;
+            
+            if(++ batch == WORKER_DRAIN_BATCH)
+            {
+                /* Free Room for the Worker, Then Check the Clock */
+                __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+                batch = 0;
+                
+                if(SDL_GetTicks() >= deadline)
+                {
+                    return false;
+                }
+            }
+        }
+        
+        __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+        
+        /* Queue Is Empty, Wait for More Until the Frame Is Due */
+        if(SDL_GetTicks() >= deadline)
+        {
+            return false;
+        }
+        SDL_Delay(1);
+    }
+}
+
+void worker_stop(struct worker* w)
+{
+    /* Interrupt the Running Chunk and Wait Until It Is Done */
+    worker_cancel(w);
+    while(!worker_drain(w, SDL_GetTicks() + 1000))
+    {
+        SDL_Delay(1);
+    }
+    
+    if(w->thread != NULL)
+    {
+        w->chunk = NULL;
+        SDL_SemPost(w->jobs);
+        SDL_WaitThread(w->thread, NULL);
+    }
+    if(w->jobs != NULL)
+    {
+        SDL_DestroySemaphore(w->jobs);
+    }
+    
+    w->env->worker = NULL;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2015 Mathias Leyendecker / University of Strasbourg
+ *
+ * This file is part of MTurtle.
+ * MTurtle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MTurtle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MTurtle.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ====================================================================
+ *
+ * MTurtle Console
+ * Evaluation thread and turtle command queue
+ */
+
+#ifndef __CONSOLEV2_WORKER_H_
+#define __CONSOLEV2_WORKER_H_
+
+#include <stdbool.h>
+#include "consolev2_common.h"
+#include "consolev2_vm.h"
+
+/*
+ * CUSTOM TYPES
+ */
+
+/*
+ * Programs run on a worker thread, which does not draw: it sends each
+ * turtle operation and each line of output to the SDL thread through a
+ * ring buffer with one producer and one consumer. Each side only writes
+ * its own index, so neither ever takes a lock.
+ */
+
+#define WORKER_RING_SIZE 4096           /* commands, a power of two */
+#define WORKER_SLICE_BUDGET 4096        /* jumps, calls and loads between cancel checks */
+#define TURTLE_TEXT_SIZE 48
+
+struct turtle_cmd {
+    vm_opcode op;                   /* turtle opcode, VM_SET_COLOR, VM_ECHO, or VM_HALT when done */
+    float args[3];
+    const char* str;                /* interned text, or NULL to use text */
+    char text[TURTLE_TEXT_SIZE];
+};
+
+struct worker {
+    struct exec_env* env;
+    struct turtle_cmd ring[WORKER_RING_SIZE];
+    unsigned head;                  /* next write, only stored by the worker */
+    unsigned tail;                  /* next read, only stored by the SDL thread */
+    SDL_Thread* thread;
+    SDL_sem* jobs;                  /* posted once per chunk to run */
+    struct vm_chunk* chunk;         /* chunk to run, NULL to quit */
+    int cancel;
+    bool busy;                      /* a chunk runs, seen from the SDL thread */
+};
+
+/*
+ * TURTLE COMMAND API
+ */
+
+void turtle_apply(struct exec_env* env, struct turtle_cmd* cmd);
+
+void turtle_emit(struct exec_env* env, struct turtle_cmd* cmd);
+
+/*
+ * WORKER API
+ */
+
+void worker_start(struct worker* w, struct exec_env* env);
+
+void worker_run(struct worker* w, struct vm_chunk* chunk);
+
+void worker_cancel(struct worker* w);
+
+bool worker_drain(struct worker* w, Uint32 deadline);
+
+void worker_stop(struct worker* w);
+
+#endif /* __CONSOLEV2_WORKER_H_ */